@@ -32,12 +32,38 @@
  * SERVICE    - Associated service name from system database
  * PROCESS    - Detailed process information (Name, PID, User)
  *
+ * Operating Modes:
+ * (default)   - Connect scan of the port range with state/service/process columns
+ * --latency   - Repeatedly times connects (and optionally first byte) against
+ *               discovered or specified listeners at a controlled rate and
+ *               prints per-port latency distributions
+ * --stream    - Lists sockets straight from the kernel socket tables with
+ *               process attribution, using constant memory per socket
+ * --list      - Loads all sockets into a columnar table for fast filter/sort
+ * --agent     - Sends the local listener set (snapshot, then deltas) to a collector
+ * --collect   - Merges agent streams into one (host, proto, port) index
+ * --query     - Asks a collector which hosts run which listeners
+ * --snapshot  - Writes the listener set (optionally one --shard) as a sorted file
+ * --merge     - K-way merges sorted snapshot files with a loser tree
+ * --probe     - Concurrent connect scan with resumable application probes
+ * --verify    - Connect-probes only the kernel's listeners to find filtered ones
+ * --reach     - Probes the listeners from every network namespace (setns threads)
+ * --udp       - Active UDP scan with protocol payloads, paced to ICMP rate limits
+ * --watch     - Prints listener changes periodically, gated by a cheap fingerprint
+ * --ephemeral - Reports destinations close to ephemeral port exhaustion
+ * --leaks     - Tracks per-process CLOSE_WAIT/FIN_WAIT2 growth across ticks
+ * --mem       - Socket buffer memory, queued bytes and drops per process/listener
+ * --fds       - Processes close to their open-file limit, from the owner fd walk
+ *
  * Usage Notes:
  * - Requires root/sudo privileges for complete system access
  * - May take several minutes for full port range scan
  * - CPU intensive during operation
+ * - Run with --help for the list of options
  */
 
+#define _GNU_SOURCE // Enables clock_nanosleep and other POSIX/GNU extensions
+
 // System includes for core functionality
 #include <stdio.h>  // Provides: printf, fprintf, fopen, fclose, FILE*, etc.
 #include <stdlib.h> // Provides: atoi, exit, malloc, free, etc.
@@ -45,15 +71,49 @@
 #include <unistd.h> // Provides: close, getpid, access, etc.
 #include <errno.h>  // Provides: errno variable and error definitions
 #include <ctype.h>  // Provides: isdigit and other character classification
+#include <time.h>   // Provides: clock_gettime, clock_nanosleep, struct timespec
+#include <fcntl.h>  // Provides: fcntl, O_NONBLOCK
+#include <poll.h>   // Provides: poll, struct pollfd
+#include <stdarg.h> // Provides: va_list for the buffered output writer
+#include <strings.h> // Provides: strcasecmp
+#include <stdint.h>  // Provides: fixed-width integers for the wire format
+#include <pthread.h> // Provides: pthread_create for the --reach namespace workers
+#include <sched.h>   // Provides: setns, CLONE_NEWNET
+#include <stdatomic.h> // Provides: atomic work counter shared by --reach workers
+#ifdef __SSE2__
+#include <emmintrin.h> // Provides: SSE2 intrinsics for the column filters
+#endif
 
 // Network-specific includes
 #include <sys/socket.h> // Provides: socket, connect, bind, sockaddr structs
 #include <arpa/inet.h>  // Provides: inet_addr, htons, sockaddr_in
 #include <netdb.h>      // Provides: getservbyport, struct servent
+#include <sys/un.h>     // Provides: sockaddr_un for Unix-socket collector endpoints
+#include <sys/epoll.h>  // Provides: epoll for the fleet collector
+#include <net/if.h>     // Provides: if_indextoname for packet sockets
+#include <ifaddrs.h>    // Provides: getifaddrs for --reach host addresses
+#include <linux/errqueue.h> // Provides: sock_extended_err for --udp ICMP errors
+#include <linux/netlink.h>   // Provides: netlink message macros for sock_diag
+#include <linux/sock_diag.h> // Provides: SOCK_DIAG_BY_FAMILY
+#include <linux/inet_diag.h> // Provides: inet_diag_req_v2 / inet_diag_msg
+#include <linux/rtnetlink.h> // Provides: RTA_* macros for inet_diag attributes
 
 // Process and filesystem includes
 #include <dirent.h> // Provides: opendir, readdir, struct dirent
 #include <pwd.h>    // Provides: getpwuid, struct passwd
+#include <sys/mman.h> // Provides: mmap for the --fast-names file tables
+#include <sys/stat.h> // Provides: fstat, struct stat
+#include <sys/resource.h> // Provides: getrlimit/setrlimit for probe descriptor budgets
+#include <sys/uio.h>  // Provides: writev for ordered chunk output
+#include <limits.h>   // Provides: IOV_MAX, UINT_MAX
+#include <sys/syscall.h>   // Provides: __NR_io_uring_setup / __NR_io_uring_enter
+#include <linux/io_uring.h> // Provides: io_uring SQE/CQE layout for the fd walk
+#include <linux/bpf.h>      // Provides: bpf_attr / bpf_insn for the BPF fd walk
+#include <linux/btf.h>      // Provides: BTF type layout to place its loads
+#include <elf.h>            // Provides: ELF headers and notes for --exe build IDs
+#include <stddef.h>         // Provides: offsetof for the --exe cache key
+#include <malloc.h>         // Provides: malloc_usable_size for the allocation accounting
+#include <linux/perf_event.h> // Provides: perf_event_attr for the --stats counters
 
 // Program constants with detailed explanations
 #define START_PORT 1   // Initial port number to begin scanning (lowest valid TCP port)
@@ -62,95 +122,489 @@
 #define COL_STATE 12   // Width of STATE column (fits "ESTABLISHED" plus padding)
 #define COL_SERVICE 20 // Width of SERVICE column (fits common service names plus padding)
 #define COL_PROC 30    // Width of PROCESS column (fits process details plus padding)
+#define COL_PROTO 8    // Width of PROTO column (fits "netlink")
+#define COL_ADDR 24    // Width of LOCAL/REMOTE columns (fits "255.255.255.255:65535")
+#define COL_PID 7      // Width of PID column
+
+// Streaming buffers: fixed sizes keep memory independent of the socket count
+#define READ_BUF_SIZE 65536 // Socket-table read buffer
+#define OUT_BUF_SIZE 65536  // Output buffer flushed with write()
+#define OUT_LINE_MAX 512    // Longest formatted output line
+#define TABLE_MAX_COLS 13   // Columns of a measured table
+#define TABLE_GAP 1         // Blanks between table columns
+#define SER_MAX_THREADS 64  // Most --list serialization workers
+#define SER_MIN_ROWS 16384  // Rows per worker below which fewer workers are used
+#define INODE_GROUP 16      // Inode index slots probed per SSE2 compare
+#define INODE_EMPTY 0x80    // Control byte of a free slot (tags use the low 7 bits)
+
+// Socket tables (index into sock_tables[])
+#define PROTO_TCP 0
+#define PROTO_TCP6 1
+#define PROTO_UDP 2
+#define PROTO_UDP6 3
+#define PROTO_RAW 4
+#define PROTO_RAW6 5
+#define PROTO_PACKET 6
+#define PROTO_NETLINK 7
+#define NUM_PROTOS 8
+
+// Fleet wire protocol (see the "Fleet collection" section)
+#define FRAME_MAGIC 0x5144     // "QD"
+#define FRAME_MAX (1 << 20)    // Largest accepted frame payload
+#define FRAME_BATCH 1024       // Records per UPSERT frame in a snapshot
+#define FRAME_HELLO 1          // Payload: agent host name
+#define FRAME_SNAP_BEGIN 2     // Start of a full snapshot (new generation)
+#define FRAME_UPSERT 3         // Payload: wire_rec array to add or replace
+#define FRAME_DELETE 4         // Payload: wire_rec array to remove (key fields only)
+#define FRAME_SNAP_END 5       // End of snapshot: drop entries not in it
+#define FRAME_QUERY 6          // Payload: PROTO_* mask, optional port bitmap
+#define FRAME_RESULT 7         // Payload: wire_rec followed by the host name
+#define FRAME_END 8            // End of a query reply
+#define FLEET_TOMB (~0ULL)     // Deleted-slot marker in the collector index
+#define AGENT_INTERVAL 10      // Default seconds between agent deltas
+#define GATE_MAX_SKIP 30       // Ticks the change gate may skip before forcing a full scan
+#define LEAK_METRICS 3         // --leaks counters: CLOSE_WAIT, FIN_WAIT2, sockets
+#define LEAK_MIN_SAMPLES 3     // Non-decreasing samples before growth is reported
+#define MEM_TOP 20             // Processes and listeners printed by --mem (--json: all)
+
+// Descriptor exhaustion (--fds)
+#define FDS_MIN_OPEN 64        // Descriptors from which a process's limit is read
+#define FDS_WARN_PCT 80        // Share of the limit counted as close to exhaustion
+#define FDS_TOP 20             // Processes printed
+
+// Ephemeral port pressure (--ephemeral)
+#define EPH_SLOTS (1 << 16)    // Tuple table slots (fixed: memory does not grow with sockets)
+#define EPH_MAX_TUPLES (EPH_SLOTS / 2) // Tuples tracked exactly before the table is thinned
+#define EPH_OWNERS 3           // Heaviest processes kept per tuple
+#define EPH_TOP 20             // Tuples printed
+#define EPH_WARN_PCT 50        // Usage of the port range counted as nearing exhaustion
+
+// Socket owner discovery (--fd-walk)
+#define FDWALK_AUTO 0          // Default: procfs (uring and bpf are opt-in)
+#define FDWALK_PROCFS 1        // readlinkat per /proc/<pid>/fd entry
+#define FDWALK_URING 2         // Batched IORING_OP_STATX
+#define FDWALK_BPF 3           // task_file BPF iterator (socket files only, one read)
+#define FDWALK_BATCH 256       // io_uring SQ entries (statx calls per io_uring_enter)
+#define FDWALK_THREADS 16      // Most procfs walk threads (one per CPU)
+#define FDWALK_MIN_PROCS 64    // Processes per procfs walk thread, at least
+
+// Run statistics (--stats)
+#define PHASE_PROBE 0          // Connect and application probes
+#define PHASE_WALK 1           // /proc/<pid>/fd traversal (any --fd-walk backend)
+#define PHASE_PARSE 2          // Socket table reads and sock_diag dumps
+#define PHASE_ATTRIB 3         // Owner identification and the inode index build
+#define PHASE_OUTPUT 4         // Formatting and writing results
+#define NUM_PHASES 5
+#define PERF_EVENTS 6          // task-clock, cycles, instructions, cache/branch misses, switches
+#define STATS_DEPTH 8          // Nested phases tracked per thread
+#define STATS_ROWS 256         // (phase, thread) pairs kept
+#define BPF_WALK_OTHER (1ULL << 63) // BPF fd walk: marks the word of a non-socket file
+
+// Probe engine (see the "Probe engine" section)
+#define PROBE_CONCURRENCY 1024 // Default probes in flight
+#define REACH_THREADS 32       // --reach worker threads (one namespace at a time each)
+#define UDP_RETRIES 2          // --udp re-sends of an unanswered probe
+#define UDP_WINDOW_MS 100      // --udp rate control window
+#define UDP_RATE_START 100     // --udp initial probes per second (remote targets)
+#define UDP_RATE_MIN 1         // --udp rate bounds (Linux answers 1 ICMP/s per peer by default)
+#define UDP_RATE_MAX 100000
+#define UDP_BURST 32           // --udp token bucket depth
+#define UDP_PENDING 0          // --udp port states
+#define UDP_OPEN 1             // Reply received
+#define UDP_CLOSED 2           // ICMP port unreachable
+#define UDP_FILTERED 3         // ICMP administratively prohibited / host unreachable
+#define UDP_SILENT 4           // No answer after all retries: open or filtered
+#define PROBE_REORDER_MIN 32768 // --probe reorder window in rows (32 bytes each), at least
+#define PROBE_REORDER_SPAN 4    // ... and at least this many times the concurrency
+#define PROBE_READ_SIZE 4096   // Shared receive buffer
+#define PROBE_CONNECT 0        // Probe kinds (index into probe_kinds[])
+#define PROBE_BANNER 1
+#define PROBE_REDIS 2
+#define PROBE_POSTGRES 3
+#define PROBE_HTTP 4
+#define PROBE_TLS 5
+#define RES_OPEN 1             // Probe outcomes
+#define RES_CLOSED 2
+#define RES_FILTERED 3
+#define RES_ERROR 4
+#define EV_CONNECTED 1         // Events fed to probe state machines
+#define EV_READ 2
+#define EV_EOF 3
+#define EV_TIMEOUT 4
+#define STEP_READ 0            // State machine wants more input
+#define STEP_DONE 1            // State machine finished
+#define TLS_REC_TYPE 1         // TLS ServerHello parse states
+#define TLS_REC_REST 2
+#define TLS_HS_TYPE 3
+#define TLS_HS_LEN 4
+#define TLS_VERSION 5
+#define TLS_RANDOM 6
+#define TLS_SID_LEN 7
+#define TLS_SID 8
+#define TLS_CIPHER 9
+#define TLS_COMP 10
+#define TLS_EXT_LEN 11
+#define TLS_EXT_TYPE 12
+#define TLS_EXT_SIZE 13
+#define TLS_EXT_SKIP 14
+#define TLS_SV 15
+
+// Columnar result set (see the "Columnar result set" section)
+#define NO_STRING 0xffffffffu  // String id of unattributed rows
+#define SORT_MAX_KEYS 8        // Keys accepted by --sort
+#define SORT_PROTO 0           // Sort columns (index into sort_names[])
+#define SORT_STATE 1
+#define SORT_PORT 2
+#define SORT_RPORT 3
+#define SORT_LOCAL 4
+#define SORT_REMOTE 5
+#define SORT_PID 6
+#define SORT_UID 7
+#define SORT_USER 8
+#define SORT_PROCESS 9
+#define SORT_INODE 10
+#define SORT_RMEM 11           // Memory columns, --list --mem only
+#define SORT_WMEM 12
+#define SORT_QUEUED 13
+#define SORT_DROPS 14
+#define MEM_NONE 0xffffffffu   // Memory cell of a socket inet_diag does not cover
+#define EXE_NONE 0             // --exe: no executable columns
+#define EXE_BUILDID 1          // Path and ELF build ID (content hash when there is none)
+#define EXE_SHA256 2           // Path and SHA-256 of the whole file
+
+// Latency mode defaults
+#define LAT_COUNT 100     // Connect samples taken per port
+#define LAT_RATE 100      // Connect attempts per second across all ports
+#define LAT_TIMEOUT 1000  // Connect and first-byte timeout in milliseconds
+
+// Operating modes selected on the command line
+#define MODE_SCAN 0    // Classic connect scan (default)
+#define MODE_LATENCY 1 // Connect-latency measurement
+#define MODE_STREAM 2  // Constant-memory socket-table listing
+#define MODE_AGENT 3   // Send listener snapshots/deltas to a collector
+#define MODE_COLLECT 4 // Merge agent streams and answer queries
+#define MODE_QUERY 5   // Query a collector
+#define MODE_SNAPSHOT 6 // Write the listener set as a snapshot file
+#define MODE_MERGE 7    // K-way merge of snapshot files
+#define MODE_DUMP 8     // Print a snapshot file
+#define MODE_PROBE 9    // Concurrent connect and application probes
+#define MODE_LIST 10    // Columnar load, filter and sort of the socket tables
+#define MODE_VERIFY 11  // Connect-probe only the kernel's listeners
+#define MODE_REACH 12   // Namespace x listener reachability matrix
+#define MODE_UDP 13     // Active UDP scan with protocol payloads
+#define MODE_WATCH 14   // Periodic listener change report
+#define MODE_EPHEMERAL 15 // Ephemeral port pressure per destination
+#define MODE_LEAKS 16   // Per-process CLOSE_WAIT / FIN_WAIT2 growth over time
+#define MODE_MEM 17     // Socket buffer memory per process and per listener
+#define MODE_FDS 18     // Processes close to their descriptor limit
+
+// Command line options
+struct options
+{
+    int mode;          // One of the MODE_* values
+    const char *host;  // Target IPv4 address in dotted notation
+    const char *ports; // Port list ("22,80,8000-8100"), NULL means full range
+    int count;         // Latency samples per port
+    int rate;          // Latency connects per second
+    int timeout_ms;    // Latency connect/first-byte timeout
+    int first_byte;    // Non-zero to also time the first byte sent by the service
+    int protos;        // Bitmask of PROTO_* socket tables to enumerate
+    const char *state; // Socket state filter name, NULL for all
+    const char *agent;   // Collector endpoint for --agent
+    const char *collect; // Listen endpoint for --collect
+    const char *query;   // Collector endpoint for --query
+    const char *name;    // Host name announced by --agent, NULL for gethostname()
+    int interval;        // Seconds between periodic ticks
+    long iterations;     // Periodic ticks to run, 0 for unlimited
+    int shard;           // This run's shard index (ports with port % shards == shard)
+    int shards;          // Number of shards, 0 when not sharding
+    const char *snapshot; // Output file for --snapshot ("-" for stdout)
+    const char *merge;   // Output file for --merge
+    const char *dump;    // Snapshot file for --dump
+    char **inputs;       // Positional input files for --merge
+    int ninputs;         // Number of inputs
+    int fast_names;      // Resolve users/services from /etc files before NSS
+    const char *probe;   // Probe kind for --probe ("auto" picks by port)
+    int concurrency;     // Probes in flight
+    const char *sort;    // --sort key list for --list
+    int pid;             // PID filter for --list, -1 for all
+    long uid;            // Socket uid filter for --list, -1 for all
+    const char *netns;   // --reach namespaces (PIDs or /run/netns names), NULL for all
+    int json;            // --json: --list output as a JSON array
+    int fd_walk;         // FDWALK_* backend for socket owner discovery
+    int mem;             // --mem: socket buffer memory report, or --list memory columns
+    int exe;             // EXE_* identity columns for --list
+    int stats;           // --stats: per-phase time and hardware counters on stderr at exit
+};
 
 // Global process ID variable
 pid_t our_pid; // Stores the scanner's own process ID for self-connection filtering
 
-// Function to get process information
-char *get_process_info(int port)
+// Global options, filled in by parse_options()
+struct options opts = {MODE_SCAN, "127.0.0.1", NULL, LAT_COUNT, LAT_RATE, LAT_TIMEOUT, 0,
+                       (1 << NUM_PROTOS) - 1, NULL, NULL, NULL, NULL, NULL, AGENT_INTERVAL, 0,
+                       0, 0, NULL, NULL, NULL, NULL, 0, 0, NULL, PROBE_CONCURRENCY,
+                       NULL, -1, -1, NULL, 0, FDWALK_AUTO, 0, EXE_NONE, 0};
+
+// ---------------------------------------------------------------------------
+// Allocation accounting
+//
+// Every heap block of the scanner comes from alloc_realloc, alloc_calloc or
+// alloc_aligned and goes back through alloc_free. With --stats they count the
+// allocations and requested bytes of the running phase and follow the live heap
+// by malloc_usable_size (no block header, so the blocks stay plain libc ones),
+// keeping the highest live heap reached by an allocation in each phase. libc's
+// own buffers (DIR streams, stdio, NSS) only show in VmHWM.
+// ---------------------------------------------------------------------------
+
+__thread int alloc_phase = NUM_PHASES;    // PHASE_* running on this thread, NUM_PHASES outside
+atomic_llong alloc_live;                  // Live heap bytes
+atomic_llong alloc_calls[NUM_PHASES + 1]; // Allocations and resizes per phase
+atomic_llong alloc_bytes[NUM_PHASES + 1]; // Bytes requested per phase
+atomic_llong alloc_peak[NUM_PHASES + 1];  // Highest live heap seen by an allocation per phase
+
+// Function to account one block changing from before to after usable bytes
+void alloc_account(size_t before, size_t after, size_t requested)
 {
-    DIR *proc_dir;                 // Directory pointer for /proc
-    struct dirent *entry;          // Directory entry structure
-    char path[256];                // Path buffer for file operations
-    char line[256];                // Line buffer for reading files
-    static char process_info[512]; // Buffer for process information
-    FILE *fp;                      // File pointer for reading files
+    int p = alloc_phase;
+    long long delta = (long long)after - (long long)before;
+    long long live = atomic_fetch_add(&alloc_live, delta) + delta;
+    long long peak = atomic_load(&alloc_peak[p]);
 
-    process_info[0] = '\0';      // Initialize process_info buffer
-    proc_dir = opendir("/proc"); // Open /proc directory
-    if (!proc_dir)
-        return process_info; // Return if directory cannot be opened
+    if (!after)
+        return; // A free: no new high-water mark
+    atomic_fetch_add(&alloc_calls[p], 1);
+    atomic_fetch_add(&alloc_bytes[p], (long long)requested);
+    while (live > peak && !atomic_compare_exchange_weak(&alloc_peak[p], &peak, live))
+        ; // Another thread raised it meanwhile: retry against its value
+}
 
-    while ((entry = readdir(proc_dir)) != NULL)
-    { // Read each entry in /proc
-        // Skip non-numeric and our own process
-        if (!isdigit(entry->d_name[0]) ||
-            atoi(entry->d_name) == our_pid)
-            continue;
-
-        snprintf(path, sizeof(path), "/proc/%s/net/tcp", entry->d_name); // Construct path to net/tcp file
-        fp = fopen(path, "r");                                           // Open net/tcp file
-        if (fp)
-        {
-            char local_addr[32]; // Buffer for local address
-            int local_port;      // Variable for local port
-            // Skip header line
-            fgets(line, sizeof(line), fp);
-            while (fgets(line, sizeof(line), fp))
-            { // Read each line in net/tcp
-                if (sscanf(line, "%*d: %[^:]:%X", local_addr, &local_port) == 2)
-                { // Parse local address and port
-                    if (local_port == port)
-                    { // Check if port matches
-                        // Get process details
-                        char comm_path[256];                                                          // Path buffer for comm file
-                        char status_path[256];                                                        // Path buffer for status file
-                        snprintf(comm_path, sizeof(comm_path), "/proc/%s/comm", entry->d_name);       // Construct path to comm file
-                        snprintf(status_path, sizeof(status_path), "/proc/%s/status", entry->d_name); // Construct path to status file
-
-                        FILE *comm_fp = fopen(comm_path, "r");     // Open comm file
-                        FILE *status_fp = fopen(status_path, "r"); // Open status file
-
-                        if (comm_fp && status_fp)
-                        {                          // Check if files are opened successfully
-                            char proc_name[256];   // Buffer for process name
-                            char status_line[256]; // Buffer for status line
-                            uid_t uid = 0;         // Variable for user ID
-
-                            // Get process name
-                            if (fgets(proc_name, sizeof(proc_name), comm_fp))
-                            {                                            // Read process name
-                                proc_name[strcspn(proc_name, "\n")] = 0; // Remove newline character
-
-                                // Get process owner
-                                while (fgets(status_line, sizeof(status_line), status_fp))
-                                { // Read each line in status file
-                                    if (strncmp(status_line, "Uid:", 4) == 0)
-                                    {                                          // Check if line contains UID
-                                        sscanf(status_line, "Uid:\t%d", &uid); // Parse UID
-                                        break;
-                                    }
-                                }
-
-                                struct passwd *pw = getpwuid(uid);           // Get user information
-                                snprintf(process_info, sizeof(process_info), // Format process information
-                                         "%-15s  PID: %-6s  User: %-8s",     // Format process information
-                                         proc_name,                          // Format process information
-                                         entry->d_name,                      // Format process information
-                                         pw ? pw->pw_name : "unknown");      // Format process information
-                            }
-                            fclose(comm_fp);   // Close comm file
-                            fclose(status_fp); // Close status file
-                        }
-                        break;
-                    }
-                }
-            }
-            fclose(fp); // Close net/tcp file
-        }
+// Function to allocate or resize a block (realloc semantics: NULL on failure)
+void *alloc_realloc(void *ptr, size_t size)
+{
+    size_t before = opts.stats && ptr ? malloc_usable_size(ptr) : 0;
+    void *p = realloc(ptr, size);
+    if (opts.stats && (p || !size))
+        alloc_account(before, p ? malloc_usable_size(p) : 0, size);
+    return p;
+}
+
+// Function to allocate a zeroed array (calloc semantics)
+void *alloc_calloc(size_t n, size_t size)
+{
+    void *p = calloc(n, size);
+    if (opts.stats && p)
+        alloc_account(0, malloc_usable_size(p), n * size);
+    return p;
+}
+
+// Function to allocate an aligned block (aligned_alloc semantics)
+void *alloc_aligned(size_t align, size_t size)
+{
+    void *p = aligned_alloc(align, size);
+    if (opts.stats && p)
+        alloc_account(0, malloc_usable_size(p), size);
+    return p;
+}
+
+// Function to release a block of any of the allocators above
+void alloc_free(void *ptr)
+{
+    if (opts.stats && ptr)
+        alloc_account(malloc_usable_size(ptr), 0, 0);
+    free(ptr);
+}
+
+// ---------------------------------------------------------------------------
+// NSS-free name resolution (--fast-names)
+//
+// getpwuid() and getservbyport() go through NSS, which may dlopen modules
+// and contact directory services. With --fast-names, /etc/passwd and
+// /etc/services are mmap'ed and parsed once into sorted (id, name) tables;
+// only ids missing from the files fall back to NSS.
+// ---------------------------------------------------------------------------
+
+// One id -> name mapping
+struct id_name
+{
+    unsigned int id;   // uid, or port * 2 + (proto == udp) for services
+    unsigned int name; // Offset of the name in the table's pool
+};
+
+// Compact id -> name table loaded from a flat file
+struct name_table
+{
+    struct id_name *ents; // Sorted by (id, file order)
+    size_t n, cap;        // Entries used / allocated
+    char *pool;           // NUL-terminated names
+    size_t len, pool_cap; // Pool bytes used / allocated
+    int loaded;           // Load attempted (successful or not)
+};
+
+struct name_table passwd_table;   // From /etc/passwd
+struct name_table services_table; // From /etc/services
+
+// Function to add one entry to a name table; silently drops it when out of memory
+void name_table_add(struct name_table *t, unsigned int id, const char *name, size_t len)
+{
+    if (t->n == t->cap)
+    {
+        size_t cap = t->cap ? t->cap * 2 : 128;
+        struct id_name *e = alloc_realloc(t->ents, cap * sizeof(*e));
+        if (!e)
+            return; // Lookup falls back to NSS
+        t->ents = e;
+        t->cap = cap;
+    }
+    if (t->len + len + 1 > t->pool_cap)
+    {
+        size_t cap = (t->len + len + 1) * 2;
+        char *p = alloc_realloc(t->pool, cap);
+        if (!p)
+            return;
+        t->pool = p;
+        t->pool_cap = cap;
+    }
+    memcpy(t->pool + t->len, name, len);
+    t->pool[t->len + len] = '\0';
+    t->ents[t->n].id = id;
+    t->ents[t->n].name = (unsigned int)t->len;
+    t->n++;
+    t->len += len + 1;
+}
+
+// Function to order table entries by id, then by position in the file (pool offset)
+int cmp_id_name(const void *a, const void *b)
+{
+    const struct id_name *x = a, *y = b;
+    if (x->id != y->id)
+        return x->id < y->id ? -1 : 1;
+    return x->name < y->name ? -1 : x->name > y->name; // First line in the file wins
+}
+
+// Function to mmap a file and hand each line to a parser, then sort the table
+void name_table_load(struct name_table *t, const char *path,
+                     void (*parse)(struct name_table *, const char *, const char *))
+{
+    struct stat st; // File size
+    t->loaded = 1;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return;
+    if (fstat(fd, &st) < 0 || st.st_size == 0)
+    {
+        close(fd);
+        return;
+    }
+    const char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return;
+    for (const char *line = map, *end = map + st.st_size; line < end;)
+    {
+        const char *eol = memchr(line, '\n', end - line); // End of this line
+        if (!eol)
+            eol = end;
+        parse(t, line, eol);
+        line = eol + 1;
+    }
+    munmap((void *)map, st.st_size);
+    qsort(t->ents, t->n, sizeof(*t->ents), cmp_id_name);
+}
+
+// Function to parse the decimal number at p, stopping at eol: mapped lines are not
+// NUL-terminated. Stores the end in *next; values above UINT_MAX saturate to it + 1.
+unsigned long long parse_digits(const char *p, const char *eol, const char **next)
+{
+    unsigned long long v = 0; // Value so far
+    for (; p < eol && isdigit((unsigned char)*p); p++)
+        if ((v = v * 10 + (unsigned)(*p - '0')) > UINT_MAX)
+            v = (unsigned long long)UINT_MAX + 1; // Out of range for any caller
+    *next = p;
+    return v;
+}
+
+// Function to parse one /etc/passwd line: name:passwd:uid:...
+void parse_passwd_line(struct name_table *t, const char *line, const char *eol)
+{
+    const char *c1 = memchr(line, ':', eol - line); // End of the name
+    if (!c1 || c1 == line || *line == '+' || *line == '-' || *line == '#')
+        return; // Malformed, NIS compat or comment
+    const char *c2 = memchr(c1 + 1, ':', eol - c1 - 1); // End of the password field
+    if (!c2 || c2 + 1 >= eol || !isdigit((unsigned char)c2[1]))
+        return;
+    const char *end; // After the uid
+    unsigned long long uid = parse_digits(c2 + 1, eol, &end);
+    if (uid > UINT_MAX || (end < eol && *end != ':'))
+        return;
+    name_table_add(t, (unsigned int)uid, line, c1 - line);
+}
+
+// Function to parse one /etc/services line: name port/proto [aliases] [# comment]
+void parse_services_line(struct name_table *t, const char *line, const char *eol)
+{
+    const char *p = line; // Parse cursor
+    while (p < eol && !isspace((unsigned char)*p) && *p != '#')
+        p++;
+    size_t len = p - line; // Name length
+    if (len == 0)
+        return; // Blank or comment line
+    while (p < eol && (*p == ' ' || *p == '\t'))
+        p++;
+    if (p == eol || !isdigit((unsigned char)*p))
+        return;
+    unsigned long long port = parse_digits(p, eol, &p);
+    if (port > END_PORT || p + 4 > eol || *p != '/')
+        return;
+    if (strncmp(p + 1, "tcp", 3) == 0)
+        name_table_add(t, (unsigned int)port * 2, line, len);
+    else if (strncmp(p + 1, "udp", 3) == 0)
+        name_table_add(t, (unsigned int)port * 2 + 1, line, len);
+}
+
+// Function to find the first name for an id, NULL when absent
+const char *name_table_find(const struct name_table *t, unsigned int id)
+{
+    size_t lo = 0, hi = t->n; // Leftmost match by binary search
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (t->ents[mid].id < id)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < t->n && t->ents[lo].id == id ? t->pool + t->ents[lo].name : NULL;
+}
+
+// Function to resolve a uid to a user name (files first with --fast-names, then NSS)
+const char *resolve_user(unsigned int uid)
+{
+    if (opts.fast_names)
+    {
+        if (!passwd_table.loaded)
+            name_table_load(&passwd_table, "/etc/passwd", parse_passwd_line);
+        const char *name = name_table_find(&passwd_table, uid);
+        if (name)
+            return name;
+    }
+    struct passwd *pw = getpwuid(uid); // NSS for everything not in the file
+    return pw ? pw->pw_name : NULL;
+}
+
+// Function to resolve a port to a service name (files first with --fast-names, then NSS)
+const char *resolve_service(int port, const char *proto)
+{
+    if (opts.fast_names)
+    {
+        if (!services_table.loaded)
+            name_table_load(&services_table, "/etc/services", parse_services_line);
+        const char *name = name_table_find(&services_table, port * 2 + (strcmp(proto, "udp") == 0));
+        if (name)
+            return name;
     }
-    closedir(proc_dir);  // Close /proc directory
-    return process_info; // Return process information
+    struct servent *se = getservbyport(htons(port), proto); // NSS for unknown ports
+    return se ? se->s_name : NULL;
 }
 
 // Function to check detailed port state
@@ -168,7 +622,7 @@ int check_port_state(int port)
 
     memset(&addr, 0, sizeof(addr));                // Clear address structure
     addr.sin_family = AF_INET;                     // Set address family to IPv4
-    addr.sin_addr.s_addr = inet_addr("127.0.0.1"); // Set address to localhost
+    addr.sin_addr.s_addr = inet_addr(opts.host);   // Set address to scan target
     addr.sin_port = htons(port);                   // Set port number
 
     // If we can connect twice, it's likely a listening socket
@@ -182,38 +636,8325 @@ int check_port_state(int port)
     return 1;         // ESTABLISHED/SINGLE CONNECTION
 }
 
-// Main program entry point
-int main(void) // void explicitly states no parameters are expected
+// Function to parse a port list such as "22,80,8000-8100" into a port bitmap
+int parse_port_list(const char *spec, unsigned char *set)
 {
-    // Store our own process ID to avoid self-detection later
-    our_pid = getpid();
+    int count = 0; // Number of distinct ports marked in the bitmap
 
-    // Initialize required structures for socket operations
-    struct servent *service; // Will hold service information from system database
-    struct sockaddr_in addr; // Will hold socket addressing information
-    int sock;                // Will store socket file descriptor
+    memset(set, 0, (END_PORT + 1) / 8); // Start from an empty set
+    while (*spec)
+    {
+        char *end;                          // End of the parsed number
+        long lo = strtol(spec, &end, 10);   // First port of the range
+        long hi = lo;                       // Last port of the range (single port by default)
+        if (end == spec)
+            return -1; // Not a number
+        if (*end == '-')
+        {                                        // Range "lo-hi"
+            const char *next = end + 1;          // Start of the upper bound
+            hi = strtol(next, &end, 10);         // Parse upper bound
+            if (end == next)
+                return -1; // Missing upper bound
+        }
+        if (lo < START_PORT || hi > END_PORT || lo > hi)
+            return -1; // Out of range or reversed
+        for (long p = lo; p <= hi; p++)
+        { // Mark every port of the range once
+            if (!(set[p >> 3] & (1 << (p & 7))))
+                count++;
+            set[p >> 3] |= 1 << (p & 7);
+        }
+        if (*end == ',')
+            end++; // Skip separator
+        else if (*end)
+            return -1; // Garbage after number
+        spec = end;
+    }
+    return count;
+}
 
-    // Print program banner and scanning range
-    printf("Scanning %s ports %d to %d...\n\n", "127.0.0.1", START_PORT, END_PORT);
+// Function to test membership of a port in a bitmap built by parse_port_list()
+int port_in_set(const unsigned char *set, int port)
+{
+    return set[port >> 3] & (1 << (port & 7));
+}
 
-    // Print formatted header with column titles
-    printf("\nPort Scanner Results\n"); // Main title
-    printf("%-*s %-*s %-*s %-*s\n",     // Column headers with proper width
-           COL_PORT, "PORT",            // Port number column
-           COL_STATE, "STATE",          // Port state column
-           COL_SERVICE, "SERVICE",      // Service name column
-           COL_PROC, "PROCESS");        // Process information column
+// Function to read the monotonic clock in nanoseconds
+long long now_ns(void)
+{
+    struct timespec ts;                                  // Clock reading
+    clock_gettime(CLOCK_MONOTONIC, &ts);                 // Monotonic: immune to wall clock steps
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec; // Convert to nanoseconds
+}
 
-    // Print separator line for visual clarity
-    printf("%-*s %-*s %-*s %-*s\n",                     // Separator line with matching widths
-           COL_PORT, "--------",                        // Port column separator
-           COL_STATE, "-----------",                    // State column separator
-           COL_SERVICE, "-------------------",          // Service column separator
-           COL_PROC, "------------------------------"); // Process column separator
+// ---------------------------------------------------------------------------
+// Run statistics (--stats)
+//
+// Each thread opens one perf_event group on itself (task-clock leading cycles,
+// instructions, cache misses, branch misses and context switches) and reads it
+// at every phase boundary; the delta is charged to the innermost open phase,
+// so nested phases are accounted exclusively. Counters the kernel refuses (no
+// PMU in a VM, perf_event_paranoid) are reported as '-', and without perf at
+// all only wall time is kept.
+// ---------------------------------------------------------------------------
 
-    // Scan each port in the specified range
+// Counters of one (phase, thread) pair
+struct stats_row
+{
+    int phase;                             // PHASE_* value
+    char thread[16];                       // Thread label ("main", "walk-1", ...)
+    long calls;                            // Times the phase was entered
+    long long wall_ns;                     // Wall time, nested phases excluded
+    unsigned long long count[PERF_EVENTS]; // Counter deltas, scaled for multiplexing
+};
+
+// Per-thread counter group and phase stack
+struct stats_thread
+{
+    int ready;                            // Group opened (or found unavailable)
+    int fd[PERF_EVENTS];                  // Event descriptors, -1 when refused; fd[0] leads
+    int slot[PERF_EVENTS];                // Position of each event in the group read
+    int depth;                            // Open phases
+    int stack[STATS_DEPTH];               // PHASE_* of the open phases, innermost last
+    long long last_ns;                    // Wall clock at the last boundary
+    unsigned long long last[PERF_EVENTS]; // Counters at the last boundary
+    char name[16];                        // Thread label
+};
+
+__thread struct stats_thread stats_self;  // This thread's group
+struct stats_row stats_rows[STATS_ROWS];  // Charged (phase, thread) pairs
+size_t nstats_rows;
+pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER; // Guards stats_rows
+int stats_have[PERF_EVENTS];              // Event opened on at least one thread
+int stats_errno[PERF_EVENTS];             // First refusal of each event
+int stats_user_only;                      // Some counter fell back to user space only
+long long stats_start_ns;                 // Clock when --stats was enabled
+const char *const phase_names[NUM_PHASES] = {"probe", "walk", "parse", "attribution", "output"};
+
+// Function to open this thread's counter group
+void stats_open(struct stats_thread *st)
+{
+    static const uint32_t type[PERF_EVENTS] = {PERF_TYPE_SOFTWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE,
+                                               PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_SOFTWARE};
+    static const uint64_t config[PERF_EVENTS] = {PERF_COUNT_SW_TASK_CLOCK, PERF_COUNT_HW_CPU_CYCLES,
+                                                 PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES,
+                                                 PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_SW_CONTEXT_SWITCHES};
+    int nopen = 0;
+
+    st->ready = 1;
+    if (!st->name[0])
+        snprintf(st->name, sizeof(st->name), "%s", syscall(SYS_gettid) == our_pid ? "main" : "thread");
+    for (int e = 0; e < PERF_EVENTS; e++)
+    {
+        struct perf_event_attr attr; // One counter of the group
+        st->fd[e] = st->slot[e] = -1;
+        if (e > 0 && st->fd[0] < 0)
+            continue; // No leader, no group
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type[e];
+        attr.config = config[e];
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                           PERF_FORMAT_TOTAL_TIME_RUNNING;
+        // The walks are mostly kernel work: count it when allowed, else user space only
+        st->fd[e] = (int)syscall(__NR_perf_event_open, &attr, 0, -1, e ? st->fd[0] : -1, PERF_FLAG_FD_CLOEXEC);
+        if (st->fd[e] < 0 && (errno == EACCES || errno == EPERM))
+        {
+            attr.exclude_kernel = attr.exclude_hv = 1;
+            st->fd[e] = (int)syscall(__NR_perf_event_open, &attr, 0, -1, e ? st->fd[0] : -1, PERF_FLAG_FD_CLOEXEC);
+            stats_user_only |= st->fd[e] >= 0;
+        }
+        pthread_mutex_lock(&stats_lock);
+        if (st->fd[e] >= 0)
+        {
+            st->slot[e] = nopen++;
+            stats_have[e] = 1;
+        }
+        else if (!stats_errno[e])
+            stats_errno[e] = errno;
+        pthread_mutex_unlock(&stats_lock);
+    }
+}
+
+// Function to read this thread's counters, scaled up when the group was multiplexed
+void stats_read(const struct stats_thread *st, unsigned long long *v)
+{
+    uint64_t buf[3 + PERF_EVENTS]; // nr, time enabled, time running, values
+    memset(v, 0, PERF_EVENTS * sizeof(*v));
+    if (st->fd[0] < 0 || read(st->fd[0], buf, sizeof(buf)) < (ssize_t)(3 * sizeof(uint64_t)))
+        return;
+    for (int e = 0; e < PERF_EVENTS; e++)
+    {
+        if (st->slot[e] < 0 || (uint64_t)st->slot[e] >= buf[0])
+            continue;
+        v[e] = buf[3 + st->slot[e]];
+        if (buf[2] && buf[2] < buf[1])
+            v[e] = (unsigned long long)((double)v[e] * buf[1] / buf[2]); // Ran part of the time
+    }
+}
+
+// Function to find (or add) the row of a phase on a thread; call with stats_lock held
+struct stats_row *stats_row(int phase, const char *thread)
+{
+    for (size_t i = 0; i < nstats_rows; i++)
+        if (stats_rows[i].phase == phase && strcmp(stats_rows[i].thread, thread) == 0)
+            return &stats_rows[i];
+    if (nstats_rows == STATS_ROWS)
+        return NULL; // Table full: drop the sample
+    struct stats_row *r = &stats_rows[nstats_rows++];
+    memset(r, 0, sizeof(*r));
+    r->phase = phase;
+    snprintf(r->thread, sizeof(r->thread), "%s", thread);
+    return r;
+}
+
+// Function to charge the time and counters since the last boundary to the open phase
+void stats_charge(struct stats_thread *st, int entering)
+{
+    unsigned long long v[PERF_EVENTS]; // Counters now
+    long long now = now_ns();
+
+    stats_read(st, v);
+    pthread_mutex_lock(&stats_lock);
+    struct stats_row *r = st->depth ? stats_row(st->stack[st->depth - 1], st->name) : NULL;
+    if (r)
+    {
+        r->wall_ns += now - st->last_ns;
+        for (int e = 0; e < PERF_EVENTS; e++)
+            r->count[e] += v[e] - st->last[e];
+    }
+    if (entering >= 0 && (r = stats_row(entering, st->name)) != NULL)
+        r->calls++;
+    pthread_mutex_unlock(&stats_lock);
+    st->last_ns = now;
+    memcpy(st->last, v, sizeof(v));
+}
+
+// Function to enter a phase on this thread (no-op without --stats)
+void stats_begin(int phase)
+{
+    struct stats_thread *st = &stats_self;
+    if (!opts.stats)
+        return;
+    if (!st->ready)
+        stats_open(st);
+    if (st->depth >= STATS_DEPTH)
+    { // Too deep: keep charging the innermost tracked phase
+        st->depth++;
+        return;
+    }
+    stats_charge(st, st->depth && st->stack[st->depth - 1] == phase ? -1 : phase); // Re-entry: one call
+    st->stack[st->depth++] = phase;
+    alloc_phase = phase;
+}
+
+// Function to leave the innermost phase on this thread
+void stats_end(void)
+{
+    struct stats_thread *st = &stats_self;
+    if (!opts.stats || !st->ready || st->depth == 0)
+        return;
+    if (st->depth <= STATS_DEPTH)
+        stats_charge(st, -1); // Before popping: the time belongs to the phase being left
+    st->depth--;
+    alloc_phase = st->depth ? st->stack[(st->depth < STATS_DEPTH ? st->depth : STATS_DEPTH) - 1] : NUM_PHASES;
+}
+
+// Function to label a worker thread ("walk-3"); the main thread keeps "main"
+void stats_thread_name(const char *kind, int index)
+{
+    if (opts.stats && syscall(SYS_gettid) != our_pid)
+        snprintf(stats_self.name, sizeof(stats_self.name), "%s-%d", kind, index);
+}
+
+// Function to close a worker thread's counters before it exits
+void stats_thread_done(void)
+{
+    struct stats_thread *st = &stats_self;
+    if (!opts.stats || !st->ready || syscall(SYS_gettid) == our_pid)
+        return;
+    for (int e = PERF_EVENTS - 1; e >= 0; e--)
+        if (st->fd[e] >= 0)
+            close(st->fd[e]);
+    memset(st, 0, sizeof(*st));
+}
+
+// Function to time one connect (and optionally the first received byte)
+// Returns 0 when the connect succeeded, -1 on refusal, timeout or error.
+// *first_byte_ns is set to -1 when no byte arrived before the timeout.
+int timed_connect(const struct sockaddr_in *addr, int timeout_ms, int want_first_byte,
+                  long long *connect_ns, long long *first_byte_ns)
+{
+    struct pollfd pfd;     // Poll descriptor for the probe socket
+    int err = 0;           // Pending socket error
+    socklen_t len = sizeof(err);
+    long long start;       // Timestamp taken right before connect()
+    struct linger lin = {1, 0}; // Abortive close: no TIME_WAIT pile-up from repeated probes
+
+    *first_byte_ns = -1;
+    int sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0); // Non-blocking so we can bound the wait
+    if (sock < 0)
+        return -1;
+    setsockopt(sock, SOL_SOCKET, SO_LINGER, &lin, sizeof(lin));
+
+    start = now_ns(); // Only the handshake is measured, not socket creation
+    if (connect(sock, (const struct sockaddr *)addr, sizeof(*addr)) < 0)
+    {
+        if (errno != EINPROGRESS)
+        { // Immediate refusal (typical on loopback)
+            close(sock);
+            return -1;
+        }
+        pfd.fd = sock;          // Wait for the handshake to complete
+        pfd.events = POLLOUT;
+        if (poll(&pfd, 1, timeout_ms) <= 0 ||
+            getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0)
+        { // Timed out or the handshake failed
+            close(sock);
+            return -1;
+        }
+    }
+    *connect_ns = now_ns() - start; // Handshake latency
+
+    if (want_first_byte)
+    {
+        char byte;             // The first byte itself is not used
+        pfd.fd = sock;         // Wait for the service to speak first
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, timeout_ms) > 0 && recv(sock, &byte, 1, 0) == 1)
+            *first_byte_ns = now_ns() - start; // Time to first byte, measured from connect()
+    }
+
+    close(sock); // Sends RST thanks to SO_LINGER {1, 0}
+    return 0;
+}
+
+// Function to compare two latency samples for qsort
+int cmp_ll(const void *a, const void *b)
+{
+    long long x = *(const long long *)a; // First sample
+    long long y = *(const long long *)b; // Second sample
+    return (x > y) - (x < y);
+}
+
+// Function to print one distribution row; samples are sorted in place
+void print_latency_row(int port, long long *samples, int n, int failed)
+{
+    long long sum = 0; // Sum for the mean
+
+    if (n == 0)
+    { // Nothing measured: every attempt failed
+        printf("%-*d %-8d %-6d %10s %10s %10s %10s %10s %10s\n",
+               COL_PORT, port, n, failed, "-", "-", "-", "-", "-", "-");
+        return;
+    }
+    qsort(samples, n, sizeof(*samples), cmp_ll); // Sort for nearest-rank percentiles
+    for (int i = 0; i < n; i++)
+        sum += samples[i];
+    printf("%-*d %-8d %-6d %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+           COL_PORT, port, n, failed,
+           samples[0] / 1e3,                // Minimum in microseconds
+           samples[(n - 1) * 50 / 100] / 1e3, // Median
+           samples[(n - 1) * 90 / 100] / 1e3, // 90th percentile
+           samples[(n - 1) * 99 / 100] / 1e3, // 99th percentile
+           samples[n - 1] / 1e3,            // Maximum
+           (double)sum / n / 1e3);          // Mean
+}
+
+// Function to print the header of a latency table
+void print_latency_header(const char *title)
+{
+    printf("\n%s (microseconds)\n", title);
+    printf("%-*s %-8s %-6s %10s %10s %10s %10s %10s %10s\n",
+           COL_PORT, "PORT", "SAMPLES", "FAIL", "MIN", "P50", "P90", "P99", "MAX", "MEAN");
+}
+
+// Function to collect the open ports of the target with a plain connect sweep
+int discover_open_ports(const unsigned char *set, int *ports)
+{
+    struct sockaddr_in addr; // Target address
+    int n = 0;               // Number of open ports found
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr(opts.host);
     for (int port = START_PORT; port <= END_PORT; port++)
     {
+        if (set && !port_in_set(set, port))
+            continue; // Outside the requested list
+        int sock = socket(AF_INET, SOCK_STREAM, 0);
+        if (sock < 0)
+            continue;
+        addr.sin_port = htons(port);
+        if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+            ports[n++] = port; // Listener found
+        close(sock);
+    }
+    return n;
+}
+
+// Function implementing --latency: paced connect timing with per-port distributions
+int run_latency(const unsigned char *set)
+{
+    static int ports[END_PORT + 1]; // Ports under test
+    struct sockaddr_in addr;        // Target address
+    int nports;                     // Number of ports under test
+
+    // Probe only the given ports when a list was specified, else discover listeners
+    if (set)
+    {
+        nports = 0;
+        for (int port = START_PORT; port <= END_PORT; port++)
+            if (port_in_set(set, port))
+                ports[nports++] = port;
+    }
+    else
+    {
+        nports = discover_open_ports(NULL, ports);
+    }
+    if (nports == 0)
+    {
+        fprintf(stderr, "No listeners to probe on %s\n", opts.host);
+        return 1;
+    }
+
+    // One sample array per port and metric, plus failure counters
+    long long *conn = alloc_realloc(NULL, sizeof(long long) * nports * opts.count);  // Connect samples
+    long long *first = alloc_realloc(NULL, sizeof(long long) * nports * opts.count); // First-byte samples
+    int *nconn = alloc_calloc(nports, sizeof(int));   // Valid connect samples per port
+    int *nfirst = alloc_calloc(nports, sizeof(int));  // Valid first-byte samples per port
+    int *failed = alloc_calloc(nports, sizeof(int));  // Failed connects per port
+    if (!conn || !first || !nconn || !nfirst || !failed)
+    {
+        fprintf(stderr, "Out of memory for %d x %d samples\n", nports, opts.count);
+        alloc_free(conn);
+        alloc_free(first);
+        alloc_free(nconn);
+        alloc_free(nfirst);
+        alloc_free(failed);
+        return 1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr(opts.host);
+
+    printf("Latency probe %s: %d ports, %d samples/port, %d connects/s\n",
+           opts.host, nports, opts.count, opts.rate);
+
+    // Round-robin over the ports so every port sees the same conditions over time,
+    // pacing attempts on an absolute schedule to hold the requested rate.
+    long long interval = 1000000000LL / opts.rate; // Spacing between attempts
+    long long next = now_ns();                     // Due time of the next attempt
+    stats_begin(PHASE_PROBE);
+    for (int round = 0; round < opts.count; round++)
+    {
+        for (int i = 0; i < nports; i++)
+        {
+            struct timespec due = {next / 1000000000LL, next % 1000000000LL};
+            long long c_ns, fb_ns; // Measured latencies
+
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL); // Wait for our slot
+            addr.sin_port = htons(ports[i]);
+            if (timed_connect(&addr, opts.timeout_ms, opts.first_byte, &c_ns, &fb_ns) == 0)
+            {
+                conn[(long)i * opts.count + nconn[i]++] = c_ns;
+                if (fb_ns >= 0)
+                    first[(long)i * opts.count + nfirst[i]++] = fb_ns;
+            }
+            else
+            {
+                failed[i]++;
+            }
+
+            next += interval;
+            long long now = now_ns();
+            if (next < now)
+                next = now; // Fell behind (slow service): resume pacing instead of bursting
+        }
+    }
+    stats_end();
+
+    print_latency_header("Connect latency");
+    for (int i = 0; i < nports; i++)
+        print_latency_row(ports[i], conn + (long)i * opts.count, nconn[i], failed[i]);
+
+    if (opts.first_byte)
+    { // FAIL here counts connects that produced no byte in time (not failed connects)
+        print_latency_header("First-byte latency");
+        for (int i = 0; i < nports; i++)
+            print_latency_row(ports[i], first + (long)i * opts.count, nfirst[i],
+                              nconn[i] - nfirst[i]);
+    }
+
+    alloc_free(conn);
+    alloc_free(first);
+    alloc_free(nconn);
+    alloc_free(nfirst);
+    alloc_free(failed);
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Socket-table enumeration (--stream)
+//
+// Sockets flow one at a time from /proc/net/{tcp,tcp6,udp,udp6} through the
+// filters and the inode->owner lookup straight into the output buffer. The
+// reader and writer use fixed-size buffers, so memory stays constant in the
+// number of sockets; only the inode index and the interned strings persist.
+// ---------------------------------------------------------------------------
+
+// Fixed-size line reader over a file descriptor
+struct line_reader
+{
+    int fd;                   // Source file descriptor
+    size_t len;               // Bytes currently held in buf
+    size_t pos;               // Start of the next unread line
+    char buf[READ_BUF_SIZE];  // Raw file bytes
+};
+
+// Bounded output buffer flushed with write()
+struct out_buf
+{
+    int fd;                  // Destination file descriptor, -1 to collect in spill
+    size_t len;              // Bytes pending in buf
+    char buf[OUT_BUF_SIZE];  // Formatted output awaiting write()
+    char *spill;             // fd -1: everything flushed so far
+    size_t spill_len, spill_cap;
+};
+
+// One socket as parsed from a socket table
+struct sock_rec
+{
+    unsigned char proto;        // PROTO_* index into sock_tables[]
+    unsigned char family;       // AF_INET or AF_INET6
+    unsigned char state;        // Kernel state number (TCP_* numbering; packet: SOCK_* type)
+    unsigned short lport;       // Local port (raw: IP protocol, packet: ethertype,
+                                // netlink: netlink protocol)
+    unsigned short rport;       // Remote port
+    unsigned char laddr[16];    // Local address (4 or 16 bytes used); for packet and
+                                // netlink sockets the native u32 ifindex / port id
+    unsigned char raddr[16];    // Remote address (4 or 16 bytes used)
+    unsigned int uid;           // Socket owner uid from the table
+    unsigned int txq;           // Send queue bytes
+    unsigned int rxq;           // Receive queue bytes
+    unsigned long long inode;   // Socket inode, 0 for TIME_WAIT and orphans
+};
+
+// Description of one kernel socket table
+struct sock_table
+{
+    const char *name; // Protocol label printed in the PROTO column
+    const char *path; // procfs file
+    int family;       // Address family of the entries
+};
+
+// Owner of a socket inode
+struct owner
+{
+    int pid;           // Process ID
+    unsigned int comm; // Process name, offset into the string cache
+    unsigned int user; // User name, offset into the string cache
+};
+
+// Size of one process's fd table, counted by the attribution walk
+struct fd_count
+{
+    int pid;              // Process ID
+    unsigned int fds;     // Open descriptors
+    unsigned int sockets; // ... of which sockets
+};
+
+// Interned string pool with an open-addressed dedup table
+struct str_cache
+{
+    char *pool;          // Concatenated NUL-terminated strings
+    size_t len;          // Bytes used in pool
+    size_t cap;          // Bytes allocated for pool
+    unsigned int *slots; // Offset+1 of the string in each slot, 0 when empty
+    size_t nslots;       // Slot count (power of two)
+    size_t count;        // Strings stored
+};
+
+// Table whose column widths are measured over all rows before printing
+struct table
+{
+    int ncols;                           // Columns in use
+    const char *header[TABLE_MAX_COLS];  // Column titles
+    size_t width[TABLE_MAX_COLS];        // Widest cell seen per column
+};
+
+// One slot of the inode index: key and owner inline, four slots per cache line
+struct inode_slot
+{
+    unsigned long long inode; // Socket inode
+    unsigned int owner;       // Index into owners[]
+};
+
+// Swiss-table inode -> owner index: a control byte per slot (INODE_EMPTY or 7 hash
+// bits) lets one SSE2 compare check a group of INODE_GROUP slots; a hit typically
+// touches one control line and one slot line
+struct inode_index
+{
+    unsigned char *ctrl;      // Control bytes, one per slot
+    struct inode_slot *slots; // Slots, grouped like ctrl
+    size_t cap;               // Slot count (power of two, multiple of INODE_GROUP)
+    size_t count;             // Inodes stored
+};
+
+// One fd-walk thread's output: socket inodes and their owners, in walk order
+struct inode_part
+{
+    unsigned long long *inodes; // Socket inodes
+    unsigned int *owners;       // Owner per inode (index into owners[] once resolved)
+    size_t n, cap;              // Used / allocated entries
+};
+
+// Known socket tables, indexed by PROTO_* value
+const struct sock_table sock_tables[] = {
+    {"tcp", "/proc/net/tcp", AF_INET},
+    {"tcp6", "/proc/net/tcp6", AF_INET6},
+    {"udp", "/proc/net/udp", AF_INET},
+    {"udp6", "/proc/net/udp6", AF_INET6},
+    {"raw", "/proc/net/raw", AF_INET},
+    {"raw6", "/proc/net/raw6", AF_INET6},
+    {"packet", "/proc/net/packet", AF_PACKET},
+    {"netlink", "/proc/net/netlink", AF_NETLINK},
+};
+
+// Number -> name pair for protocol numbers shown in place of ports
+struct num_name
+{
+    unsigned int num; // Protocol number
+    const char *name; // Display name
+};
+
+// IP protocols of raw sockets
+const struct num_name ipproto_names[] = {
+    {1, "icmp"}, {2, "igmp"}, {6, "tcp"}, {17, "udp"}, {47, "gre"}, {58, "icmp6"},
+    {89, "ospf"}, {112, "vrrp"}, {132, "sctp"}, {255, "raw"}, {0, NULL}};
+
+// Ethertypes of packet sockets
+const struct num_name ether_names[] = {
+    {0x0003, "all"}, {0x0800, "ip"}, {0x0806, "arp"}, {0x86DD, "ipv6"}, {0x8100, "vlan"},
+    {0x88CC, "lldp"}, {0x888E, "eapol"}, {0, NULL}};
+
+// Netlink protocols
+const struct num_name netlink_names[] = {
+    {0, "route"}, {4, "sock_diag"}, {6, "xfrm"}, {7, "selinux"}, {9, "audit"},
+    {10, "fib_lookup"}, {11, "connector"}, {12, "netfilter"}, {15, "uevent"},
+    {16, "generic"}, {18, "scsitransport"}, {0, NULL}};
+
+// Kernel TCP state names, indexed by state number
+const char *tcp_states[] = {
+    "UNKNOWN", "ESTABLISHED", "SYN_SENT", "SYN_RECV", "FIN_WAIT1", "FIN_WAIT2",
+    "TIME_WAIT", "CLOSE", "CLOSE_WAIT", "LAST_ACK", "LISTEN", "CLOSING", "NEW_SYN_RECV"};
+
+// Attribution state shared by the enumeration modes
+struct str_cache strings;      // Process and user names
+struct inode_index inodes;     // Socket inode -> owners[] index
+struct owner *owners;          // Processes owning at least one socket
+size_t nowners, owners_cap;    // Used and allocated owners[] entries
+struct fd_count *fd_counts;    // Every process the last walk visited, in walk order
+size_t nfd_counts, fd_counts_cap;
+unsigned int *uid_names;       // uid -> user name offset+1 (small uids only)
+size_t uid_names_cap;          // Entries allocated in uid_names
+
+// Function to hash a 64-bit key (Fibonacci hashing)
+size_t hash64(unsigned long long key)
+{
+    return (size_t)((key * 0x9E3779B97F4A7C15ULL) >> 17);
+}
+
+// Function to continue an FNV-1a hash over a byte range
+size_t hash_bytes_from(size_t h, const void *data, size_t len)
+{
+    const unsigned char *p = data; // Next byte
+    while (len--)
+        h = (h ^ *p++) * 1099511628211ULL; // FNV prime
+    return h;
+}
+
+// Function to hash a byte range (FNV-1a)
+size_t hash_bytes(const void *data, size_t len)
+{
+    return hash_bytes_from(1469598103934665603ULL, data, len); // FNV offset basis
+}
+
+// Function to hash a string (FNV-1a)
+size_t hash_str(const char *s)
+{
+    size_t h = 1469598103934665603ULL; // FNV offset basis
+    while (*s)
+        h = (h ^ (unsigned char)*s++) * 1099511628211ULL; // FNV prime
+    return h;
+}
+
+// Function to abort on allocation failure (the index cannot be partially built)
+void *xrealloc(void *ptr, size_t size)
+{
+    void *p = alloc_realloc(ptr, size); // Grow or allocate
+    if (!p)
+    {
+        fprintf(stderr, "Out of memory (%zu bytes)\n", size);
+        exit(1);
+    }
+    return p;
+}
+
+// Function to intern a string and return its pool offset
+unsigned int str_intern(struct str_cache *c, const char *s)
+{
+    size_t n = strlen(s) + 1; // Bytes including terminator
+
+    if (c->count * 2 >= c->nslots)
+    { // Keep load below 1/2: rebuild the slot table twice as large
+        size_t nslots = c->nslots ? c->nslots * 2 : 256;
+        unsigned int *slots = alloc_calloc(nslots, sizeof(*slots));
+        if (!slots)
+            xrealloc(NULL, (size_t)-1); // Reports and exits
+        for (size_t i = 0; i < c->nslots; i++)
+        {
+            if (!c->slots[i])
+                continue;
+            size_t j = hash_str(c->pool + c->slots[i] - 1) & (nslots - 1);
+            while (slots[j])
+                j = (j + 1) & (nslots - 1);
+            slots[j] = c->slots[i];
+        }
+        alloc_free(c->slots);
+        c->slots = slots;
+        c->nslots = nslots;
+    }
+
+    size_t i = hash_str(s) & (c->nslots - 1); // Home slot
+    while (c->slots[i])
+    { // Linear probe until hit or empty slot
+        if (strcmp(c->pool + c->slots[i] - 1, s) == 0)
+            return c->slots[i] - 1; // Already interned
+        i = (i + 1) & (c->nslots - 1);
+    }
+
+    if (c->len + n > c->cap)
+    { // Grow pool geometrically
+        c->cap = (c->len + n) * 2;
+        c->pool = xrealloc(c->pool, c->cap);
+    }
+    memcpy(c->pool + c->len, s, n);
+    c->slots[i] = (unsigned int)c->len + 1;
+    c->count++;
+    c->len += n;
+    return (unsigned int)(c->len - n);
+}
+
+// Function to return the slots of a control group whose byte equals tag, as a bitmask
+unsigned int inode_group_match(const unsigned char *ctrl, unsigned char tag)
+{
+#ifdef __SSE2__
+    __m128i group = _mm_load_si128((const __m128i *)ctrl); // Groups are 16-byte aligned
+    return (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)tag)));
+#else
+    unsigned int mask = 0;
+    for (int i = 0; i < INODE_GROUP; i++)
+        mask |= (unsigned int)(ctrl[i] == tag) << i;
+    return mask;
+#endif
+}
+
+// Function to place an inode into a presized index (first owner wins)
+void inode_place(struct inode_index *ix, unsigned long long inode, unsigned int owner)
+{
+    size_t h = hash64(inode);                    // Low 7 bits tag, the rest picks the group
+    unsigned char tag = (unsigned char)(h & 0x7f);
+    size_t mask = ix->cap / INODE_GROUP - 1;     // Group count - 1
+    size_t g = (h >> 7) & mask;                  // Home group
+
+    for (size_t step = 1;; g = (g + step++) & mask)
+    { // Triangular probing visits every group once
+        unsigned char *ctrl = ix->ctrl + g * INODE_GROUP;
+        struct inode_slot *slots = ix->slots + g * INODE_GROUP;
+        for (unsigned int m = inode_group_match(ctrl, tag); m; m &= m - 1)
+            if (slots[__builtin_ctz(m)].inode == inode)
+                return; // Shared socket (e.g. inherited across fork)
+        unsigned int empty = inode_group_match(ctrl, INODE_EMPTY);
+        if (empty)
+        {
+            int i = __builtin_ctz(empty); // Slots fill in order: no deletions
+            ctrl[i] = tag;
+            slots[i].inode = inode;
+            slots[i].owner = owner;
+            ix->count++;
+            return;
+        }
+    }
+}
+
+// Function to build the index in one pass from fd-walk partitions, taken in order
+// (first owner wins, as for a single walk); sized once, so nothing is rehashed
+void inode_index_build(struct inode_index *ix, const struct inode_part *parts, int nparts)
+{
+    size_t total = 0; // Upper bound on distinct inodes
+
+    for (int p = 0; p < nparts; p++)
+        total += parts[p].n;
+    alloc_free(ix->ctrl);
+    alloc_free(ix->slots);
+    ix->count = 0;
+    ix->cap = INODE_GROUP;
+    while (ix->cap * 7 / 8 < total)
+        ix->cap *= 2; // Load stays at or below 7/8
+    ix->ctrl = alloc_aligned(INODE_GROUP, ix->cap);
+    ix->slots = alloc_realloc(NULL, ix->cap * sizeof(*ix->slots));
+    if (!ix->ctrl || !ix->slots)
+        xrealloc(NULL, (size_t)-1); // Reports and exits
+    memset(ix->ctrl, INODE_EMPTY, ix->cap);
+    for (int p = 0; p < nparts; p++)
+        for (size_t i = 0; i < parts[p].n; i++)
+            inode_place(ix, parts[p].inodes[i], parts[p].owners[i]);
+}
+
+// Function to free an index
+void inode_index_free(struct inode_index *ix)
+{
+    alloc_free(ix->ctrl);
+    alloc_free(ix->slots);
+    memset(ix, 0, sizeof(*ix));
+}
+
+// Function to look up the value stored with an inode, -1 when unknown
+long inode_find(const struct inode_index *ix, unsigned long long inode)
+{
+    if (!ix->cap || !inode)
+        return -1;
+    size_t h = hash64(inode);
+    unsigned char tag = (unsigned char)(h & 0x7f);
+    size_t mask = ix->cap / INODE_GROUP - 1;
+    size_t g = (h >> 7) & mask;
+
+    for (size_t step = 1; step <= mask + 1; g = (g + step++) & mask)
+    {
+        const unsigned char *ctrl = ix->ctrl + g * INODE_GROUP;
+        const struct inode_slot *slots = ix->slots + g * INODE_GROUP;
+        for (unsigned int m = inode_group_match(ctrl, tag); m; m &= m - 1)
+            if (slots[__builtin_ctz(m)].inode == inode)
+                return slots[__builtin_ctz(m)].owner;
+        if (inode_group_match(ctrl, INODE_EMPTY))
+            return -1; // A free slot ends the probe sequence
+    }
+    return -1;
+}
+
+// Function to look up the owner of an inode, NULL when unknown
+const struct owner *inode_lookup(const struct inode_index *ix, unsigned long long inode)
+{
+    long i = inode_find(ix, inode); // Index into owners[]
+    return i < 0 ? NULL : &owners[i];
+}
+
+// Function to append an inode and its owner to a partition
+void inode_part_add(struct inode_part *p, unsigned long long inode, unsigned int owner)
+{
+    if (p->n == p->cap)
+    {
+        p->cap = p->cap ? p->cap * 2 : 1024;
+        p->inodes = xrealloc(p->inodes, p->cap * sizeof(*p->inodes));
+        p->owners = xrealloc(p->owners, p->cap * sizeof(*p->owners));
+    }
+    p->inodes[p->n] = inode;
+    p->owners[p->n++] = owner;
+}
+
+// Function to add a partition to a built index (first owner wins), rebuilding it
+// larger when the load would pass 7/8
+void inode_index_extend(struct inode_index *ix, const struct inode_part *add)
+{
+    if (ix->count + add->n <= ix->cap * 7 / 8)
+    {
+        for (size_t i = 0; i < add->n; i++)
+            inode_place(ix, add->inodes[i], add->owners[i]);
+        return;
+    }
+    struct inode_part all[2] = {{0}, *add}; // Current contents, then the additions
+    for (size_t i = 0; i < ix->cap; i++)
+        if (ix->ctrl[i] != INODE_EMPTY)
+            inode_part_add(&all[0], ix->slots[i].inode, ix->slots[i].owner);
+    inode_index_build(ix, all, 2);
+    alloc_free(all[0].inodes);
+    alloc_free(all[0].owners);
+}
+
+// Function to resolve a uid to an interned user name, cached per uid
+unsigned int user_name(unsigned int uid)
+{
+    char num[16]; // Numeric fallback
+
+    if (uid < 65536)
+    { // Cache small uids in a direct-mapped array
+        if (uid >= uid_names_cap)
+        {
+            size_t cap = uid + 64;
+            uid_names = xrealloc(uid_names, cap * sizeof(*uid_names));
+            memset(uid_names + uid_names_cap, 0, (cap - uid_names_cap) * sizeof(*uid_names));
+            uid_names_cap = cap;
+        }
+        if (uid_names[uid])
+            return uid_names[uid] - 1;
+    }
+    const char *name = resolve_user(uid); // One lookup per distinct uid
+    snprintf(num, sizeof(num), "%u", uid);
+    unsigned int off = str_intern(&strings, name ? name : num);
+    if (uid < 65536)
+        uid_names[uid] = off + 1;
+    return off;
+}
+
+// Function to read a small procfs file into buf, returns bytes read or -1
+ssize_t read_small_file(int dirfd, const char *name, char *buf, size_t size)
+{
+    int fd = openat(dirfd, name, O_RDONLY | O_CLOEXEC); // Relative to /proc/<pid>
+    if (fd < 0)
+        return -1;
+    ssize_t n = read(fd, buf, size - 1); // One read covers comm and the head of status
+    close(fd);
+    if (n < 0)
+        return -1;
+    buf[n] = '\0';
+    return n;
+}
+
+// Function to read a sysctl (or other small procfs file) as text, returns 0 or -1
+int read_sysctl(const char *path, char *buf, size_t size)
+{
+    ssize_t n = read_small_file(AT_FDCWD, path, buf, size);
+    return n > 0 ? 0 : -1;
+}
+
+// Function to record the fd-table size of a walked process
+void add_fd_count(int pid, unsigned int fds, unsigned int sockets)
+{
+    if (nfd_counts == fd_counts_cap)
+    {
+        fd_counts_cap = fd_counts_cap ? fd_counts_cap * 2 : 256;
+        fd_counts = xrealloc(fd_counts, fd_counts_cap * sizeof(*fd_counts));
+    }
+    fd_counts[nfd_counts++] = (struct fd_count){pid, fds, sockets};
+}
+
+// Function to register a process as an owner given its name and real uid
+unsigned int add_owner_id(int pid, const char *comm, unsigned int uid)
+{
+    if (nowners == owners_cap)
+    { // Grow owners array geometrically
+        owners_cap = owners_cap ? owners_cap * 2 : 256;
+        owners = xrealloc(owners, owners_cap * sizeof(*owners));
+    }
+    owners[nowners].pid = pid;
+    owners[nowners].comm = str_intern(&strings, comm);
+    owners[nowners].user = user_name(uid);
+    return (unsigned int)nowners++;
+}
+
+// Function to extract the process name and real uid from the text of its comm and
+// status files (either may be NULL)
+void parse_owner_text(char *comm_text, const char *status_text, char *comm, size_t size,
+                      unsigned int *uid)
+{
+    snprintf(comm, size, "unknown");
+    *uid = 0;
+    if (comm_text && comm_text[0])
+    {
+        comm_text[strcspn(comm_text, "\n")] = '\0'; // Strip newline
+        snprintf(comm, size, "%s", comm_text);
+    }
+    if (status_text)
+    {
+        const char *u = strstr(status_text, "\nUid:"); // Real uid is the first field
+        if (u)
+            *uid = (unsigned int)strtoul(u + 5, NULL, 10);
+    }
+}
+
+// Function to register a process as an owner from the text of its comm and status files
+unsigned int add_owner_text(int pid, char *comm_text, const char *status_text)
+{
+    char comm[64];    // Process name
+    unsigned int uid; // Real uid
+
+    parse_owner_text(comm_text, status_text, comm, sizeof(comm), &uid);
+    return add_owner_id(pid, comm, uid);
+}
+
+// A process seen by the procfs fd walk
+struct walk_proc
+{
+    int pid;          // Process ID
+    int has_socket;   // Non-zero once a socket fd was seen
+    unsigned int fds, sockets; // Descriptors and socket descriptors seen
+    unsigned int uid; // Real uid (valid with has_socket)
+    char comm[64];    // Process name (valid with has_socket)
+};
+
+// State shared by the procfs fd-walk threads
+struct procfs_walk
+{
+    int proc_fd;              // /proc directory
+    struct walk_proc *procs;  // Processes in /proc order
+    size_t nprocs;
+    struct inode_part *parts; // One per thread; owners hold indexes into procs
+    int nthreads;
+};
+
+// Argument of one procfs fd-walk thread
+struct procfs_worker
+{
+    struct procfs_walk *walk; // Shared state
+    int index;                // Thread number: its slice of procs and its part
+    pthread_t tid;
+};
+
+// Function to walk /proc/<pid>/fd of one contiguous slice of processes (thread body)
+void *procfs_walk_slice(void *arg)
+{
+    struct procfs_worker *wk = arg;
+    struct procfs_walk *w = wk->walk;
+    struct inode_part *part = &w->parts[wk->index]; // This thread's output
+    size_t begin = w->nprocs * wk->index / w->nthreads;
+    size_t end = w->nprocs * (wk->index + 1) / w->nthreads;
+
+    stats_thread_name("walk", wk->index);
+    stats_begin(PHASE_WALK);
+    for (size_t i = begin; i < end; i++)
+    {
+        struct walk_proc *proc = &w->procs[i];
+        char name[16]; // "<pid>"
+        snprintf(name, sizeof(name), "%d", proc->pid);
+        int pid_dirfd = openat(w->proc_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (pid_dirfd < 0)
+            continue; // Process exited
+        int fd_dirfd = openat(pid_dirfd, "fd", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        DIR *fd_dir = fd_dirfd >= 0 ? fdopendir(fd_dirfd) : NULL;
+        if (!fd_dir)
+        { // No permission or process exited
+            if (fd_dirfd >= 0)
+                close(fd_dirfd);
+            close(pid_dirfd);
+            continue;
+        }
+
+        struct dirent *fd_entry;
+        while ((fd_entry = readdir(fd_dir)) != NULL)
+        {
+            char link[64]; // "socket:[12345]"
+            if (fd_entry->d_name[0] == '.')
+                continue;
+            proc->fds++;
+            ssize_t n = readlinkat(fd_dirfd, fd_entry->d_name, link, sizeof(link) - 1);
+            if (n < 9 || memcmp(link, "socket:[", 8) != 0)
+                continue; // Not a socket
+            link[n] = '\0';
+            proc->sockets++;
+            if (!proc->has_socket)
+            { // Identify the owner on its first socket fd
+                char comm[1024], status[1024]; // comm, head of status
+                stats_begin(PHASE_ATTRIB);
+                int have_comm = read_small_file(pid_dirfd, "comm", comm, sizeof(comm)) > 0;
+                int have_status = read_small_file(pid_dirfd, "status", status, sizeof(status)) > 0;
+                parse_owner_text(have_comm ? comm : NULL, have_status ? status : NULL,
+                                 proc->comm, sizeof(proc->comm), &proc->uid);
+                proc->has_socket = 1;
+                stats_end();
+            }
+            inode_part_add(part, strtoull(link + 8, NULL, 10), (unsigned int)i);
+        }
+        closedir(fd_dir); // Also closes fd_dirfd
+        close(pid_dirfd);
+    }
+    stats_end();
+    stats_thread_done();
+    return NULL;
+}
+
+// Function to build the inode -> owner index with readlinkat over /proc/*/fd; the
+// processes are split into contiguous slices walked by one thread per CPU, and the
+// per-thread partitions are merged in /proc order by a single bulk build
+void build_inode_index_procfs(void)
+{
+    struct procfs_walk w;            // Shared walk state
+    struct procfs_worker workers[FDWALK_THREADS];
+    DIR *proc_dir = opendir("/proc"); // Process directories
+    struct dirent *entry;             // Current /proc entry
+    size_t cap = 0;
+
+    if (!proc_dir)
+        return;
+    memset(&w, 0, sizeof(w));
+    w.proc_fd = dirfd(proc_dir);
+    while ((entry = readdir(proc_dir)) != NULL)
+    {
+        if (!isdigit(entry->d_name[0]))
+            continue; // Not a process
+        int pid = atoi(entry->d_name);
+        if (pid == our_pid)
+            continue; // Skip ourselves
+        if (w.nprocs == cap)
+        {
+            cap = cap ? cap * 2 : 256;
+            w.procs = xrealloc(w.procs, cap * sizeof(*w.procs));
+        }
+        memset(&w.procs[w.nprocs], 0, sizeof(*w.procs));
+        w.procs[w.nprocs++].pid = pid;
+    }
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    w.nthreads = cpus > 1 ? (int)(cpus < FDWALK_THREADS ? cpus : FDWALK_THREADS) : 1;
+    if ((size_t)w.nthreads > w.nprocs / FDWALK_MIN_PROCS + 1)
+        w.nthreads = (int)(w.nprocs / FDWALK_MIN_PROCS + 1); // Small hosts: fewer threads
+    w.parts = alloc_calloc(w.nthreads, sizeof(*w.parts));
+    if (!w.parts)
+        xrealloc(NULL, (size_t)-1); // Reports and exits
+    for (int t = 0; t < w.nthreads; t++)
+    {
+        workers[t].walk = &w;
+        workers[t].index = t;
+        if (t > 0 && pthread_create(&workers[t].tid, NULL, procfs_walk_slice, &workers[t]) != 0)
+            workers[t].index = -1; // Run that slice here instead
+    }
+    procfs_walk_slice(&workers[0]);
+    for (int t = 1; t < w.nthreads; t++)
+    {
+        if (workers[t].index < 0)
+        {
+            workers[t].index = t;
+            procfs_walk_slice(&workers[t]);
+        }
+        else
+            pthread_join(workers[t].tid, NULL);
+    }
+    closedir(proc_dir);
+
+    // Register owners in /proc order, then point the partitions at them
+    stats_begin(PHASE_ATTRIB);
+    unsigned int *owner_of = xrealloc(NULL, (w.nprocs ? w.nprocs : 1) * sizeof(*owner_of));
+    for (size_t i = 0; i < w.nprocs; i++)
+    {
+        if (w.procs[i].has_socket)
+            owner_of[i] = add_owner_id(w.procs[i].pid, w.procs[i].comm, w.procs[i].uid);
+        if (w.procs[i].fds)
+            add_fd_count(w.procs[i].pid, w.procs[i].fds, w.procs[i].sockets);
+    }
+    for (int t = 0; t < w.nthreads; t++)
+        for (size_t i = 0; i < w.parts[t].n; i++)
+            w.parts[t].owners[i] = owner_of[w.parts[t].owners[i]];
+    inode_index_build(&inodes, w.parts, w.nthreads);
+    stats_end();
+
+    for (int t = 0; t < w.nthreads; t++)
+    {
+        alloc_free(w.parts[t].inodes);
+        alloc_free(w.parts[t].owners);
+    }
+    alloc_free(w.parts);
+    alloc_free(w.procs);
+    alloc_free(owner_of);
+}
+
+// Function to rescan the fd tables of some known owners (indexes into owners[]) and
+// add their new sockets to the index, without a full walk; sockets[k] receives the
+// number of sockets owner which[k] holds now. Returns how many inodes were added.
+size_t inode_index_rescan(const unsigned int *which, size_t n, unsigned int *sockets)
+{
+    struct procfs_walk w;           // One slice over just these processes
+    struct procfs_worker worker;
+    struct inode_part part = {0};   // Everything they hold
+    struct inode_part add = {0};    // ... of which not indexed yet
+    DIR *proc_dir = opendir("/proc");
+
+    if (!proc_dir)
+        return 0;
+    memset(&w, 0, sizeof(w));
+    w.proc_fd = dirfd(proc_dir);
+    w.procs = xrealloc(NULL, (n ? n : 1) * sizeof(*w.procs));
+    w.nprocs = n;
+    w.parts = &part;
+    w.nthreads = 1;
+    memset(w.procs, 0, n * sizeof(*w.procs));
+    for (size_t k = 0; k < n; k++)
+    {
+        w.procs[k].pid = owners[which[k]].pid;
+        sockets[k] = 0;
+    }
+    worker.walk = &w;
+    worker.index = 0;
+    procfs_walk_slice(&worker);
+    closedir(proc_dir);
+
+    for (size_t i = 0; i < part.n; i++)
+    {
+        sockets[part.owners[i]]++;
+        if (!inode_lookup(&inodes, part.inodes[i]))
+            inode_part_add(&add, part.inodes[i], which[part.owners[i]]);
+    }
+    inode_index_extend(&inodes, &add);
+    alloc_free(w.procs);
+    alloc_free(part.inodes);
+    alloc_free(part.owners);
+    alloc_free(add.inodes);
+    alloc_free(add.owners);
+    return add.n;
+}
+
+// Minimal io_uring instance driven through raw syscalls (no liburing)
+struct uring
+{
+    int fd;                      // Ring descriptor
+    unsigned entries;            // Submission queue size
+    unsigned tail;               // Local SQ tail, published on submit
+    unsigned queued;             // SQEs filled since the last submit
+    unsigned *sq_tail, *sq_mask, *sq_array; // Shared SQ ring fields
+    unsigned *cq_head, *cq_tail, *cq_mask;  // Shared CQ ring fields
+    struct io_uring_sqe *sqes;   // Submission entries
+    struct io_uring_cqe *cqes;   // Completion entries
+    void *sq_map, *cq_map;       // Ring mappings (the same with IORING_FEAT_SINGLE_MMAP)
+    size_t sq_len, cq_len, sqes_len; // Mapping sizes
+};
+
+// Function to set up an io_uring with room for entries SQEs, returns 0 or -1
+int uring_init(struct uring *u, unsigned entries)
+{
+    struct io_uring_params p; // Offsets filled in by the kernel
+
+    memset(u, 0, sizeof(*u));
+    memset(&p, 0, sizeof(p));
+    u->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if (u->fd < 0)
+        return -1; // Not built in, or disabled by kernel.io_uring_disabled
+    u->entries = p.sq_entries;
+    u->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        u->sq_len = u->cq_len = u->sq_len > u->cq_len ? u->sq_len : u->cq_len;
+    u->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    u->sq_map = mmap(NULL, u->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     u->fd, IORING_OFF_SQ_RING);
+    u->cq_map = (p.features & IORING_FEAT_SINGLE_MMAP) ? u->sq_map :
+                mmap(NULL, u->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     u->fd, IORING_OFF_CQ_RING);
+    u->sqes = mmap(NULL, u->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   u->fd, IORING_OFF_SQES);
+    if (u->sq_map == MAP_FAILED || u->cq_map == MAP_FAILED || u->sqes == MAP_FAILED)
+    {
+        if (u->sq_map != MAP_FAILED)
+            munmap(u->sq_map, u->sq_len);
+        if (u->cq_map != MAP_FAILED && u->cq_map != u->sq_map)
+            munmap(u->cq_map, u->cq_len);
+        if (u->sqes != MAP_FAILED)
+            munmap(u->sqes, u->sqes_len);
+        close(u->fd);
+        return -1;
+    }
+    u->sq_tail = (unsigned *)((char *)u->sq_map + p.sq_off.tail);
+    u->sq_mask = (unsigned *)((char *)u->sq_map + p.sq_off.ring_mask);
+    u->sq_array = (unsigned *)((char *)u->sq_map + p.sq_off.array);
+    u->cq_head = (unsigned *)((char *)u->cq_map + p.cq_off.head);
+    u->cq_tail = (unsigned *)((char *)u->cq_map + p.cq_off.tail);
+    u->cq_mask = (unsigned *)((char *)u->cq_map + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)((char *)u->cq_map + p.cq_off.cqes);
+    u->tail = *u->sq_tail;
+
+    // Blocking ops (statx, openat) run in io-wq workers; one per CPU is enough, more
+    // only contend on the same procfs locks (best effort: needs 5.15)
+    unsigned workers[2] = {0, 0}; // Bounded, unbounded
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    workers[0] = workers[1] = cpus > 0 ? (unsigned)cpus : 1;
+    syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_IOWQ_MAX_WORKERS, workers, 2);
+    return 0;
+}
+
+// Function to tear down an io_uring
+void uring_exit(struct uring *u)
+{
+    munmap(u->sqes, u->sqes_len);
+    if (u->cq_map != u->sq_map)
+        munmap(u->cq_map, u->cq_len);
+    munmap(u->sq_map, u->sq_len);
+    close(u->fd);
+}
+
+// Function to queue a zeroed SQE tagged with slot (its index in this batch)
+struct io_uring_sqe *uring_sqe(struct uring *u, int op, int fd, unsigned slot)
+{
+    unsigned idx = u->tail & *u->sq_mask; // Batches never exceed the ring
+    struct io_uring_sqe *sqe = &u->sqes[idx];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = (uint8_t)op;
+    sqe->fd = fd;
+    sqe->user_data = slot;
+    u->sq_array[idx] = idx;
+    u->tail++;
+    u->queued++;
+    return sqe;
+}
+
+// Function to submit the queued SQEs and wait for all of them, storing each result
+// in res[slot]; returns 0 or -1 if io_uring_enter fails
+int uring_run(struct uring *u, int *res)
+{
+    unsigned want = u->queued; // Completions still owed
+    unsigned submit = want;    // SQEs the kernel has not consumed yet
+
+    __atomic_store_n(u->sq_tail, u->tail, __ATOMIC_RELEASE); // Publish the SQEs
+    u->queued = 0;
+    while (want)
+    {
+        unsigned head = *u->cq_head; // Only we advance the head
+        if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE))
+        { // Nothing completed yet: submit the rest and sleep for one completion
+            int n = (int)syscall(__NR_io_uring_enter, u->fd, submit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+            if (n < 0 && errno != EINTR)
+                return -1;
+            if (n > 0)
+                submit -= (unsigned)n;
+            continue;
+        }
+        struct io_uring_cqe *cqe = &u->cqes[head & *u->cq_mask];
+        res[cqe->user_data] = cqe->res;
+        __atomic_store_n(u->cq_head, head + 1, __ATOMIC_RELEASE);
+        want--;
+    }
+    return 0;
+}
+
+// State of the io_uring /proc/*/fd walk
+struct fd_walk
+{
+    struct uring ring;          // Shared ring
+    int *res;                   // Completion result per slot
+    struct statx *stx;          // statx result per slot
+    char (*names)[16];          // fd name per slot (must outlive the submit)
+    unsigned *slot_proc;        // Process (index into pids) per slot
+    DIR **dirs;                 // fd directories referenced by the current batch
+    size_t ndirs;
+    int *pids;                  // Processes walked, in /proc order
+    uint8_t *has_socket;        // Non-zero once a socket fd was seen
+    unsigned *nfds, *nsockets;  // Descriptors and socket descriptors per process
+    size_t npids, pids_cap;
+    struct inode_part part;     // Socket inodes found; owners index pids until resolved
+    int unsupported;            // Kernel rejected IORING_OP_STATX
+};
+
+// Function to run the queued statx batch and collect the socket inodes it found
+int fd_walk_flush(struct fd_walk *w)
+{
+    unsigned n = w->ring.queued; // Slots in this batch
+
+    if (n && uring_run(&w->ring, w->res) < 0)
+        return -1;
+    for (unsigned i = 0; i < n; i++)
+    {
+        if (w->res[i] == -EINVAL || w->res[i] == -EOPNOTSUPP)
+            w->unsupported = 1; // Pre-5.6 kernel: opcode unknown
+        if (w->res[i] < 0 || !S_ISSOCK(w->stx[i].stx_mode))
+            continue; // Closed meanwhile, or not a socket
+        inode_part_add(&w->part, w->stx[i].stx_ino, w->slot_proc[i]); // The socket's inode
+        w->has_socket[w->slot_proc[i]] = 1;
+        w->nsockets[w->slot_proc[i]]++;
+    }
+    for (size_t i = 0; i < w->ndirs; i++)
+        closedir(w->dirs[i]); // No SQE refers to them any more
+    w->ndirs = 0;
+    return w->unsupported ? -1 : 0;
+}
+
+// Function to read comm and status of every socket-owning process in io_uring
+// batches (open, read, close rounds) and register them as owners
+int fd_walk_owners(struct fd_walk *w, unsigned *owner_of)
+{
+    unsigned per = w->ring.entries / 2; // Processes per batch: two files each
+    char (*bufs)[1024] = xrealloc(NULL, (size_t)w->ring.entries * sizeof(*bufs));
+    int *fds = xrealloc(NULL, w->ring.entries * sizeof(*fds));
+    int *lens = xrealloc(NULL, w->ring.entries * sizeof(*lens));
+    size_t *batch = xrealloc(NULL, per * sizeof(*batch)); // Process indexes in this batch
+    int rc = 0;
+
+    for (size_t next = 0; next < w->npids && rc == 0;)
+    {
+        unsigned nb = 0;
+        for (; next < w->npids && nb < per; next++)
+            if (w->has_socket[next])
+                batch[nb++] = next;
+
+        for (unsigned k = 0; k < nb; k++)
+            for (unsigned f = 0; f < 2; f++)
+            { // Round 1: open /proc/<pid>/comm and /proc/<pid>/status
+                unsigned slot = 2 * k + f;
+                fds[slot] = -1; // Until the open completes
+                snprintf(bufs[slot], sizeof(bufs[slot]), "/proc/%d/%s", w->pids[batch[k]],
+                         f ? "status" : "comm");
+                struct io_uring_sqe *sqe = uring_sqe(&w->ring, IORING_OP_OPENAT, AT_FDCWD, slot);
+                sqe->addr = (uintptr_t)bufs[slot];
+                sqe->open_flags = O_RDONLY | O_CLOEXEC;
+            }
+        if (uring_run(&w->ring, fds) < 0)
+            rc = -1;
+
+        for (unsigned slot = 0; rc == 0 && slot < 2 * nb; slot++)
+        { // Round 2: one read each (covers comm and the head of status)
+            lens[slot] = -1;
+            if (fds[slot] < 0)
+                continue; // Process exited
+            struct io_uring_sqe *sqe = uring_sqe(&w->ring, IORING_OP_READ, fds[slot], slot);
+            sqe->addr = (uintptr_t)bufs[slot];
+            sqe->len = sizeof(bufs[slot]) - 1;
+        }
+        if (rc == 0 && uring_run(&w->ring, lens) < 0)
+            rc = -1;
+
+        for (unsigned slot = 0; slot < 2 * nb; slot++)
+        { // Round 3: close, whatever happened above
+            if (fds[slot] >= 0)
+                uring_sqe(&w->ring, IORING_OP_CLOSE, fds[slot], slot);
+        }
+        if (uring_run(&w->ring, w->res) < 0)
+            rc = -1;
+
+        for (unsigned k = 0; rc == 0 && k < nb; k++)
+        {
+            char *text[2] = {NULL, NULL}; // comm, status
+            for (unsigned f = 0; f < 2; f++)
+                if (fds[2 * k + f] >= 0 && lens[2 * k + f] > 0)
+                {
+                    bufs[2 * k + f][lens[2 * k + f]] = '\0';
+                    text[f] = bufs[2 * k + f];
+                }
+            owner_of[batch[k]] = add_owner_text(w->pids[batch[k]], text[0], text[1]);
+        }
+    }
+    alloc_free(bufs);
+    alloc_free(fds);
+    alloc_free(lens);
+    alloc_free(batch);
+    return rc;
+}
+
+// Function to build the inode -> owner index with io_uring: directory listings stay
+// synchronous, but the per-fd statx calls and the comm/status reads go through the
+// ring in batches, so a walk costs a few syscalls per process instead of one per fd.
+// Returns -1 (with nothing indexed) if io_uring or IORING_OP_STATX is unavailable.
+int build_inode_index_uring(void)
+{
+    struct fd_walk w;          // Walk state
+    DIR *proc_dir;             // Process directories
+    struct dirent *entry;      // Current /proc entry
+    int rc = 0;
+
+    memset(&w, 0, sizeof(w));
+    if (uring_init(&w.ring, FDWALK_BATCH) < 0)
+        return -1;
+    proc_dir = opendir("/proc");
+    if (!proc_dir)
+    {
+        uring_exit(&w.ring);
+        return -1;
+    }
+    w.res = xrealloc(NULL, w.ring.entries * sizeof(*w.res));
+    w.stx = xrealloc(NULL, w.ring.entries * sizeof(*w.stx));
+    w.names = xrealloc(NULL, w.ring.entries * sizeof(*w.names));
+    w.slot_proc = xrealloc(NULL, w.ring.entries * sizeof(*w.slot_proc));
+    w.dirs = xrealloc(NULL, w.ring.entries * sizeof(*w.dirs));
+
+    while (rc == 0 && (entry = readdir(proc_dir)) != NULL)
+    {
+        if (!isdigit(entry->d_name[0]) || strlen(entry->d_name) > 10)
+            continue; // Not a process
+        int pid = atoi(entry->d_name);
+        if (pid == our_pid)
+            continue; // Skip ourselves
+
+        char path[32]; // "<pid>/fd"
+        snprintf(path, sizeof(path), "%.10s/fd", entry->d_name);
+        int fd_dirfd = openat(dirfd(proc_dir), path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        DIR *fd_dir = fd_dirfd >= 0 ? fdopendir(fd_dirfd) : NULL;
+        if (!fd_dir)
+        { // No permission or process exited
+            if (fd_dirfd >= 0)
+                close(fd_dirfd);
+            continue;
+        }
+        if (w.npids == w.pids_cap)
+        {
+            w.pids_cap = w.pids_cap ? w.pids_cap * 2 : 256;
+            w.pids = xrealloc(w.pids, w.pids_cap * sizeof(*w.pids));
+            w.has_socket = xrealloc(w.has_socket, w.pids_cap);
+            w.nfds = xrealloc(w.nfds, w.pids_cap * sizeof(*w.nfds));
+            w.nsockets = xrealloc(w.nsockets, w.pids_cap * sizeof(*w.nsockets));
+        }
+        unsigned proc = (unsigned)w.npids++;
+        w.pids[proc] = pid;
+        w.has_socket[proc] = 0;
+        w.nfds[proc] = w.nsockets[proc] = 0;
+
+        struct dirent *fd_entry;
+        unsigned queued = 0; // SQEs of this directory in the current batch
+        while (rc == 0 && (fd_entry = readdir(fd_dir)) != NULL)
+        {
+            size_t len = strlen(fd_entry->d_name);
+            if (fd_entry->d_name[0] == '.' || len >= sizeof(w.names[0]))
+                continue; // Not a descriptor number
+            if (w.ring.queued == w.ring.entries)
+            { // Ring full: run the batch (fd_dir stays open, it is still being read)
+                rc = fd_walk_flush(&w);
+                if (rc < 0)
+                    break;
+                queued = 0;
+            }
+            unsigned slot = w.ring.queued;
+            w.nfds[proc]++;
+            memcpy(w.names[slot], fd_entry->d_name, len + 1);
+            w.slot_proc[slot] = proc;
+            struct io_uring_sqe *sqe = uring_sqe(&w.ring, IORING_OP_STATX, fd_dirfd, slot);
+            sqe->addr = (uintptr_t)w.names[slot];         // Follows the link to the socket
+            sqe->len = STATX_TYPE | STATX_INO;
+            sqe->off = (uintptr_t)&w.stx[slot];
+            queued++;
+        }
+        if (!queued)
+            closedir(fd_dir); // No SQE refers to it
+        else
+        {
+            w.dirs[w.ndirs++] = fd_dir; // Closed once its SQEs completed
+            if (w.ndirs == w.ring.entries && rc == 0)
+                rc = fd_walk_flush(&w);
+        }
+    }
+    if (rc == 0)
+        rc = fd_walk_flush(&w);
+    for (size_t i = 0; i < w.ndirs; i++)
+        closedir(w.dirs[i]); // Only left over after a failure
+    closedir(proc_dir);
+
+    if (rc == 0)
+    { // Register owners in /proc order, then index (first owner wins, as procfs)
+        unsigned *owner_of = xrealloc(NULL, (w.npids ? w.npids : 1) * sizeof(*owner_of));
+        stats_begin(PHASE_ATTRIB);
+        rc = fd_walk_owners(&w, owner_of);
+        for (size_t i = 0; rc == 0 && i < w.part.n; i++)
+            w.part.owners[i] = owner_of[w.part.owners[i]];
+        if (rc == 0)
+            inode_index_build(&inodes, &w.part, 1);
+        for (size_t i = 0; rc == 0 && i < w.npids; i++)
+            if (w.nfds[i])
+                add_fd_count(w.pids[i], w.nfds[i], w.nsockets[i]);
+        stats_end();
+        alloc_free(owner_of);
+    }
+    uring_exit(&w.ring);
+    alloc_free(w.res);
+    alloc_free(w.stx);
+    alloc_free(w.names);
+    alloc_free(w.slot_proc);
+    alloc_free(w.dirs);
+    alloc_free(w.pids);
+    alloc_free(w.has_socket);
+    alloc_free(w.nfds);
+    alloc_free(w.nsockets);
+    alloc_free(w.part.inodes);
+    alloc_free(w.part.owners);
+    return rc;
+}
+
+// vmlinux BTF type table, used to place the loads of the BPF fd walk
+struct btf_info
+{
+    char *data;                    // Raw /sys/kernel/btf/vmlinux
+    const char *strs;              // String section
+    uint32_t str_len;
+    const struct btf_type **types; // By type id (0 is void)
+    uint32_t ntypes;
+};
+
+// Record emitted by the task_file iterator for each socket fd. Every other file is
+// counted with one 8-byte word instead: BPF_WALK_OTHER | tgid (inodes never set bit 63).
+struct bpf_walk_rec
+{
+    uint64_t ino;  // Socket inode
+    uint32_t pid;  // Thread group ID, in the initial PID namespace
+    uint32_t uid;  // Real uid
+    char comm[16]; // Task name (TASK_COMM_LEN)
+};
+
+// Function to load and index the kernel's BTF, returns 0 or -1
+int btf_load(struct btf_info *b)
+{
+    size_t len = 0, cap = 0; // Bytes read / allocated
+    int fd = open("/sys/kernel/btf/vmlinux", O_RDONLY | O_CLOEXEC);
+
+    memset(b, 0, sizeof(*b));
+    if (fd < 0)
+        return -1; // CONFIG_DEBUG_INFO_BTF off
+    for (;;)
+    { // sysfs reports no useful size: read until EOF
+        if (len == cap)
+        {
+            cap = cap ? cap * 2 : 1 << 22;
+            b->data = xrealloc(b->data, cap);
+        }
+        ssize_t n = read(fd, b->data + len, cap - len);
+        if (n <= 0)
+            break;
+        len += (size_t)n;
+    }
+    close(fd);
+
+    const struct btf_header *h = (const struct btf_header *)b->data;
+    if (len < sizeof(*h) || h->magic != BTF_MAGIC ||
+        (size_t)h->hdr_len + h->type_off + h->type_len > len ||
+        (size_t)h->hdr_len + h->str_off + h->str_len > len)
+        return -1;
+    b->strs = b->data + h->hdr_len + h->str_off;
+    b->str_len = h->str_len;
+
+    const char *p = b->data + h->hdr_len + h->type_off; // Current type
+    const char *end = p + h->type_len;
+    size_t types_cap = 0;
+    b->ntypes = 1; // Type 0 is void
+    while (p + sizeof(struct btf_type) <= end)
+    {
+        const struct btf_type *t = (const struct btf_type *)p;
+        size_t vlen = BTF_INFO_VLEN(t->info), extra; // Kind-specific trailer
+        switch (BTF_INFO_KIND(t->info))
+        {
+        case BTF_KIND_INT: case BTF_KIND_VAR: case BTF_KIND_DECL_TAG:
+            extra = 4;
+            break;
+        case BTF_KIND_ARRAY:
+            extra = sizeof(struct btf_array);
+            break;
+        case BTF_KIND_STRUCT: case BTF_KIND_UNION:
+            extra = vlen * sizeof(struct btf_member);
+            break;
+        case BTF_KIND_ENUM: case BTF_KIND_FUNC_PROTO:
+            extra = vlen * 8;
+            break;
+        case BTF_KIND_DATASEC: case BTF_KIND_ENUM64:
+            extra = vlen * 12;
+            break;
+        case BTF_KIND_PTR: case BTF_KIND_FWD: case BTF_KIND_TYPEDEF: case BTF_KIND_VOLATILE:
+        case BTF_KIND_CONST: case BTF_KIND_RESTRICT: case BTF_KIND_FUNC: case BTF_KIND_FLOAT:
+        case BTF_KIND_TYPE_TAG:
+            extra = 0;
+            break;
+        default:
+            return -1; // Newer BTF than we understand
+        }
+        if (b->ntypes >= types_cap)
+        {
+            types_cap = types_cap ? types_cap * 2 : 65536;
+            b->types = xrealloc(b->types, types_cap * sizeof(*b->types));
+        }
+        b->types[b->ntypes++] = t;
+        p += sizeof(*t) + extra;
+    }
+    return 0;
+}
+
+// Function to find a named type of the given BTF_KIND_*, returns its id or 0
+uint32_t btf_find(const struct btf_info *b, const char *name, int kind)
+{
+    for (uint32_t id = 1; id < b->ntypes; id++)
+    {
+        const struct btf_type *t = b->types[id];
+        if ((int)BTF_INFO_KIND(t->info) == kind && t->name_off < b->str_len &&
+            strcmp(b->strs + t->name_off, name) == 0)
+            return id;
+    }
+    return 0;
+}
+
+// Function to return the byte offset of a struct member, looking through anonymous
+// structs and unions; -1 when there is no such member
+long btf_member(const struct btf_info *b, uint32_t id, const char *name)
+{
+    const struct btf_type *t; // Type, with typedefs and qualifiers stripped
+
+    for (;;)
+    {
+        if (id == 0 || id >= b->ntypes)
+            return -1;
+        t = b->types[id];
+        int kind = BTF_INFO_KIND(t->info);
+        if (kind != BTF_KIND_TYPEDEF && kind != BTF_KIND_CONST && kind != BTF_KIND_VOLATILE &&
+            kind != BTF_KIND_RESTRICT && kind != BTF_KIND_TYPE_TAG)
+            break;
+        id = t->type;
+    }
+    if (BTF_INFO_KIND(t->info) != BTF_KIND_STRUCT && BTF_INFO_KIND(t->info) != BTF_KIND_UNION)
+        return -1;
+
+    const struct btf_member *m = (const struct btf_member *)(t + 1);
+    for (unsigned i = 0; i < BTF_INFO_VLEN(t->info); i++)
+    {
+        long bits = BTF_INFO_KFLAG(t->info) ? BTF_MEMBER_BIT_OFFSET(m[i].offset) : m[i].offset;
+        if (m[i].name_off == 0)
+        { // Anonymous struct/union: search inside it
+            long sub = btf_member(b, m[i].type, name);
+            if (sub >= 0)
+                return bits / 8 + sub;
+        }
+        else if (m[i].name_off < b->str_len && strcmp(b->strs + m[i].name_off, name) == 0)
+            return bits / 8;
+    }
+    return -1;
+}
+
+// Function to encode one BPF instruction
+struct bpf_insn bpf_op(int code, int dst, int src, long off, int imm)
+{
+    struct bpf_insn insn = {(uint8_t)code, (uint8_t)dst, (uint8_t)src, (int16_t)off, imm};
+    return insn;
+}
+
+// Function to load the task_file iterator program and attach it, returns a link fd or -1.
+// The program is assembled here (no clang/libbpf needed) with the struct offsets taken
+// from the running kernel's BTF, and writes one bpf_walk_rec per socket file and one
+// BPF_WALK_OTHER word per other file (for the per-process fd counts).
+int bpf_walk_attach(void)
+{
+    struct btf_info b;    // Kernel types
+    union bpf_attr attr;  // bpf() arguments
+    char log[4096] = "";  // Verifier log, shown on failure with --fd-walk bpf
+    enum { CTX_META, CTX_TASK, CTX_FILE, META_SEQ, FILE_INODE, INODE_MODE, INODE_INO,
+           TASK_TGID, TASK_CRED, TASK_COMM, CRED_UID, NOFFS };
+    static const char *const fields[NOFFS][2] = {
+        {"bpf_iter__task_file", "meta"}, {"bpf_iter__task_file", "task"},
+        {"bpf_iter__task_file", "file"}, {"bpf_iter_meta", "seq"}, {"file", "f_inode"},
+        {"inode", "i_mode"}, {"inode", "i_ino"}, {"task_struct", "tgid"},
+        {"task_struct", "real_cred"}, {"task_struct", "comm"}, {"cred", "uid"}};
+    long off[NOFFS]; // Byte offsets of the fields above
+
+    if (btf_load(&b) < 0)
+    {
+        alloc_free(b.data);
+        alloc_free(b.types);
+        return -1;
+    }
+    uint32_t attach_id = btf_find(&b, "bpf_iter_task_file", BTF_KIND_FUNC); // Iterator target
+    for (int i = 0; i < NOFFS; i++)
+    {
+        off[i] = btf_member(&b, btf_find(&b, fields[i][0], BTF_KIND_STRUCT), fields[i][1]);
+        if (off[i] < 0 || off[i] > INT16_MAX - 8)
+            attach_id = 0; // Missing or unreachable field: not this kernel
+    }
+    alloc_free(b.data);
+    alloc_free(b.types);
+    if (!attach_id)
+        return -1;
+
+    // r6 = ctx, r7 = file, r8 = task, r9 = bytes to write, record built at r10 - 32
+    // (see struct bpf_walk_rec; other files get the 8-byte BPF_WALK_OTHER | tgid word)
+    struct bpf_insn prog[] = {
+        bpf_op(BPF_ALU64 | BPF_MOV | BPF_X, 6, 1, 0, 0),
+        bpf_op(BPF_LDX | BPF_MEM | BPF_DW, 7, 6, off[CTX_FILE], 0),
+        bpf_op(BPF_JMP | BPF_JEQ | BPF_K, 7, 0, 34, 0),                 // End of iteration
+        bpf_op(BPF_LDX | BPF_MEM | BPF_DW, 8, 6, off[CTX_TASK], 0),
+        bpf_op(BPF_JMP | BPF_JEQ | BPF_K, 8, 0, 32, 0),
+        bpf_op(BPF_LDX | BPF_MEM | BPF_DW, 2, 7, off[FILE_INODE], 0),
+        bpf_op(BPF_JMP | BPF_JEQ | BPF_K, 2, 0, 30, 0),
+        bpf_op(BPF_LDX | BPF_MEM | BPF_H, 3, 2, off[INODE_MODE], 0),
+        bpf_op(BPF_ALU64 | BPF_AND | BPF_K, 3, 0, 0, S_IFMT),
+        bpf_op(BPF_JMP | BPF_JEQ | BPF_K, 3, 0, 7, S_IFSOCK),          // Sockets: full record
+        bpf_op(BPF_LDX | BPF_MEM | BPF_W, 3, 8, off[TASK_TGID], 0),
+        bpf_op(BPF_ALU64 | BPF_MOV | BPF_K, 4, 0, 0, 1),
+        bpf_op(BPF_ALU64 | BPF_LSH | BPF_K, 4, 0, 0, 63),               // BPF_WALK_OTHER
+        bpf_op(BPF_ALU64 | BPF_OR | BPF_X, 3, 4, 0, 0),
+        bpf_op(BPF_STX | BPF_MEM | BPF_DW, 10, 3, -32, 0),
+        bpf_op(BPF_ALU64 | BPF_MOV | BPF_K, 9, 0, 0, 8),
+        bpf_op(BPF_JMP | BPF_JA, 0, 0, 14, 0),                          // To the write
+        bpf_op(BPF_LDX | BPF_MEM | BPF_DW, 3, 2, off[INODE_INO], 0),
+        bpf_op(BPF_STX | BPF_MEM | BPF_DW, 10, 3, -32, 0),
+        bpf_op(BPF_LDX | BPF_MEM | BPF_W, 3, 8, off[TASK_TGID], 0),
+        bpf_op(BPF_STX | BPF_MEM | BPF_W, 10, 3, -24, 0),
+        bpf_op(BPF_LDX | BPF_MEM | BPF_DW, 3, 8, off[TASK_CRED], 0),
+        bpf_op(BPF_ST | BPF_MEM | BPF_W, 10, 0, -20, 0),
+        bpf_op(BPF_JMP | BPF_JEQ | BPF_K, 3, 0, 2, 0),
+        bpf_op(BPF_LDX | BPF_MEM | BPF_W, 3, 3, off[CRED_UID], 0),     // kuid_t.val
+        bpf_op(BPF_STX | BPF_MEM | BPF_W, 10, 3, -20, 0),
+        bpf_op(BPF_LDX | BPF_MEM | BPF_DW, 3, 8, off[TASK_COMM], 0),
+        bpf_op(BPF_STX | BPF_MEM | BPF_DW, 10, 3, -16, 0),
+        bpf_op(BPF_LDX | BPF_MEM | BPF_DW, 3, 8, off[TASK_COMM] + 8, 0),
+        bpf_op(BPF_STX | BPF_MEM | BPF_DW, 10, 3, -8, 0),
+        bpf_op(BPF_ALU64 | BPF_MOV | BPF_K, 9, 0, 0, (int)sizeof(struct bpf_walk_rec)),
+        bpf_op(BPF_LDX | BPF_MEM | BPF_DW, 1, 6, off[CTX_META], 0),    // Write: jump target
+        bpf_op(BPF_LDX | BPF_MEM | BPF_DW, 1, 1, off[META_SEQ], 0),
+        bpf_op(BPF_ALU64 | BPF_MOV | BPF_X, 2, 10, 0, 0),
+        bpf_op(BPF_ALU64 | BPF_ADD | BPF_K, 2, 0, 0, -32),
+        bpf_op(BPF_ALU64 | BPF_MOV | BPF_X, 3, 9, 0, 0),
+        bpf_op(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_seq_write),
+        bpf_op(BPF_ALU64 | BPF_MOV | BPF_K, 0, 0, 0, 0),               // End: jump target
+        bpf_op(BPF_JMP | BPF_EXIT, 0, 0, 0, 0)};
+
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_TRACING;
+    attr.expected_attach_type = BPF_TRACE_ITER;
+    attr.attach_btf_id = attach_id;
+    attr.insns = (uintptr_t)prog;
+    attr.insn_cnt = sizeof(prog) / sizeof(prog[0]);
+    attr.license = (uintptr_t)"Dual MIT/GPL"; // bpf_seq_write is GPL-only
+    attr.log_buf = (uintptr_t)log;
+    attr.log_size = sizeof(log);
+    attr.log_level = opts.fd_walk == FDWALK_BPF;
+    memcpy(attr.prog_name, "qds_fd_walk", sizeof("qds_fd_walk"));
+    int prog_fd = (int)syscall(__NR_bpf, BPF_PROG_LOAD, &attr, sizeof(attr));
+    if (prog_fd < 0)
+    {
+        if (opts.fd_walk == FDWALK_BPF)
+            fprintf(stderr, "BPF fd walk: %s\n%s", strerror(errno), log);
+        return -1; // No CAP_BPF, or the verifier disagrees with this kernel
+    }
+
+    memset(&attr, 0, sizeof(attr));
+    attr.link_create.prog_fd = prog_fd;
+    attr.link_create.attach_type = BPF_TRACE_ITER;
+    int link_fd = (int)syscall(__NR_bpf, BPF_LINK_CREATE, &attr, sizeof(attr));
+    close(prog_fd); // The link holds the program
+    return link_fd < 0 ? -1 : link_fd;
+}
+
+// Function to build the inode -> owner index from the task_file BPF iterator: the
+// kernel walks every task's file table and hands back only the socket files, so one
+// read() replaces the whole /proc/*/fd walk. Returns -1 (nothing indexed) when BPF
+// iterators are unavailable or PIDs would not match /proc (another PID namespace).
+int build_inode_index_bpf(void)
+{
+    static int link_fd = -2;  // Attached iterator: -2 not tried yet, -1 unavailable
+    union bpf_attr attr;      // bpf() arguments
+    struct stat self;         // Marker socket, to learn our PID as the kernel sees it
+    char *buf = NULL;         // All records
+    size_t len = 0, cap = 0;
+
+    if (link_fd == -2)
+        link_fd = bpf_walk_attach();
+    if (link_fd < 0)
+        return -1;
+
+    int marker = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    memset(&attr, 0, sizeof(attr));
+    attr.iter_create.link_fd = (uint32_t)link_fd;
+    int it = marker >= 0 && fstat(marker, &self) == 0 ?
+             (int)syscall(__NR_bpf, BPF_ITER_CREATE, &attr, sizeof(attr)) : -1;
+    for (ssize_t n = 0; it >= 0; len += (size_t)n)
+    {
+        if (cap - len < 65536)
+        {
+            cap = cap ? cap * 2 : 1 << 20;
+            buf = xrealloc(buf, cap);
+        }
+        n = read(it, buf + len, cap - len); // Whole records, as many as fit
+        if (n <= 0)
+            break;
+    }
+    if (it >= 0)
+        close(it);
+    if (marker >= 0)
+        close(marker);
+
+    long kernel_pid = -1; // Our tgid in the initial PID namespace
+    for (size_t off = 0; it >= 0 && off + 8 <= len && kernel_pid < 0;)
+    {
+        const struct bpf_walk_rec *r = (const struct bpf_walk_rec *)(buf + off);
+        if (r->ino & BPF_WALK_OTHER)
+            off += 8;
+        else if ((off += sizeof(*r)) <= len && r->ino == self.st_ino)
+            kernel_pid = r->pid;
+    }
+    if (kernel_pid != our_pid)
+    { // Iterator failed, or we run in a PID namespace and its PIDs would be wrong
+        alloc_free(buf);
+        close(link_fd);
+        link_fd = -1;
+        return -1;
+    }
+
+    struct inode_part part = {0}; // Records in iteration (PID) order
+    long last = -1;      // Socket records arrive grouped by process
+    stats_begin(PHASE_ATTRIB);
+    unsigned owner = 0;  // Owner of the current group
+    long counted = -1;   // Process whose descriptors are being counted
+    unsigned fds = 0, socks = 0;
+    for (size_t off = 0; off + 8 <= len;)
+    {
+        struct bpf_walk_rec *r = (struct bpf_walk_rec *)(buf + off);
+        int other = (r->ino & BPF_WALK_OTHER) != 0;
+        long pid = other ? (long)(uint32_t)r->ino : (long)r->pid;
+        if (!other && off + sizeof(*r) > len)
+            break; // Truncated record
+        off += other ? 8 : sizeof(*r);
+        if (pid == our_pid)
+            continue; // Skip ourselves
+        if (pid != counted)
+        { // Files arrive grouped by process too
+            if (counted >= 0)
+                add_fd_count((int)counted, fds, socks);
+            counted = pid;
+            fds = socks = 0;
+        }
+        fds++;
+        if (other)
+            continue;
+        socks++;
+        if (pid != last)
+        {
+            r->comm[sizeof(r->comm) - 1] = '\0';
+            owner = add_owner_id((int)pid, r->comm, r->uid);
+            last = pid;
+        }
+        inode_part_add(&part, r->ino, owner);
+    }
+    if (counted >= 0)
+        add_fd_count((int)counted, fds, socks);
+    inode_index_build(&inodes, &part, 1);
+    stats_end();
+    alloc_free(part.inodes);
+    alloc_free(part.owners);
+    alloc_free(buf);
+    return 0;
+}
+
+// Function to build the inode -> owner index with one walk over /proc/*/fd
+void build_inode_index(void)
+{
+    static int warned;                 // Forced backend fallback reported once
+    size_t had_owners = nowners;       // Owners and counts before this walk: a failed
+    size_t had_fd_counts = nfd_counts; // backend may have registered some already
+
+    stats_begin(PHASE_WALK);
+    if (opts.fd_walk == FDWALK_BPF && build_inode_index_bpf() == 0)
+    {
+        stats_end();
+        return;
+    }
+    if (opts.fd_walk == FDWALK_URING && build_inode_index_uring() == 0)
+    {
+        stats_end();
+        return;
+    }
+    if (opts.fd_walk != FDWALK_PROCFS && opts.fd_walk != FDWALK_AUTO && !warned++)
+        fprintf(stderr, "%s fd walk unavailable, using procfs\n",
+                opts.fd_walk == FDWALK_BPF ? "BPF iterator" : "io_uring statx");
+    nowners = had_owners; // The procfs walk registers them again
+    nfd_counts = had_fd_counts;
+    build_inode_index_procfs();
+    stats_end();
+}
+
+// Function to return the next line from a reader, NULL at end of file
+char *next_line(struct line_reader *r)
+{
+    for (;;)
+    {
+        char *start = r->buf + r->pos;                        // Unread bytes
+        char *nl = memchr(start, '\n', r->len - r->pos);      // End of the next line
+        if (nl)
+        {
+            *nl = '\0';
+            r->pos = nl - r->buf + 1;
+            return start;
+        }
+        // No complete line left: move the tail to the front and refill
+        memmove(r->buf, start, r->len - r->pos);
+        r->len -= r->pos;
+        r->pos = 0;
+        if (r->len == sizeof(r->buf) - 1)
+            r->len = 0; // Absurdly long line: drop it rather than stall
+        ssize_t n = read(r->fd, r->buf + r->len, sizeof(r->buf) - 1 - r->len);
+        if (n <= 0)
+        { // End of file: hand out a final unterminated line, if any
+            if (r->len == 0)
+                return NULL;
+            r->buf[r->len] = '\0';
+            r->pos = r->len;
+            return r->buf;
+        }
+        r->len += n;
+    }
+}
+
+// Function to parse hex digits at *p, advancing past them
+unsigned long long parse_hex(const char **p)
+{
+    unsigned long long v = 0; // Accumulated value
+    for (;; (*p)++)
+    {
+        char c = **p;
+        if (c >= '0' && c <= '9')
+            v = (v << 4) | (c - '0');
+        else if (c >= 'A' && c <= 'F')
+            v = (v << 4) | (c - 'A' + 10);
+        else if (c >= 'a' && c <= 'f')
+            v = (v << 4) | (c - 'a' + 10);
+        else
+            return v;
+    }
+}
+
+// Function to parse decimal digits at *p after skipping blanks, advancing past them
+unsigned long long parse_dec(const char **p)
+{
+    unsigned long long v = 0; // Accumulated value
+    while (**p == ' ')
+        (*p)++;
+    while (**p >= '0' && **p <= '9')
+        v = v * 10 + (*(*p)++ - '0');
+    return v;
+}
+
+// Function to parse a procfs "ADDR:PORT" field; addresses are native-endian 32-bit words
+void parse_addr_port(const char **p, int family, unsigned char *addr, unsigned short *port)
+{
+    int words = family == AF_INET6 ? 4 : 1; // 32-bit words in the address
+    while (**p == ' ')
+        (*p)++;
+    for (int w = 0; w < words; w++)
+    { // Each word is printed as %08X of the in-memory value
+        char word[9];
+        memcpy(word, *p, 8);
+        word[8] = '\0';
+        const char *wp = word;
+        unsigned int v = (unsigned int)parse_hex(&wp);
+        memcpy(addr + 4 * w, &v, 4);
+        *p += 8;
+    }
+    if (**p == ':')
+        (*p)++;
+    *port = (unsigned short)parse_hex(p);
+}
+
+// Function to parse one /proc/net/{tcp,udp}{,6} line, returns 0 on success
+int parse_sock_line(const char *line, int proto, struct sock_rec *rec)
+{
+    const char *p = strchr(line, ':'); // End of the slot number
+    if (!p)
+        return -1;
+    p++;
+    memset(rec, 0, sizeof(*rec));
+    rec->proto = proto;
+    rec->family = sock_tables[proto].family;
+    parse_addr_port(&p, rec->family, rec->laddr, &rec->lport);
+    parse_addr_port(&p, rec->family, rec->raddr, &rec->rport);
+    while (*p == ' ')
+        p++;
+    rec->state = (unsigned char)parse_hex(&p);
+    while (*p == ' ')
+        p++;
+    rec->txq = (unsigned int)parse_hex(&p);
+    if (*p++ != ':')
+        return -1;
+    rec->rxq = (unsigned int)parse_hex(&p);
+    while (*p == ' ')
+        p++;
+    parse_hex(&p); // tr
+    p++;
+    parse_hex(&p); // tm->when
+    while (*p == ' ')
+        p++;
+    parse_hex(&p); // retrnsmt
+    rec->uid = (unsigned int)parse_dec(&p);
+    parse_dec(&p); // timeout
+    rec->inode = parse_dec(&p);
+    return 0;
+}
+
+// Function to parse one /proc/net/packet line, returns 0 on success
+// Columns: sk RefCnt Type Proto Iface R Rmem User Inode
+int parse_packet_line(const char *line, int proto, struct sock_rec *rec)
+{
+    const char *p = line; // Parse cursor
+    unsigned int ifindex;
+
+    memset(rec, 0, sizeof(*rec));
+    rec->proto = proto;
+    rec->family = AF_PACKET;
+    parse_hex(&p);                                  // sk
+    parse_dec(&p);                                  // RefCnt
+    rec->state = (unsigned char)parse_dec(&p);      // Type: SOCK_RAW or SOCK_DGRAM
+    while (*p == ' ')
+        p++;
+    rec->lport = (unsigned short)parse_hex(&p);     // Ethertype (ETH_P_*)
+    ifindex = (unsigned int)parse_dec(&p);          // Bound interface, 0 for all
+    memcpy(rec->laddr, &ifindex, sizeof(ifindex));
+    parse_dec(&p);                                  // R (running)
+    rec->rxq = (unsigned int)parse_dec(&p);         // Rmem
+    rec->uid = (unsigned int)parse_dec(&p);
+    rec->inode = parse_dec(&p);
+    return *p == '\0' || *p == ' ' ? 0 : -1;
+}
+
+// Function to parse one /proc/net/netlink line, returns 0 on success
+// Columns: sk Eth Pid Groups Rmem Wmem Dump Locks Drops Inode
+int parse_netlink_line(const char *line, int proto, struct sock_rec *rec)
+{
+    const char *p = line; // Parse cursor
+    unsigned int portid;
+
+    memset(rec, 0, sizeof(*rec));
+    rec->proto = proto;
+    rec->family = AF_NETLINK;
+    parse_hex(&p);                                  // sk
+    rec->lport = (unsigned short)parse_dec(&p);     // Netlink protocol (NETLINK_*)
+    portid = (unsigned int)parse_dec(&p);           // Port id, 0 for kernel sockets
+    memcpy(rec->laddr, &portid, sizeof(portid));
+    while (*p == ' ')
+        p++;
+    parse_hex(&p);                                  // Groups
+    rec->rxq = (unsigned int)parse_dec(&p);         // Rmem
+    rec->txq = (unsigned int)parse_dec(&p);         // Wmem
+    parse_dec(&p);                                  // Dump
+    parse_dec(&p);                                  // Locks
+    parse_dec(&p);                                  // Drops
+    rec->inode = parse_dec(&p);
+    rec->uid = (unsigned int)-1;                    // Not reported by the table
+    return 0;
+}
+
+// Function to stream the sockets of one table through a callback
+// Returns the number of sockets read, or -1 when the table is unavailable.
+long for_each_socket(int proto, int (*cb)(const struct sock_rec *, void *), void *ctx)
+{
+    static struct line_reader reader; // Reused: bounded, not per-socket
+    struct sock_rec rec;              // The one socket in flight
+    long n = 0;
+    char *line;
+
+    reader.fd = open(sock_tables[proto].path, O_RDONLY | O_CLOEXEC);
+    if (reader.fd < 0)
+        return -1;
+    reader.len = reader.pos = 0;
+    stats_begin(PHASE_PARSE);
+    next_line(&reader); // Skip header
+    while ((line = next_line(&reader)) != NULL)
+    {
+        int family = sock_tables[proto].family; // Selects the line format
+        int bad = family == AF_PACKET    ? parse_packet_line(line, proto, &rec)
+                  : family == AF_NETLINK ? parse_netlink_line(line, proto, &rec)
+                                         : parse_sock_line(line, proto, &rec);
+        if (bad < 0)
+            continue;
+        n++;
+        if (cb(&rec, ctx) < 0)
+            break;
+    }
+    stats_end();
+    close(reader.fd);
+    return n;
+}
+
+// Function to remember the socket inode bound to each TCP port (for_each_socket callback)
+int map_port_inode(const struct sock_rec *rec, void *arg)
+{
+    unsigned long long *port_inode = arg; // Indexed by local port
+
+    if (rec->inode && (rec->state == 10 || !port_inode[rec->lport]))
+        port_inode[rec->lport] = rec->inode; // A listener wins over connections
+    return 0;
+}
+
+// Function to get process information for a local TCP port: the socket tables and the
+// inode index are read once per run, after which each port is two lookups
+char *get_process_info(int port)
+{
+    static unsigned long long *port_inode; // Local port -> socket inode
+    static char process_info[512];         // Buffer for process information
+
+    if (!port_inode)
+    {
+        port_inode = alloc_calloc(END_PORT + 1, sizeof(*port_inode));
+        if (!port_inode)
+            xrealloc(NULL, (size_t)-1); // Reports and exits
+        build_inode_index();
+        for (int proto = PROTO_TCP; proto <= PROTO_TCP6; proto++)
+            for_each_socket(proto, map_port_inode, port_inode);
+    }
+
+    const struct owner *o = inode_lookup(&inodes, port_inode[port & END_PORT]);
+    process_info[0] = '\0';
+    if (o)
+    {
+        char pid[16]; // PID column text
+        snprintf(pid, sizeof(pid), "%d", o->pid);
+        snprintf(process_info, sizeof(process_info), "%-15s  PID: %-6s  User: %-8s",
+                 strings.pool + o->comm, pid, strings.pool + o->user);
+    }
+    return process_info;
+}
+
+// Function to set up an output buffer for fd (-1 collects in spill) before its first
+// write: a long report flushes early, and those flushes must reach fd too
+void out_init(struct out_buf *o, int fd)
+{
+    o->fd = fd;
+    o->len = 0;
+    o->spill = NULL;
+    o->spill_len = o->spill_cap = 0;
+}
+
+// Function to write pending output
+void out_flush(struct out_buf *o)
+{
+    size_t off = 0; // Bytes already written
+    if (o->fd < 0)
+    { // In-memory buffer: move the pending bytes to the spill area
+        if (o->spill_cap - o->spill_len < o->len)
+        {
+            o->spill_cap = o->spill_cap * 2 > o->spill_len + o->len ? o->spill_cap * 2 : o->spill_len + o->len;
+            o->spill = xrealloc(o->spill, o->spill_cap);
+        }
+        memcpy(o->spill + o->spill_len, o->buf, o->len);
+        o->spill_len += o->len;
+        o->len = 0;
+        return;
+    }
+    stats_begin(PHASE_OUTPUT);
+    while (off < o->len)
+    {
+        ssize_t n = write(o->fd, o->buf + off, o->len - off);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break; // Reader went away: drop the rest
+        off += n;
+    }
+    stats_end();
+    o->len = 0;
+}
+
+// Function to append formatted text, flushing first when the buffer is nearly full
+void out_printf(struct out_buf *o, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+void out_printf(struct out_buf *o, const char *fmt, ...)
+{
+    va_list ap;
+    if (sizeof(o->buf) - o->len < OUT_LINE_MAX)
+        out_flush(o); // Guarantees room for one full line
+    va_start(ap, fmt);
+    int n = vsnprintf(o->buf + o->len, sizeof(o->buf) - o->len, fmt, ap);
+    va_end(ap);
+    if (n > 0)
+        o->len += (size_t)n < sizeof(o->buf) - o->len ? (size_t)n : sizeof(o->buf) - o->len - 1;
+}
+
+// Function to append raw bytes, flushing as often as needed
+void out_write(struct out_buf *o, const char *s, size_t n)
+{
+    while (n)
+    {
+        if (o->len == sizeof(o->buf))
+            out_flush(o);
+        size_t k = sizeof(o->buf) - o->len; // Room left
+        if (k > n)
+            k = n;
+        memcpy(o->buf + o->len, s, k);
+        o->len += k;
+        s += k;
+        n -= k;
+    }
+}
+
+// Function to append n copies of a byte
+void out_fill(struct out_buf *o, int c, size_t n)
+{
+    while (n)
+    {
+        if (o->len == sizeof(o->buf))
+            out_flush(o);
+        size_t k = sizeof(o->buf) - o->len; // Room left
+        if (k > n)
+            k = n;
+        memset(o->buf + o->len, c, k);
+        o->len += k;
+        n -= k;
+    }
+}
+
+// Function to format an unsigned number, returns its length (buf needs 21 bytes)
+size_t format_uint(char *buf, unsigned long long v)
+{
+    char tmp[20]; // Digits in reverse
+    size_t n = 0;
+    do
+        tmp[n++] = (char)('0' + v % 10);
+    while (v /= 10);
+    for (size_t i = 0; i < n; i++)
+        buf[i] = tmp[n - 1 - i];
+    buf[n] = '\0';
+    return n;
+}
+
+// Function to append a JSON string literal (quotes and escapes included)
+void out_json_string(struct out_buf *o, const char *s)
+{
+    out_write(o, "\"", 1);
+    for (const char *run = s;; s++)
+    {
+        unsigned char ch = (unsigned char)*s; // Current byte
+        if (ch && ch >= 0x20 && ch != '"' && ch != '\\')
+            continue;
+        out_write(o, run, s - run); // Plain bytes up to here
+        if (!ch)
+            break;
+        if (ch == '"' || ch == '\\')
+            out_printf(o, "\\%c", ch);
+        else
+            out_printf(o, "\\u%04x", ch);
+        run = s + 1;
+    }
+    out_write(o, "\"", 1);
+}
+
+// Function to start a table: every column is at least as wide as its header
+void table_init(struct table *t, const char *const *headers, int ncols)
+{
+    t->ncols = ncols;
+    for (int c = 0; c < ncols; c++)
+    {
+        t->header[c] = headers[c];
+        t->width[c] = strlen(headers[c]);
+    }
+}
+
+// Function to widen a column to fit a cell of len bytes (the measuring pass)
+void table_measure(struct table *t, int col, size_t len)
+{
+    if (len > t->width[col])
+        t->width[col] = len;
+}
+
+// Function to emit one cell padded to its column width; the last column ends the row
+void table_cell(struct out_buf *o, const struct table *t, int col, const char *s, size_t len)
+{
+    out_write(o, s, len);
+    if (col == t->ncols - 1)
+        out_write(o, "\n", 1); // No trailing blanks after the last column
+    else
+        out_fill(o, ' ', t->width[col] - len + TABLE_GAP);
+}
+
+// Function to emit the header row of a measured table
+void table_header(struct out_buf *o, const struct table *t)
+{
+    for (int c = 0; c < t->ncols; c++)
+        table_cell(o, t, c, t->header[c], strlen(t->header[c]));
+}
+
+// Function to format an address without a port (IPv6 in brackets); returns its length
+size_t format_address(char *buf, size_t size, int family, const unsigned char *addr)
+{
+    char ip[INET6_ADDRSTRLEN]; // Textual address
+    inet_ntop(family, addr, ip, sizeof(ip));
+    int n = snprintf(buf, size, family == AF_INET6 ? "[%s]" : "%s", ip);
+    return n < 0 ? 0 : (size_t)n < size ? (size_t)n : size - 1;
+}
+
+// Function to format "addr:port" (IPv6 in brackets, port 0 as '*')
+void format_endpoint(char *buf, size_t size, int family, const unsigned char *addr, unsigned short port)
+{
+    size_t n = format_address(buf, size, family, addr);
+    if (port)
+        snprintf(buf + n, size - n, ":%u", port);
+    else
+        snprintf(buf + n, size - n, ":*");
+}
+
+// Function to name small protocol numbers; returns NULL when not in the table
+const char *number_name(const struct num_name *t, unsigned int v)
+{
+    for (; t->name; t++)
+        if (t->num == v)
+            return t->name;
+    return NULL;
+}
+
+// Function to format the local (remote == 0) or remote endpoint of any socket kind
+void format_sock_endpoint(char *buf, size_t size, const struct sock_rec *rec, int remote)
+{
+    unsigned int id;          // Packet ifindex or netlink port id
+    char ifname[IF_NAMESIZE]; // Packet interface name
+    const char *name;
+
+    if (rec->family == AF_PACKET || rec->family == AF_NETLINK)
+    {
+        if (remote)
+        { // Neither kind has a peer address
+            snprintf(buf, size, "*");
+            return;
+        }
+        memcpy(&id, rec->laddr, sizeof(id));
+        if (rec->family == AF_PACKET)
+        { // "ethertype@interface"
+            name = number_name(ether_names, rec->lport);
+            const char *dev = id && if_indextoname(id, ifname) ? ifname : "*";
+            if (name)
+                snprintf(buf, size, "%s@%s", name, dev);
+            else
+                snprintf(buf, size, "0x%04x@%s", rec->lport, dev);
+        }
+        else
+        { // "family:portid"
+            name = number_name(netlink_names, rec->lport);
+            if (name)
+                snprintf(buf, size, "%s:%u", name, id);
+            else
+                snprintf(buf, size, "%u:%u", rec->lport, id);
+        }
+        return;
+    }
+    if (!remote && (rec->proto == PROTO_RAW || rec->proto == PROTO_RAW6))
+    { // Raw sockets are bound to an IP protocol, shown in place of the port
+        char ip[INET6_ADDRSTRLEN];
+        inet_ntop(rec->family, rec->laddr, ip, sizeof(ip));
+        name = number_name(ipproto_names, rec->lport);
+        if (name)
+            snprintf(buf, size, rec->family == AF_INET6 ? "[%s]:%s" : "%s:%s", ip, name);
+        else
+            snprintf(buf, size, rec->family == AF_INET6 ? "[%s]:%u" : "%s:%u", ip, rec->lport);
+        return;
+    }
+    format_endpoint(buf, size, rec->family, remote ? rec->raddr : rec->laddr, remote ? rec->rport : rec->lport);
+}
+
+// Function to name a socket state for output
+const char *state_name(const struct sock_rec *rec)
+{
+    if (rec->proto == PROTO_PACKET)
+        return rec->state == SOCK_DGRAM ? "DGRAM" : "RAW"; // Cooked or raw capture
+    if (rec->proto == PROTO_NETLINK)
+        return "-"; // Netlink sockets have no connection state
+    if (rec->proto != PROTO_TCP && rec->proto != PROTO_TCP6)
+        return rec->state == 1 ? "ESTABLISHED" : "UNCONN"; // UDP/raw reuse TCP_CLOSE for unconnected
+    return rec->state < sizeof(tcp_states) / sizeof(*tcp_states) ? tcp_states[rec->state] : "UNKNOWN";
+}
+
+// Function to tell whether the --ports/--shard selection keeps sockets without ports:
+// raw (IP protocol) and packet (ethertype) sockets are dropped by an explicit --ports
+// and kept by shard 0 alone, so a sharded snapshot lists them once
+int port_selection_others(void)
+{
+    return !opts.ports && opts.shard == 0;
+}
+
+// Function to apply a port selection to a socket. Only TCP and UDP have ports; the
+// other tables are kept or dropped as a whole by others (see port_selection_others)
+int sock_port_selected(int proto, int lport, const unsigned char *set, int others)
+{
+    if (!set)
+        return 1;
+    if (proto <= PROTO_UDP6)
+        return port_in_set(set, lport);
+    return others;
+}
+
+// Function to apply a --state filter (TCP numbering, which only TCP and UDP rows use)
+int sock_state_selected(int proto, int rec_state, int state)
+{
+    return state < 0 || (proto <= PROTO_UDP6 && rec_state == state);
+}
+
+// Filter and output state for the streaming callback
+struct stream_ctx
+{
+    const unsigned char *ports; // Local port filter, NULL for all
+    int state;                  // State filter (kernel number), -1 for all
+    struct out_buf *out;        // Destination
+    long shown;                 // Rows written
+    int others;                 // Port filter keeps raw/packet sockets
+};
+
+// Function to filter, attribute and print one socket (stream callback)
+int stream_socket(const struct sock_rec *rec, void *arg)
+{
+    struct stream_ctx *ctx = arg; // Filters and output
+    char local[64], remote[64];   // Formatted endpoints
+
+    if (!sock_port_selected(rec->proto, rec->lport, ctx->ports, ctx->others) ||
+        !sock_state_selected(rec->proto, rec->state, ctx->state))
+        return 0;
+
+    const struct owner *o = inode_lookup(&inodes, rec->inode); // Attribution
+    format_sock_endpoint(local, sizeof(local), rec, 0);
+    format_sock_endpoint(remote, sizeof(remote), rec, 1);
+    if (o)
+        out_printf(ctx->out, "%-*s %-*s %-*s %-*s %-*d %-15s %s\n",
+                   COL_PROTO, sock_tables[rec->proto].name, COL_ADDR, local, COL_ADDR, remote,
+                   COL_STATE, state_name(rec), COL_PID, o->pid,
+                   strings.pool + o->comm, strings.pool + o->user);
+    else
+        out_printf(ctx->out, "%-*s %-*s %-*s %-*s %-*s %-15s %s\n",
+                   COL_PROTO, sock_tables[rec->proto].name, COL_ADDR, local, COL_ADDR, remote,
+                   COL_STATE, state_name(rec), COL_PID, "-", "-", "-");
+    ctx->shown++;
+    return 0;
+}
+
+// Function to map a --state name to the kernel state number, -1 if unknown
+int parse_state(const char *name)
+{
+    if (strcasecmp(name, "UNCONN") == 0)
+        return 7; // UDP unconnected sockets sit in TCP_CLOSE
+    for (size_t i = 1; i < sizeof(tcp_states) / sizeof(*tcp_states); i++)
+        if (strcasecmp(name, tcp_states[i]) == 0)
+            return (int)i;
+    return -1;
+}
+
+// Function to parse a --proto list ("tcp,udp6") into a PROTO_* bitmask
+int parse_proto_list(const char *spec)
+{
+    int mask = 0; // Selected tables
+    char buf[128];
+    snprintf(buf, sizeof(buf), "%s", spec);
+    for (char *save, *tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save))
+    {
+        int found = 0;
+        for (int i = 0; i < NUM_PROTOS; i++)
+        { // "tcp" selects tcp only; "tcp6" selects tcp6
+            if (strcmp(tok, sock_tables[i].name) == 0)
+            {
+                mask |= 1 << i;
+                found = 1;
+            }
+        }
+        if (!found)
+            return -1;
+    }
+    return mask;
+}
+
+// Function implementing --stream: constant-memory socket-table listing
+int run_stream(const unsigned char *set)
+{
+    static struct out_buf out;  // Bounded output buffer
+    struct stream_ctx ctx = {set, -1, &out, 0, port_selection_others()};
+
+    out_init(&out, STDOUT_FILENO);
+    if (opts.state)
+    {
+        ctx.state = parse_state(opts.state);
+        if (ctx.state < 0)
+        {
+            fprintf(stderr, "Unknown state: %s\n", opts.state);
+            return 1;
+        }
+    }
+
+    build_inode_index(); // The only per-socket state kept resident
+
+    out_printf(&out, "%-*s %-*s %-*s %-*s %-*s %-15s %s\n",
+               COL_PROTO, "PROTO", COL_ADDR, "LOCAL", COL_ADDR, "REMOTE",
+               COL_STATE, "STATE", COL_PID, "PID", "PROCESS", "USER");
+    for (int proto = 0; proto < NUM_PROTOS; proto++)
+        if (opts.protos & (1 << proto))
+            for_each_socket(proto, stream_socket, &ctx);
+    out_flush(&out);
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Socket buffer memory (--mem)
+//
+// One inet_diag dump per TCP/UDP table with INET_DIAG_SKMEMINFO requested
+// returns every socket's memory counters in the same pass that lists it, so
+// the cost is a netlink dump, not a procfs read per socket. Sockets are
+// charged to their owner through the inode index and, for connections, to
+// the listener on their local port.
+// ---------------------------------------------------------------------------
+
+// Function to dump the sockets of one family and protocol in the given states (bitmask
+// of 1 << TCP state) via inet_diag, calling cb with each message and its length
+// (attributes requested with the ext bits follow the message); returns 0, or -1 on
+// failure. The kernel applies the state filter, so the cost follows the matching sockets.
+int diag_dump(int nl, int family, int protocol, uint32_t states, uint8_t ext,
+              void (*cb)(const struct inet_diag_msg *, size_t, void *), void *ctx)
+{
+    struct
+    {
+        struct nlmsghdr nlh;
+        struct inet_diag_req_v2 req;
+    } msg = {{sizeof(msg), SOCK_DIAG_BY_FAMILY, NLM_F_REQUEST | NLM_F_DUMP, 0, 0},
+             {.sdiag_family = (uint8_t)family, .sdiag_protocol = (uint8_t)protocol,
+              .idiag_ext = ext, .idiag_states = states}};
+    static char buf[32768]; // Dump batches; only the caller's thread dumps
+    int rc = 1;             // 1 while the dump is still arriving
+
+    if (send(nl, &msg, sizeof(msg), 0) < 0)
+        return -1;
+    stats_begin(PHASE_PARSE);
+    while (rc > 0)
+    {
+        ssize_t n = recv(nl, buf, sizeof(buf), 0);
+        if (n <= 0)
+            rc = -1;
+        for (struct nlmsghdr *m = (struct nlmsghdr *)buf; rc > 0 && NLMSG_OK(m, (size_t)n); m = NLMSG_NEXT(m, n))
+        {
+            if (m->nlmsg_type == NLMSG_DONE)
+                rc = 0;
+            else if (m->nlmsg_type == NLMSG_ERROR)
+                rc = -1;
+            else
+                cb(NLMSG_DATA(m), m->nlmsg_len - NLMSG_HDRLEN, ctx);
+        }
+    }
+    while (rc < 0 && recv(nl, buf, sizeof(buf), MSG_DONTWAIT) > 0)
+        ; // Drop the rest of a failed dump: callers reuse the socket for the next one
+    stats_end();
+    return rc;
+}
+
+// Memory counters of one socket, from INET_DIAG_SKMEMINFO
+struct sk_mem
+{
+    unsigned long long inode; // Socket inode, 0 for orphans
+    unsigned char proto;      // PROTO_* table of the socket
+    unsigned char state;      // Kernel state (TCP_* numbering)
+    unsigned short lport;     // Local port
+    unsigned short rport;     // Remote port, 0 when unconnected
+    unsigned char laddr[16];  // Local address
+    unsigned char raddr[16];  // Remote address
+    uint32_t rmem, rcvbuf;    // Receive memory charged (incl. backlog) / SO_RCVBUF
+    uint32_t wmem, sndbuf;    // Send memory charged / SO_SNDBUF
+    uint32_t queued;          // Unread plus unsent/unacked bytes, 0 for listeners
+    uint32_t drops;           // Packets dropped on the socket (listeners: accept overflow)
+};
+
+// All sockets of one --mem collection
+struct mem_dump
+{
+    struct sk_mem *recs;
+    size_t n, cap;
+    unsigned char proto; // PROTO_* of the dump in progress
+};
+
+// Memory totals of a group of sockets: a process, or a listener and its connections
+struct mem_total
+{
+    int pid;                  // Owning PID, 0 when unattributed
+    unsigned int comm;        // Process name (string cache offset), NO_STRING when unknown
+    size_t listener;          // Listener socket (index into the dump), listener totals only
+    unsigned int sockets;     // Sockets (listener totals: connections)
+    unsigned long long rmem, rcvbuf, wmem, sndbuf, queued, drops;
+};
+
+// Function to key a socket that has no inode (a connection still in the accept
+// queue) by its table and endpoints; bit 63 keeps the key out of the inode range
+unsigned long long mem_tuple_key(int proto, const unsigned char *laddr, unsigned short lport,
+                                 const unsigned char *raddr, unsigned short rport)
+{
+    size_t h = hash_bytes(laddr, 16);
+    h = hash_bytes_from(h, raddr, 16);
+    h = hash_bytes_from(h, &lport, sizeof(lport));
+    h = hash_bytes_from(h, &rport, sizeof(rport));
+    h = hash_bytes_from(h, &proto, sizeof(proto));
+    return (unsigned long long)h | 1ULL << 63;
+}
+
+// Function to record one socket and its memory counters (diag_dump callback)
+void mem_collect(const struct inet_diag_msg *d, size_t len, void *arg)
+{
+    struct mem_dump *md = arg;   // Collection
+    int rest = len > sizeof(*d) ? (int)(len - sizeof(*d)) : 0; // Attribute bytes
+    struct sk_mem *s;
+
+    if (md->n == md->cap)
+    {
+        md->cap = md->cap ? md->cap * 2 : 1024;
+        md->recs = xrealloc(md->recs, md->cap * sizeof(*md->recs));
+    }
+    s = &md->recs[md->n++];
+    memset(s, 0, sizeof(*s));
+    s->inode = d->idiag_inode;
+    s->proto = md->proto;
+    s->state = d->idiag_state;
+    s->lport = ntohs(d->id.idiag_sport);
+    s->rport = ntohs(d->id.idiag_dport);
+    memcpy(s->laddr, d->id.idiag_src, sizeof(s->laddr));
+    memcpy(s->raddr, d->id.idiag_dst, sizeof(s->raddr));
+    if (d->idiag_state != 10)
+        s->queued = d->idiag_rqueue + d->idiag_wqueue; // LISTEN: accept queue lengths, not bytes
+    for (const struct rtattr *a = (const struct rtattr *)(d + 1); RTA_OK(a, rest); a = RTA_NEXT(a, rest))
+    {
+        if (a->rta_type != INET_DIAG_SKMEMINFO || RTA_PAYLOAD(a) < SK_MEMINFO_DROPS * sizeof(uint32_t))
+            continue;
+        const uint32_t *m = RTA_DATA(a); // SK_MEMINFO_* counters
+        s->rmem = m[SK_MEMINFO_RMEM_ALLOC] + m[SK_MEMINFO_BACKLOG];
+        s->rcvbuf = m[SK_MEMINFO_RCVBUF];
+        // TCP charges its write queue to wmem_queued; UDP has none and uses wmem_alloc
+        s->wmem = md->proto <= PROTO_TCP6 ? m[SK_MEMINFO_WMEM_QUEUED] : m[SK_MEMINFO_WMEM_ALLOC];
+        s->sndbuf = m[SK_MEMINFO_SNDBUF];
+        if (RTA_PAYLOAD(a) > SK_MEMINFO_DROPS * sizeof(uint32_t))
+            s->drops = m[SK_MEMINFO_DROPS]; // Kernels since 4.6
+    }
+}
+
+// Function to dump the selected TCP/UDP tables with their memory counters into md;
+// returns 0, or -1 when a dump fails. TIME_WAIT and SYN_RECV mini-sockets hold no
+// buffers and are left out by the kernel-side state filter.
+int mem_load(int nl, struct mem_dump *md)
+{
+    uint32_t states = ~((1u << 6) | (1u << 12)); // All but TIME_WAIT, NEW_SYN_RECV
+
+    for (int proto = PROTO_TCP; proto <= PROTO_UDP6; proto++)
+    {
+        if (!(opts.protos & (1 << proto)))
+            continue;
+        md->proto = (unsigned char)proto;
+        if (diag_dump(nl, sock_tables[proto].family, proto <= PROTO_TCP6 ? IPPROTO_TCP : IPPROTO_UDP,
+                      states, 1 << (INET_DIAG_SKMEMINFO - 1), mem_collect, md) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+// Function to add one socket's counters to a total
+void mem_add(struct mem_total *t, const struct sk_mem *s)
+{
+    t->rmem += s->rmem;
+    t->rcvbuf += s->rcvbuf;
+    t->wmem += s->wmem;
+    t->sndbuf += s->sndbuf;
+    t->queued += s->queued;
+    t->drops += s->drops;
+}
+
+// Function to fold one total into another
+void mem_merge(struct mem_total *t, const struct mem_total *u)
+{
+    t->sockets += u->sockets;
+    t->rmem += u->rmem;
+    t->rcvbuf += u->rcvbuf;
+    t->wmem += u->wmem;
+    t->sndbuf += u->sndbuf;
+    t->queued += u->queued;
+    t->drops += u->drops;
+}
+
+// Function to order totals by memory charged (receive plus send), largest first
+int cmp_mem_total(const void *a, const void *b)
+{
+    const struct mem_total *x = a, *y = b;
+    unsigned long long mx = x->rmem + x->wmem, my = y->rmem + y->wmem;
+    if (mx != my)
+        return mx < my ? 1 : -1;
+    if (x->drops != y->drops)
+        return x->drops < y->drops ? 1 : -1;
+    return x->pid - y->pid;
+}
+
+// Function to order totals by (pid, name), to merge owners of the same process
+int cmp_mem_owner(const void *a, const void *b)
+{
+    const struct mem_total *x = a, *y = b;
+    if (x->pid != y->pid)
+        return x->pid < y->pid ? -1 : 1;
+    return x->comm < y->comm ? -1 : x->comm > y->comm;
+}
+
+// Function to tell whether a socket is a listener: TCP LISTEN or bound unconnected UDP
+int mem_is_listener(const struct sk_mem *s)
+{
+    if (s->proto <= PROTO_TCP6)
+        return s->state == 10;
+    return s->lport && !s->rport;
+}
+
+// Function to print --mem totals as a measured table (JSON: an array of objects).
+// Listener tables (listeners set) label each row with the listener endpoint.
+void mem_print(struct out_buf *out, const struct mem_total *t, size_t n, const struct mem_dump *md,
+               int listeners)
+{
+    static const char *const proc_headers[] = {"PID", "PROCESS", "SOCKETS", "RMEM", "RCVBUF",
+                                               "WMEM", "SNDBUF", "QUEUED", "DROPS"};
+    static const char *const listen_headers[] = {"PROTO", "LISTENER", "PID", "PROCESS", "CONNS",
+                                                 "RMEM", "WMEM", "QUEUED", "DROPS"};
+    struct table tab; // Column widths
+    size_t shown = opts.json || n < MEM_TOP ? n : MEM_TOP;
+
+    table_init(&tab, listeners ? listen_headers : proc_headers, 9);
+    for (int pass = 0; pass < 2; pass++)
+    { // Pass 0 measures, pass 1 prints
+        if (pass && opts.json)
+            out_write(out, "[", 1);
+        else if (pass)
+            table_header(out, &tab);
+        for (size_t i = 0; i < shown; i++)
+        {
+            const struct mem_total *m = &t[i];
+            const char *comm = m->comm == NO_STRING ? "-" : strings.pool + m->comm;
+            char pid[24], socks[24], rmem[24], rcvbuf[24], wmem[24], sndbuf[24], queued[24],
+                drops[24], ep[80];
+            const char *proc_cells[9] = {pid, comm, socks, rmem, rcvbuf, wmem, sndbuf, queued, drops};
+            const char *listen_cells[9] = {NULL, ep, pid, comm, socks, rmem, wmem, queued, drops};
+            const char **cells = listeners ? listen_cells : proc_cells;
+            const struct sk_mem *l = listeners ? &md->recs[m->listener] : NULL;
+
+            if (m->pid)
+                format_uint(pid, (unsigned)m->pid);
+            else
+                strcpy(pid, "-");
+            format_uint(socks, m->sockets);
+            format_uint(rmem, m->rmem);
+            format_uint(rcvbuf, m->rcvbuf);
+            format_uint(wmem, m->wmem);
+            format_uint(sndbuf, m->sndbuf);
+            format_uint(queued, m->queued);
+            format_uint(drops, m->drops);
+            if (l)
+            {
+                format_endpoint(ep, sizeof(ep), sock_tables[l->proto].family, l->laddr, l->lport);
+                listen_cells[0] = sock_tables[l->proto].name;
+            }
+            if (pass && opts.json)
+            {
+                out_write(out, i ? ",\n  {" : "\n  {", i ? 5 : 4);
+                if (l)
+                {
+                    out_printf(out, "\"proto\":\"%s\",\"listener\":", sock_tables[l->proto].name);
+                    out_json_string(out, ep);
+                    out_write(out, ",", 1);
+                }
+                if (m->pid)
+                {
+                    out_printf(out, "\"pid\":%d,\"process\":", m->pid);
+                    out_json_string(out, comm);
+                    out_write(out, ",", 1);
+                }
+                out_printf(out, "\"%s\":%u,\"rmem\":%llu,\"rcvbuf\":%llu,\"wmem\":%llu,\"sndbuf\":%llu,"
+                                "\"queued\":%llu,\"drops\":%llu}",
+                           l ? "conns" : "sockets", m->sockets, m->rmem, m->rcvbuf, m->wmem, m->sndbuf,
+                           m->queued, m->drops);
+                continue;
+            }
+            for (int c = 0; c < 9; c++)
+            {
+                if (pass)
+                    table_cell(out, &tab, c, cells[c], strlen(cells[c]));
+                else
+                    table_measure(&tab, c, strlen(cells[c]));
+            }
+        }
+    }
+    if (opts.json)
+        out_write(out, n ? "\n]" : "]", n ? 2 : 1);
+}
+
+// Function implementing --mem: socket buffer memory per process and per listener.
+// Every socket is charged to its owning process; connections are also charged to
+// the listener on their local port (the first listener of that table and port),
+// which shows which service is holding memory under load. Tables list the
+// MEM_TOP largest groups; --json prints all of them.
+int run_mem(const unsigned char *set)
+{
+    static struct out_buf out;   // Buffered report
+    struct mem_dump md = {0};    // Every socket with its counters
+    struct mem_total total = {0}; // Whole host
+    struct mem_total *procs, *lists;
+    uint32_t *by_port;           // (table, port) -> listener total + 1
+    size_t nprocs = 0, nlists = 0;
+    char buf[1024];              // /proc/net/sockstat
+    int nl = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_SOCK_DIAG);
+
+    out_init(&out, STDOUT_FILENO);
+    if (nl < 0)
+    {
+        perror("NETLINK_SOCK_DIAG");
+        return 1;
+    }
+    build_inode_index();
+    if (mem_load(nl, &md) < 0)
+    {
+        fprintf(stderr, "inet_diag dump failed\n");
+        close(nl);
+        return 1;
+    }
+    close(nl);
+
+    // Per owner (plus one slot for unattributed sockets), then per listener
+    procs = xrealloc(NULL, (nowners + 1) * sizeof(*procs));
+    for (size_t i = 0; i <= nowners; i++)
+        procs[i] = (struct mem_total){i < nowners ? owners[i].pid : 0,
+                                      i < nowners ? owners[i].comm : NO_STRING, 0, 0, 0, 0, 0, 0, 0, 0};
+    lists = xrealloc(NULL, (md.n + 1) * sizeof(*lists));
+    by_port = alloc_calloc((PROTO_UDP6 + 1) * (END_PORT + 1), sizeof(*by_port));
+    if (!by_port)
+        xrealloc(NULL, (size_t)-1); // Reports and exits
+    for (size_t i = 0; i < md.n; i++)
+    {
+        const struct sk_mem *s = &md.recs[i];
+        const struct owner *o = inode_lookup(&inodes, s->inode);
+        uint32_t *slot = &by_port[s->proto * (END_PORT + 1) + s->lport];
+
+        if (opts.pid >= 0 && (!o || o->pid != opts.pid))
+            continue;
+        mem_add(&total, s);
+        total.sockets++;
+        mem_add(&procs[o ? (size_t)(o - owners) : nowners], s);
+        procs[o ? (size_t)(o - owners) : nowners].sockets++;
+        if (!mem_is_listener(s) || (set && !port_in_set(set, s->lport)) || *slot)
+            continue;
+        lists[nlists] = (struct mem_total){o ? o->pid : 0, o ? o->comm : NO_STRING, i, 0, 0, 0, 0, 0, 0, 0};
+        *slot = (uint32_t)++nlists;
+    }
+    for (size_t i = 0; i < md.n; i++)
+    { // Listeners and their TCP connections (UDP listeners stand alone)
+        const struct sk_mem *s = &md.recs[i];
+        uint32_t slot = by_port[s->proto * (END_PORT + 1) + s->lport];
+        if (!slot || (s->proto > PROTO_TCP6 && !mem_is_listener(s)))
+            continue;
+        if (!mem_is_listener(s))
+            lists[slot - 1].sockets++;
+        mem_add(&lists[slot - 1], s); // Listener drops are accept-queue overflows
+    }
+
+    // Merge owners of one process, drop empty ones, largest first
+    qsort(procs, nowners, sizeof(*procs), cmp_mem_owner);
+    for (size_t i = 0; i <= nowners; i++)
+    {
+        if (!procs[i].sockets)
+            continue;
+        if (nprocs && i < nowners && cmp_mem_owner(&procs[nprocs - 1], &procs[i]) == 0)
+        { // Same process listed twice (threads with their own fd table)
+            mem_merge(&procs[nprocs - 1], &procs[i]);
+            continue;
+        }
+        procs[nprocs++] = procs[i];
+    }
+    qsort(procs, nprocs, sizeof(*procs), cmp_mem_total);
+    qsort(lists, nlists, sizeof(*lists), cmp_mem_total);
+
+    if (opts.json)
+    {
+        out_write(&out, "{\"processes\":", 13);
+        mem_print(&out, procs, nprocs, &md, 0);
+        out_write(&out, ",\n\"listeners\":", 14);
+        mem_print(&out, lists, nlists, &md, 1);
+        out_printf(&out, ",\n\"total\":{\"sockets\":%u,\"rmem\":%llu,\"rcvbuf\":%llu,\"wmem\":%llu,"
+                         "\"sndbuf\":%llu,\"queued\":%llu,\"drops\":%llu}}\n",
+                   total.sockets, total.rmem, total.rcvbuf, total.wmem, total.sndbuf, total.queued,
+                   total.drops);
+    }
+    else
+    {
+        mem_print(&out, procs, nprocs, &md, 0);
+        out_write(&out, "\n", 1);
+        mem_print(&out, lists, nlists, &md, 1);
+        out_printf(&out, "\n%u sockets: %llu bytes receive memory, %llu send, %llu queued, "
+                         "%llu drops\n",
+                   total.sockets, total.rmem, total.wmem, total.queued, total.drops);
+        if (read_sysctl("/proc/net/sockstat", buf, sizeof(buf)) == 0)
+        { // The kernel's own accounting, in pages, for comparison
+            const char *tcp = strstr(buf, "TCP:"), *udp = strstr(buf, "UDP:");
+            const char *tm = tcp ? strstr(tcp, " mem ") : NULL, *um = udp ? strstr(udp, " mem ") : NULL;
+            long page = sysconf(_SC_PAGESIZE);
+            out_printf(&out, "Kernel accounting (all namespaces): TCP %lld bytes, UDP %lld bytes\n",
+                       tm ? atoll(tm + 5) * page : 0, um ? atoll(um + 5) * page : 0);
+        }
+        if (nprocs > MEM_TOP || nlists > MEM_TOP)
+            out_printf(&out, "Largest %d of %zu processes and %zu listeners shown (--json for all)\n",
+                       MEM_TOP, nprocs, nlists);
+    }
+    out_flush(&out);
+    alloc_free(md.recs);
+    alloc_free(procs);
+    alloc_free(lists);
+    alloc_free(by_port);
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Columnar result set (--list)
+//
+// Sockets are stored struct-of-arrays: each attribute lives in its own
+// densely packed column, and addresses/names are small integer ids into
+// intern tables. Filters are SIMD scans over single columns producing a
+// selection mask; sorting is an LSD radix sort of (key, row) pairs, one
+// stable pass group per sort key from the least significant key up, with
+// keys pre-packed into 32-bit chunks and constant bytes skipped.
+// ---------------------------------------------------------------------------
+
+// One interned address (family + raw bytes)
+struct addr_ent
+{
+    unsigned char family;    // AF_* of the address
+    unsigned char bytes[16]; // Address bytes as stored in sock_rec
+};
+
+// Struct-of-arrays socket table
+struct result_set
+{
+    size_t n, cap;          // Rows used / allocated
+    uint8_t *proto;         // PROTO_* per row
+    uint8_t *state;         // Kernel state
+    uint16_t *lport;        // Local port
+    uint16_t *rport;        // Remote port
+    uint32_t *laddr;        // Local address id (index into addrs)
+    uint32_t *raddr;        // Remote address id
+    int32_t *pid;           // Owning PID, 0 when unattributed
+    uint32_t *uid;          // Socket uid from the table
+    uint32_t *comm;         // Process name string id, NO_STRING when unattributed
+    uint32_t *user;         // User name string id, NO_STRING when unattributed
+    uint32_t *txq;          // Send queue bytes
+    uint32_t *rxq;          // Receive queue bytes
+    uint64_t *inode;        // Socket inode
+    uint32_t *rmem;         // --mem: receive memory charged, MEM_NONE if not a TCP/UDP socket
+    uint32_t *wmem;         // --mem: send memory charged (NULL without --mem)
+    uint32_t *queued;       // --mem: unread plus unsent/unacked bytes
+    uint32_t *drops;        // --mem: packets dropped
+    uint32_t *exe;          // --exe: executable path string id (NULL without --exe)
+    uint32_t *build;        // --exe: build ID or content hash string id
+    struct addr_ent *addrs; // Interned addresses
+    size_t naddrs, addrs_cap;
+    uint32_t *addr_slots;   // Open-addressed id+1 table over addrs
+    size_t addr_nslots;
+};
+
+// Sort key of --sort
+struct sort_key
+{
+    int col;  // SORT_* column
+    int desc; // Descending order
+};
+
+// Names accepted by --sort, indexed by SORT_* value
+const char *sort_names[] = {"proto", "state", "port", "rport", "local", "remote",
+                            "pid", "uid", "user", "process", "inode", "rmem", "wmem",
+                            "queued", "drops"};
+
+// Function to grow every column of a result set to hold cap rows
+void result_reserve(struct result_set *r, size_t cap)
+{
+    if (cap <= r->cap)
+        return;
+    cap = cap < 2 * r->cap ? 2 * r->cap : cap < 1024 ? 1024 : cap;
+    r->proto = xrealloc(r->proto, cap * sizeof(*r->proto));
+    r->state = xrealloc(r->state, cap * sizeof(*r->state));
+    r->lport = xrealloc(r->lport, cap * sizeof(*r->lport));
+    r->rport = xrealloc(r->rport, cap * sizeof(*r->rport));
+    r->laddr = xrealloc(r->laddr, cap * sizeof(*r->laddr));
+    r->raddr = xrealloc(r->raddr, cap * sizeof(*r->raddr));
+    r->pid = xrealloc(r->pid, cap * sizeof(*r->pid));
+    r->uid = xrealloc(r->uid, cap * sizeof(*r->uid));
+    r->comm = xrealloc(r->comm, cap * sizeof(*r->comm));
+    r->user = xrealloc(r->user, cap * sizeof(*r->user));
+    r->txq = xrealloc(r->txq, cap * sizeof(*r->txq));
+    r->rxq = xrealloc(r->rxq, cap * sizeof(*r->rxq));
+    r->inode = xrealloc(r->inode, cap * sizeof(*r->inode));
+    r->cap = cap;
+}
+
+// Function to intern an address and return its id
+uint32_t result_addr(struct result_set *r, int family, const unsigned char *bytes)
+{
+    struct addr_ent key; // Probe key
+    memset(&key, 0, sizeof(key));
+    key.family = (unsigned char)family;
+    memcpy(key.bytes, bytes, sizeof(key.bytes));
+
+    if (r->naddrs * 2 >= r->addr_nslots)
+    { // Rebuild the id table at twice the size
+        size_t nslots = r->addr_nslots ? r->addr_nslots * 2 : 1024;
+        uint32_t *slots = alloc_calloc(nslots, sizeof(*slots));
+        if (!slots)
+            xrealloc(NULL, (size_t)-1); // Reports and exits
+        for (size_t id = 0; id < r->naddrs; id++)
+        {
+            size_t j = hash_bytes(&r->addrs[id], sizeof(key)) & (nslots - 1);
+            while (slots[j])
+                j = (j + 1) & (nslots - 1);
+            slots[j] = (uint32_t)id + 1;
+        }
+        alloc_free(r->addr_slots);
+        r->addr_slots = slots;
+        r->addr_nslots = nslots;
+    }
+    size_t i = hash_bytes(&key, sizeof(key)) & (r->addr_nslots - 1);
+    while (r->addr_slots[i])
+    {
+        if (memcmp(&r->addrs[r->addr_slots[i] - 1], &key, sizeof(key)) == 0)
+            return r->addr_slots[i] - 1;
+        i = (i + 1) & (r->addr_nslots - 1);
+    }
+    if (r->naddrs == r->addrs_cap)
+    {
+        r->addrs_cap = r->addrs_cap ? r->addrs_cap * 2 : 256;
+        r->addrs = xrealloc(r->addrs, r->addrs_cap * sizeof(*r->addrs));
+    }
+    r->addrs[r->naddrs] = key;
+    r->addr_slots[i] = (uint32_t)r->naddrs + 1;
+    return (uint32_t)r->naddrs++;
+}
+
+// Function to append one socket to the result set (for_each_socket callback)
+int result_add(const struct sock_rec *rec, void *arg)
+{
+    struct result_set *r = arg;                                 // Destination
+    const struct owner *o = inode_lookup(&inodes, rec->inode);  // Attribution
+    size_t i = r->n;
+
+    result_reserve(r, r->n + 1);
+    r->proto[i] = rec->proto;
+    r->state[i] = rec->state;
+    r->lport[i] = rec->lport;
+    r->rport[i] = rec->rport;
+    r->laddr[i] = result_addr(r, rec->family, rec->laddr);
+    r->raddr[i] = result_addr(r, rec->family, rec->raddr);
+    r->pid[i] = o ? o->pid : 0;
+    r->uid[i] = rec->uid;
+    r->comm[i] = o ? o->comm : NO_STRING;
+    r->user[i] = o ? o->user : NO_STRING;
+    r->txq[i] = rec->txq;
+    r->rxq[i] = rec->rxq;
+    r->inode[i] = rec->inode;
+    r->n++;
+    return 0;
+}
+
+// Function to rebuild a sock_rec from a result row (for formatting helpers)
+void result_row(const struct result_set *r, size_t i, struct sock_rec *rec)
+{
+    const struct addr_ent *l = &r->addrs[r->laddr[i]];  // Local address
+    const struct addr_ent *rm = &r->addrs[r->raddr[i]]; // Remote address
+    memset(rec, 0, sizeof(*rec));
+    rec->proto = r->proto[i];
+    rec->family = l->family;
+    rec->state = r->state[i];
+    rec->lport = r->lport[i];
+    rec->rport = r->rport[i];
+    memcpy(rec->laddr, l->bytes, sizeof(rec->laddr));
+    memcpy(rec->raddr, rm->bytes, sizeof(rec->raddr));
+    rec->uid = r->uid[i];
+    rec->txq = r->txq[i];
+    rec->rxq = r->rxq[i];
+    rec->inode = r->inode[i];
+}
+
+// Function to AND sel[i] with (col[i] == v) over a byte column
+void filter_eq_u8(const uint8_t *col, size_t n, uint8_t v, uint8_t *sel)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    __m128i needle = _mm_set1_epi8((char)v); // 16 lanes per step
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(col + i)), needle);
+        __m128i s = _mm_loadu_si128((const __m128i *)(sel + i));
+        _mm_storeu_si128((__m128i *)(sel + i), _mm_and_si128(s, eq));
+    }
+#endif
+    for (; i < n; i++)
+        sel[i] &= col[i] == v ? 0xff : 0;
+}
+
+// Function to AND sel[i] with (col[i] == v) over a 32-bit column
+void filter_eq_u32(const uint32_t *col, size_t n, uint32_t v, uint8_t *sel)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    __m128i needle = _mm_set1_epi32((int)v); // 16 rows per step, packed down to bytes
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i a = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)(col + i)), needle);
+        __m128i b = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)(col + i + 4)), needle);
+        __m128i c = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)(col + i + 8)), needle);
+        __m128i d = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)(col + i + 12)), needle);
+        __m128i eq = _mm_packs_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+        __m128i s = _mm_loadu_si128((const __m128i *)(sel + i));
+        _mm_storeu_si128((__m128i *)(sel + i), _mm_and_si128(s, eq));
+    }
+#endif
+    for (; i < n; i++)
+        sel[i] &= col[i] == v ? 0xff : 0;
+}
+
+// Function to AND sel[i] with (col[i] in set) over a byte column, set given as a bitmask
+void filter_in_u8(const uint8_t *col, size_t n, unsigned int mask, uint8_t *sel)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    for (; i + 16 <= n; i += 16)
+    { // OR of one compare per member of the (small) set
+        __m128i v = _mm_loadu_si128((const __m128i *)(col + i));
+        __m128i any = _mm_setzero_si128();
+        for (unsigned int b = 0; b < 8; b++)
+            if (mask & (1u << b))
+                any = _mm_or_si128(any, _mm_cmpeq_epi8(v, _mm_set1_epi8((char)b)));
+        __m128i s = _mm_loadu_si128((const __m128i *)(sel + i));
+        _mm_storeu_si128((__m128i *)(sel + i), _mm_and_si128(s, any));
+    }
+#endif
+    for (; i < n; i++)
+        sel[i] &= col[i] < 8 && (mask & (1u << col[i])) ? 0xff : 0;
+}
+
+// Function to AND sel[i] with the port selection of a 16-bit port column (proto gives
+// the table of each row: only TCP/UDP ports are looked up, see sock_port_selected)
+void filter_port_set(const uint16_t *col, const uint8_t *proto, size_t n, const unsigned char *set,
+                     int others, uint8_t *sel)
+{
+    for (size_t i = 0; i < n; i++) // Table lookup per row: a gather, not worth SIMD
+        sel[i] &= sock_port_selected(proto[i], col[i], set, others) ? 0xff : 0;
+}
+
+// Function to compact a selection mask into a row index list; returns the row count
+size_t select_rows(const uint8_t *sel, size_t n, uint32_t *rows)
+{
+    size_t k = 0; // Rows selected
+    size_t i = 0;
+#ifdef __SSE2__
+    for (; i + 16 <= n; i += 16)
+    { // Skip 16 rejected rows at a time via the sign-bit mask
+        unsigned int m = (unsigned int)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(sel + i)));
+        while (m)
+        {
+            rows[k++] = (uint32_t)(i + __builtin_ctz(m));
+            m &= m - 1;
+        }
+    }
+#endif
+    for (; i < n; i++)
+        if (sel[i])
+            rows[k++] = (uint32_t)i;
+    return k;
+}
+
+// Function to compare two string pool offsets by content (qsort_r callback)
+int cmp_pool_str(const void *a, const void *b, void *pool)
+{
+    return strcmp((const char *)pool + *(const uint32_t *)a, (const char *)pool + *(const uint32_t *)b);
+}
+
+// Function to compute the rank of every interned string in strcmp order (indexed by pool offset)
+uint32_t *string_ranks(void)
+{
+    uint32_t *offs = xrealloc(NULL, (strings.count + 1) * sizeof(*offs)); // Distinct strings
+    uint32_t *rank = alloc_calloc(strings.len + 1, sizeof(*rank));
+    size_t k = 0;
+    if (!rank)
+        xrealloc(NULL, (size_t)-1); // Reports and exits
+    for (size_t i = 0; i < strings.nslots; i++)
+        if (strings.slots[i])
+            offs[k++] = strings.slots[i] - 1;
+    qsort_r(offs, k, sizeof(*offs), cmp_pool_str, strings.pool);
+    for (size_t i = 0; i < k; i++)
+        rank[offs[i]] = (uint32_t)i + 1; // 0 stays free for NO_STRING (sorts first)
+    alloc_free(offs);
+    return rank;
+}
+
+// Function to compare two address ids by (family, bytes) (qsort_r callback)
+int cmp_addr_id(const void *a, const void *b, void *addrs)
+{
+    const struct addr_ent *x = (const struct addr_ent *)addrs + *(const uint32_t *)a;
+    const struct addr_ent *y = (const struct addr_ent *)addrs + *(const uint32_t *)b;
+    return memcmp(x, y, sizeof(*x)); // Network byte order compares numerically
+}
+
+// Function to compute the rank of every address id in numeric order
+uint32_t *address_ranks(const struct result_set *r)
+{
+    uint32_t *ids = xrealloc(NULL, (r->naddrs + 1) * sizeof(*ids)); // Ids in sorted order
+    uint32_t *rank = xrealloc(NULL, (r->naddrs + 1) * sizeof(*rank));
+    for (size_t i = 0; i < r->naddrs; i++)
+        ids[i] = (uint32_t)i;
+    qsort_r(ids, r->naddrs, sizeof(*ids), cmp_addr_id, r->addrs);
+    for (size_t i = 0; i < r->naddrs; i++)
+        rank[ids[i]] = (uint32_t)i;
+    alloc_free(ids);
+    return rank;
+}
+
+// Function to LSD radix sort (key << 32 | row) pairs on their upper 32 bits (stable)
+void radix_sort_pairs(uint64_t *a, uint64_t *tmp, size_t n)
+{
+    size_t count[256]; // Histogram of the current byte
+    for (int shift = 32; shift < 64; shift += 8)
+    {
+        memset(count, 0, sizeof(count));
+        for (size_t i = 0; i < n; i++)
+            count[(a[i] >> shift) & 0xff]++;
+        if (count[(a[0] >> shift) & 0xff] == n)
+            continue; // Byte is constant across all rows: pass would be a no-op
+        size_t sum = 0;
+        for (int b = 0; b < 256; b++)
+        { // Exclusive prefix sum -> bucket starts
+            size_t c = count[b];
+            count[b] = sum;
+            sum += c;
+        }
+        for (size_t i = 0; i < n; i++)
+            tmp[count[(a[i] >> shift) & 0xff]++] = a[i];
+        memcpy(a, tmp, n * sizeof(*a));
+    }
+}
+
+// Function to give the value of a sort column for a row
+uint32_t sort_value(const struct result_set *r, int col, uint32_t row,
+                    const uint32_t *srank, const uint32_t *arank)
+{
+    switch (col)
+    {
+    case SORT_PROTO:
+        return r->proto[row];
+    case SORT_STATE:
+        return r->state[row];
+    case SORT_PORT:
+        return r->lport[row];
+    case SORT_RPORT:
+        return r->rport[row];
+    case SORT_LOCAL:
+        return arank[r->laddr[row]];
+    case SORT_REMOTE:
+        return arank[r->raddr[row]];
+    case SORT_PID:
+        return (uint32_t)r->pid[row];
+    case SORT_UID:
+        return r->uid[row];
+    case SORT_USER:
+        return r->user[row] == NO_STRING ? 0 : srank[r->user[row]];
+    case SORT_PROCESS:
+        return r->comm[row] == NO_STRING ? 0 : srank[r->comm[row]];
+    case SORT_RMEM:
+        return r->rmem[row] == MEM_NONE ? 0 : r->rmem[row];
+    case SORT_WMEM:
+        return r->wmem[row];
+    case SORT_QUEUED:
+        return r->queued[row];
+    case SORT_DROPS:
+        return r->drops[row];
+    default:
+        return (uint32_t)r->inode[row]; // Inodes fit 32 bits in practice
+    }
+}
+
+// Function to give the number of significant bits of a sort column
+int sort_bits(int col, const struct result_set *r)
+{
+    int bits = 0; // log2 of the id space, for interned columns
+    switch (col)
+    {
+    case SORT_PROTO:
+        return 4;
+    case SORT_STATE:
+        return 8;
+    case SORT_PORT:
+    case SORT_RPORT:
+        return 16;
+    case SORT_PID:
+        return 22; // PID_MAX_LIMIT is 2^22
+    case SORT_LOCAL:
+    case SORT_REMOTE:
+        while (bits < 32 && (1ULL << bits) < r->naddrs)
+            bits++;
+        return bits ? bits : 1;
+    case SORT_USER:
+    case SORT_PROCESS:
+        while (bits < 32 && (1ULL << bits) <= strings.count)
+            bits++;
+        return bits ? bits : 1;
+    default:
+        return 32;
+    }
+}
+
+// Function to sort the selected rows by a list of keys (first key most significant)
+// "local"/"remote" sort by address then port, as users expect.
+void sort_rows(const struct result_set *r, uint32_t *rows, size_t n, const struct sort_key *keys, int nkeys)
+{
+    struct sort_key expanded[2 * SORT_MAX_KEYS]; // Keys with local/remote split in two
+    int nexp = 0;
+    uint64_t *a, *tmp;                           // (key, row) pairs and scratch
+    uint32_t *srank = NULL, *arank = NULL;       // Ranks for interned columns
+
+    if (n < 2 || nkeys == 0)
+        return;
+    for (int k = 0; k < nkeys; k++)
+    {
+        expanded[nexp++] = keys[k];
+        if (keys[k].col == SORT_LOCAL || keys[k].col == SORT_REMOTE)
+            expanded[nexp++] = (struct sort_key){keys[k].col == SORT_LOCAL ? SORT_PORT : SORT_RPORT, keys[k].desc};
+        if (keys[k].col == SORT_USER || keys[k].col == SORT_PROCESS)
+            srank = srank ? srank : string_ranks();
+        if (keys[k].col == SORT_LOCAL || keys[k].col == SORT_REMOTE)
+            arank = arank ? arank : address_ranks(r);
+    }
+    a = xrealloc(NULL, n * sizeof(*a));
+    tmp = xrealloc(NULL, n * sizeof(*tmp));
+
+    // Walk keys from least to most significant, packing adjacent keys into 32-bit chunks
+    for (int hi = nexp - 1; hi >= 0;)
+    {
+        int lo = hi;    // Chunk covers expanded[lo..hi]
+        int bits = sort_bits(expanded[hi].col, r);
+        while (lo > 0 && bits + sort_bits(expanded[lo - 1].col, r) <= 32)
+            bits += sort_bits(expanded[--lo].col, r);
+        for (size_t i = 0; i < n; i++)
+        {
+            uint64_t key = 0; // Packed chunk, most significant key in the top bits
+            for (int k = lo; k <= hi; k++)
+            {
+                int b = sort_bits(expanded[k].col, r);
+                uint64_t v = sort_value(r, expanded[k].col, rows[i], srank, arank);
+                if (b < 32)
+                    v &= (1ULL << b) - 1;
+                if (expanded[k].desc)
+                    v = ((b < 32 ? (1ULL << b) : (1ULL << 32)) - 1) - v;
+                key = (key << b) | v;
+            }
+            a[i] = (key << 32) | rows[i];
+        }
+        radix_sort_pairs(a, tmp, n);
+        for (size_t i = 0; i < n; i++)
+            rows[i] = (uint32_t)a[i]; // Carry the new order into the next (more significant) chunk
+        hi = lo - 1;
+    }
+    alloc_free(a);
+    alloc_free(tmp);
+    alloc_free(srank);
+    alloc_free(arank);
+}
+
+// Function to parse --sort "key,-key,..." (leading '-' for descending)
+int parse_sort_keys(const char *spec, struct sort_key *keys)
+{
+    int n = 0; // Keys parsed
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%s", spec);
+    for (char *save, *tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save))
+    {
+        int desc = *tok == '-'; // Descending marker
+        int col = -1;
+        for (size_t i = 0; i < sizeof(sort_names) / sizeof(*sort_names); i++)
+            if (strcmp(tok + desc, sort_names[i]) == 0)
+                col = (int)i;
+        if (col < 0 || n == SORT_MAX_KEYS)
+            return -1;
+        keys[n].col = col;
+        keys[n].desc = desc;
+        n++;
+    }
+    return n;
+}
+
+// Function to apply the --state/--ports/--pid/--uid filters; returns selected row count
+size_t filter_rows(const struct result_set *r, const unsigned char *ports, int state, uint32_t *rows)
+{
+    uint8_t *sel = xrealloc(NULL, r->n + 1); // Selection mask, 0xff = keep
+    memset(sel, 0xff, r->n);
+    filter_in_u8(r->proto, r->n, (unsigned int)opts.protos, sel);
+    if (state >= 0)
+    { // States exist for TCP/UDP only: other tables keep a socket type there
+        filter_in_u8(r->proto, r->n, (1u << PROTO_TCP) | (1u << PROTO_TCP6) | (1u << PROTO_UDP) |
+                                         (1u << PROTO_UDP6), sel);
+        filter_eq_u8(r->state, r->n, (uint8_t)state, sel);
+    }
+    if (opts.pid >= 0)
+        filter_eq_u32((const uint32_t *)r->pid, r->n, (uint32_t)opts.pid, sel);
+    if (opts.uid >= 0)
+        filter_eq_u32(r->uid, r->n, (uint32_t)opts.uid, sel);
+    if (ports)
+        filter_port_set(r->lport, r->proto, r->n, ports, port_selection_others(), sel);
+    size_t n = select_rows(sel, r->n, rows);
+    alloc_free(sel);
+    return n;
+}
+
+// One slice of the selected rows, serialized by a worker into private memory
+struct ser_chunk
+{
+    const struct result_set *r;     // Table the rows index
+    const uint32_t *rows;           // This chunk's rows
+    size_t n;                       // Row count
+    size_t first;                   // Position of the chunk's first row in the output
+    int index;                      // Chunk number (thread label for --stats)
+    struct table t;                 // Chunk widths while measuring, merged widths when emitting
+    char *arena;                    // "local\0remote\0" per row (table output)
+    uint32_t *offs;                 // Offset of each row's endpoints in arena
+    size_t arena_len, arena_cap;
+    struct out_buf *out;            // Private buffer (fd -1: accumulates in memory)
+    int json;                       // Emit JSON objects instead of table rows
+};
+
+// Function to measure a chunk's column widths, formatting endpoints once into its arena
+void *measure_chunk(void *arg)
+{
+    struct ser_chunk *c = arg;      // Chunk to measure
+    const struct result_set *r = c->r;
+    char num[24];                   // PID text
+
+    stats_thread_name("output", c->index);
+    stats_begin(PHASE_OUTPUT);
+    c->offs = xrealloc(NULL, (c->n + 1) * sizeof(*c->offs));
+    for (size_t k = 0; k < c->n; k++)
+    {
+        struct sock_rec rec; // Row in record form for the formatters
+        uint32_t i = c->rows[k];
+        result_row(r, i, &rec);
+        if (c->arena_cap - c->arena_len < 160)
+        {
+            c->arena_cap = c->arena_cap ? c->arena_cap * 2 : 65536;
+            c->arena = xrealloc(c->arena, c->arena_cap);
+        }
+        char *a = c->arena + c->arena_len;
+        c->offs[k] = (uint32_t)c->arena_len;
+        format_sock_endpoint(a, 80, &rec, 0);
+        size_t l = strlen(a);
+        table_measure(&c->t, 1, l);
+        c->arena_len += l + 1;
+        format_sock_endpoint(a + l + 1, 80, &rec, 1);
+        l = strlen(a + l + 1);
+        table_measure(&c->t, 2, l);
+        c->arena_len += l + 1;
+        table_measure(&c->t, 0, strlen(sock_tables[rec.proto].name));
+        table_measure(&c->t, 3, strlen(state_name(&rec)));
+        if (r->pid[i])
+        {
+            table_measure(&c->t, 4, format_uint(num, (unsigned)r->pid[i]));
+            table_measure(&c->t, 5, strlen(strings.pool + r->comm[i]));
+            table_measure(&c->t, 6, strlen(strings.pool + r->user[i]));
+        }
+        if (r->rmem && r->rmem[i] != MEM_NONE)
+        {
+            table_measure(&c->t, 7, format_uint(num, r->rmem[i]));
+            table_measure(&c->t, 8, format_uint(num, r->wmem[i]));
+            table_measure(&c->t, 9, format_uint(num, r->queued[i]));
+            table_measure(&c->t, 10, format_uint(num, r->drops[i]));
+        }
+        if (r->exe && r->exe[i] != NO_STRING)
+        {
+            int col = r->rmem ? 11 : 7; // After the memory columns, if any
+            table_measure(&c->t, col, strlen(strings.pool + r->exe[i]));
+            table_measure(&c->t, col + 1, strlen(strings.pool + r->build[i]));
+        }
+    }
+    stats_end();
+    stats_thread_done();
+    return NULL;
+}
+
+// Function to serialize one row as a JSON object
+void emit_json_row(struct out_buf *o, const struct result_set *r, uint32_t i, int first)
+{
+    struct sock_rec rec;        // Row in record form for the formatters
+    char local[80], remote[80]; // Formatted endpoints
+    result_row(r, i, &rec);
+    format_sock_endpoint(local, sizeof(local), &rec, 0);
+    format_sock_endpoint(remote, sizeof(remote), &rec, 1);
+    out_write(o, first ? "  {\"proto\":\"" : ",\n  {\"proto\":\"", first ? 12 : 14);
+    out_printf(o, "%s\",\"local\":", sock_tables[rec.proto].name);
+    out_json_string(o, local);
+    out_write(o, ",\"remote\":", 10);
+    out_json_string(o, remote);
+    out_printf(o, ",\"state\":\"%s\",\"uid\":%u,\"inode\":%llu,\"txq\":%u,\"rxq\":%u", state_name(&rec),
+               r->uid[i], (unsigned long long)r->inode[i], r->txq[i], r->rxq[i]);
+    if (r->pid[i])
+    {
+        out_printf(o, ",\"pid\":%d,\"process\":", r->pid[i]);
+        out_json_string(o, strings.pool + r->comm[i]);
+        out_write(o, ",\"user\":", 8);
+        out_json_string(o, strings.pool + r->user[i]);
+    }
+    if (r->rmem && r->rmem[i] != MEM_NONE)
+        out_printf(o, ",\"rmem\":%u,\"wmem\":%u,\"queued\":%u,\"drops\":%u", r->rmem[i], r->wmem[i],
+                   r->queued[i], r->drops[i]);
+    if (r->exe && r->exe[i] != NO_STRING)
+    {
+        out_write(o, ",\"exe\":", 7);
+        out_json_string(o, strings.pool + r->exe[i]);
+        out_write(o, ",\"build\":", 9);
+        out_json_string(o, strings.pool + r->build[i]);
+    }
+    out_write(o, "}", 1);
+}
+
+// Function to serialize a chunk's rows (table rows use the merged widths)
+void *emit_chunk(void *arg)
+{
+    struct ser_chunk *c = arg;      // Chunk to serialize
+    const struct result_set *r = c->r;
+    struct out_buf *out = c->out;
+    char num[24];                   // PID text
+
+    stats_thread_name("output", c->index);
+    stats_begin(PHASE_OUTPUT);
+    for (size_t k = 0; k < c->n; k++)
+    {
+        uint32_t i = c->rows[k];
+        if (c->json)
+        {
+            emit_json_row(out, r, i, c->first + k == 0);
+            continue;
+        }
+        struct sock_rec rec; // Row in record form for state_name()
+        const char *local = c->arena + c->offs[k];
+        const char *remote = local + strlen(local) + 1;
+        const char *s;
+        result_row(r, i, &rec);
+        table_cell(out, &c->t, 0, sock_tables[rec.proto].name, strlen(sock_tables[rec.proto].name));
+        table_cell(out, &c->t, 1, local, remote - local - 1);
+        table_cell(out, &c->t, 2, remote, strlen(remote));
+        s = state_name(&rec);
+        table_cell(out, &c->t, 3, s, strlen(s));
+        if (r->pid[i])
+        {
+            table_cell(out, &c->t, 4, num, format_uint(num, (unsigned)r->pid[i]));
+            s = strings.pool + r->comm[i];
+            table_cell(out, &c->t, 5, s, strlen(s));
+            s = strings.pool + r->user[i];
+            table_cell(out, &c->t, 6, s, strlen(s));
+        }
+        else
+        {
+            table_cell(out, &c->t, 4, "-", 1);
+            table_cell(out, &c->t, 5, "-", 1);
+            table_cell(out, &c->t, 6, "-", 1);
+        }
+        if (r->rmem && r->rmem[i] != MEM_NONE)
+        {
+            table_cell(out, &c->t, 7, num, format_uint(num, r->rmem[i]));
+            table_cell(out, &c->t, 8, num, format_uint(num, r->wmem[i]));
+            table_cell(out, &c->t, 9, num, format_uint(num, r->queued[i]));
+            table_cell(out, &c->t, 10, num, format_uint(num, r->drops[i]));
+        }
+        else if (r->rmem)
+            for (int col = 7; col <= 10; col++)
+                table_cell(out, &c->t, col, "-", 1);
+        if (r->exe)
+        {
+            int col = r->rmem ? 11 : 7; // After the memory columns, if any
+            s = r->exe[i] != NO_STRING ? strings.pool + r->exe[i] : "-";
+            table_cell(out, &c->t, col, s, strlen(s));
+            s = r->build[i] != NO_STRING ? strings.pool + r->build[i] : "-";
+            table_cell(out, &c->t, col + 1, s, strlen(s));
+        }
+    }
+    out_flush(out); // Moves the tail into the chunk's memory
+    stats_end();
+    stats_thread_done();
+    return NULL;
+}
+
+// Function to run fn over every chunk, one thread per chunk beyond the first
+void run_chunks(struct ser_chunk *chunks, int n, void *(*fn)(void *))
+{
+    pthread_t tids[SER_MAX_THREADS]; // Helper threads
+    int started = 0;
+    for (int i = 1; i < n; i++)
+    {
+        if (pthread_create(&tids[started], NULL, fn, &chunks[i]) != 0)
+        {
+            fn(&chunks[i]); // No thread: do it here
+            continue;
+        }
+        started++;
+    }
+    fn(&chunks[0]);
+    for (int i = 0; i < started; i++)
+        pthread_join(tids[i], NULL);
+}
+
+// Function to write a list of buffers completely, IOV_MAX at a time
+int writev_all(int fd, struct iovec *iov, int n)
+{
+    while (n > 0)
+    {
+        ssize_t w = writev(fd, iov, n < IOV_MAX ? n : IOV_MAX);
+        if (w < 0 && errno == EINTR)
+            continue;
+        if (w < 0)
+            return -1;
+        while (n > 0 && (size_t)w >= iov->iov_len)
+        { // Drop fully written buffers
+            w -= iov->iov_len;
+            iov++;
+            n--;
+        }
+        if (n > 0)
+        { // Partial buffer: resume inside it
+            iov->iov_base = (char *)iov->iov_base + w;
+            iov->iov_len -= w;
+        }
+    }
+    return 0;
+}
+
+// Function to print selected rows as a measured table or as JSON.
+// Rows are cut into one chunk per CPU; workers measure their chunk (table),
+// the widths are merged, workers serialize their chunk into private memory,
+// and the pieces are written in order with a single writev(). Returns -1 when the
+// write failed (e.g. a closed pipe or a full disk), 0 otherwise.
+int print_result_table(int fd, const struct result_set *r, const uint32_t *rows, size_t n, int json)
+{
+    static const char *const base[] = {"PROTO", "LOCAL", "REMOTE", "STATE", "PID", "PROCESS", "USER",
+                                       "RMEM", "WMEM", "QUEUED", "DROPS", "EXE", "BUILD"};
+    const char *headers[TABLE_MAX_COLS]; // Columns in use
+    struct ser_chunk chunks[SER_MAX_THREADS];  // Row slices
+    struct iovec iov[SER_MAX_THREADS + 2];     // Header, chunks, trailer
+    struct out_buf *head = xrealloc(NULL, sizeof(*head)); // Header (table) or "[" (JSON)
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int nchunks = (int)(n / SER_MIN_ROWS) + 1; // Small outputs stay on one thread
+    int niov = 0;
+    int ncols = 0;
+    int rc;
+
+    stats_begin(PHASE_OUTPUT);
+    for (int col = 0; col < 13; col++)
+        if (col < 7 || (col < 11 && r->rmem) || (col >= 11 && r->exe))
+            headers[ncols++] = base[col]; // Memory columns with --mem, identity with --exe
+
+    if (nchunks > cpus)
+        nchunks = cpus > 0 ? (int)cpus : 1;
+    if (nchunks > SER_MAX_THREADS)
+        nchunks = SER_MAX_THREADS;
+    memset(chunks, 0, sizeof(chunks));
+    for (int c = 0; c < nchunks; c++)
+    {
+        chunks[c].r = r;
+        chunks[c].index = c;
+        chunks[c].first = n * c / nchunks;
+        chunks[c].rows = rows + chunks[c].first;
+        chunks[c].n = n * (c + 1) / nchunks - chunks[c].first;
+        chunks[c].json = json;
+        chunks[c].out = xrealloc(NULL, sizeof(*chunks[c].out));
+        out_init(chunks[c].out, -1);
+        table_init(&chunks[c].t, headers, ncols);
+    }
+    out_init(head, -1);
+
+    if (!json)
+    { // Merge the chunk widths, then hand every chunk the result
+        run_chunks(chunks, nchunks, measure_chunk);
+        for (int c = 1; c < nchunks; c++)
+            for (int col = 0; col < ncols; col++)
+                table_measure(&chunks[0].t, col, chunks[c].t.width[col]);
+        for (int c = 1; c < nchunks; c++)
+            chunks[c].t = chunks[0].t;
+        table_header(head, &chunks[0].t);
+    }
+    else
+        out_write(head, "[\n", 2);
+    out_flush(head);
+    run_chunks(chunks, nchunks, emit_chunk);
+
+    iov[niov++] = (struct iovec){head->spill, head->spill_len};
+    for (int c = 0; c < nchunks; c++)
+        iov[niov++] = (struct iovec){chunks[c].out->spill, chunks[c].out->spill_len};
+    if (json)
+        iov[niov++] = (struct iovec){n ? "\n]\n" : "]\n", n ? 3 : 2};
+    if ((rc = writev_all(fd, iov, niov)) < 0)
+        perror("write");
+
+    for (int c = 0; c < nchunks; c++)
+    {
+        alloc_free(chunks[c].out->spill);
+        alloc_free(chunks[c].out);
+        alloc_free(chunks[c].arena);
+        alloc_free(chunks[c].offs);
+    }
+    alloc_free(head->spill);
+    alloc_free(head);
+    stats_end();
+    return rc;
+}
+
+// Function to load every selected socket table into a result set
+void load_result_set(struct result_set *r)
+{
+    build_inode_index();
+    for (int proto = 0; proto < NUM_PROTOS; proto++)
+        if (opts.protos & (1 << proto))
+            for_each_socket(proto, result_add, r);
+}
+
+// Cached identity of one executable, keyed by (dev, ino, mtime)
+struct exe_ident
+{
+    uint64_t dev, ino;       // The binary's device and inode (ino 0: free slot)
+    int64_t sec, nsec;       // Its modification time
+    uint32_t path;           // Resolved path (string cache offset)
+    uint32_t build;          // "gnu:<hex>", "go:<id>" or "sha256:<hex>" (string cache offset)
+};
+
+// SHA-256 state for --exe sha256 (FIPS 180-4)
+struct sha256
+{
+    uint32_t h[8];            // Chaining value
+    unsigned char block[64];  // Partial block
+    size_t fill;              // Bytes in block
+    uint64_t bytes;           // Message length so far
+};
+
+// Function to start a SHA-256 computation
+void sha256_init(struct sha256 *c)
+{
+    static const uint32_t iv[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                   0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    memcpy(c->h, iv, sizeof(iv));
+    c->fill = 0;
+    c->bytes = 0;
+}
+
+// Function to compress one 64-byte block into the chaining value
+void sha256_block(struct sha256 *c, const unsigned char *p)
+{
+    static const uint32_t k[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+    uint32_t w[64], v[8]; // Message schedule, working variables a..h
+#define ROR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+    for (int i = 0; i < 16; i++)
+        w[i] = (uint32_t)p[4 * i] << 24 | (uint32_t)p[4 * i + 1] << 16 | (uint32_t)p[4 * i + 2] << 8 | p[4 * i + 3];
+    for (int i = 16; i < 64; i++)
+        w[i] = w[i - 16] + (ROR32(w[i - 15], 7) ^ ROR32(w[i - 15], 18) ^ (w[i - 15] >> 3)) + w[i - 7] +
+               (ROR32(w[i - 2], 17) ^ ROR32(w[i - 2], 19) ^ (w[i - 2] >> 10));
+    memcpy(v, c->h, sizeof(v));
+    for (int i = 0; i < 64; i++)
+    {
+        uint32_t t1 = v[7] + (ROR32(v[4], 6) ^ ROR32(v[4], 11) ^ ROR32(v[4], 25)) +
+                      ((v[4] & v[5]) ^ (~v[4] & v[6])) + k[i] + w[i];
+        uint32_t t2 = (ROR32(v[0], 2) ^ ROR32(v[0], 13) ^ ROR32(v[0], 22)) +
+                      ((v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]));
+        memmove(v + 1, v, 7 * sizeof(*v));
+        v[4] += t1;
+        v[0] = t1 + t2;
+    }
+#undef ROR32
+    for (int i = 0; i < 8; i++)
+        c->h[i] += v[i];
+}
+
+// Function to feed bytes into a SHA-256 computation
+void sha256_update(struct sha256 *c, const unsigned char *p, size_t n)
+{
+    c->bytes += n;
+    if (c->fill)
+    { // Complete the partial block first
+        size_t take = 64 - c->fill < n ? 64 - c->fill : n;
+        memcpy(c->block + c->fill, p, take);
+        c->fill += take;
+        p += take;
+        n -= take;
+        if (c->fill < 64)
+            return;
+        sha256_block(c, c->block);
+        c->fill = 0;
+    }
+    for (; n >= 64; p += 64, n -= 64)
+        sha256_block(c, p);
+    memcpy(c->block, p, n);
+    c->fill = n;
+}
+
+// Function to finish a SHA-256 computation into 64 hex digits
+void sha256_hex(struct sha256 *c, char *hex)
+{
+    uint64_t bits = c->bytes * 8; // Length trailer
+    unsigned char pad[72] = {0x80};
+    size_t npad = (c->fill < 56 ? 56 : 120) - c->fill;
+    for (int i = 0; i < 8; i++)
+        pad[npad + i] = (unsigned char)(bits >> (56 - 8 * i));
+    sha256_update(c, pad, npad + 8);
+    for (int i = 0; i < 8; i++)
+        snprintf(hex + 8 * i, 9, "%08x", c->h[i]);
+}
+
+// Function to hash a whole file as "sha256:<hex>"; returns 0 or -1
+int exe_file_sha256(int fd, char *out, size_t size)
+{
+    static unsigned char buf[1 << 16]; // Read buffer (only the main thread hashes)
+    struct sha256 c;
+    char hex[65];
+    ssize_t n;
+
+    sha256_init(&c);
+    while ((n = pread(fd, buf, sizeof(buf), (off_t)c.bytes)) > 0)
+        sha256_update(&c, buf, (size_t)n);
+    if (n < 0)
+        return -1;
+    sha256_hex(&c, hex);
+    snprintf(out, size, "sha256:%s", hex);
+    return 0;
+}
+
+// Function to read the build ID from the PT_NOTE segments of a native ELF file:
+// "gnu:<hex>" (NT_GNU_BUILD_ID) or "go:<id>" (Go toolchain note); returns 0 or -1
+int exe_build_id(int fd, char *out, size_t size)
+{
+    unsigned char ehdr[sizeof(Elf64_Ehdr)]; // ELF header (64-bit size covers both classes)
+    unsigned char notes[4096];              // Head of one note segment
+    int is64;
+
+    if (pread(fd, ehdr, sizeof(ehdr), 0) < (ssize_t)sizeof(Elf32_Ehdr) ||
+        memcmp(ehdr, ELFMAG, SELFMAG) != 0)
+        return -1;
+    is64 = ehdr[EI_CLASS] == ELFCLASS64;
+    const Elf64_Ehdr *e64 = (const Elf64_Ehdr *)ehdr;
+    const Elf32_Ehdr *e32 = (const Elf32_Ehdr *)ehdr;
+    uint64_t phoff = is64 ? e64->e_phoff : e32->e_phoff;
+    unsigned phnum = is64 ? e64->e_phnum : e32->e_phnum;
+    unsigned phentsize = is64 ? e64->e_phentsize : e32->e_phentsize;
+    if (phentsize < (is64 ? sizeof(Elf64_Phdr) : sizeof(Elf32_Phdr)))
+        return -1;
+
+    for (unsigned i = 0; i < phnum && i < 128; i++)
+    {
+        Elf64_Phdr ph;     // Program header (widened)
+        if (is64 && pread(fd, &ph, sizeof(ph), (off_t)(phoff + (uint64_t)i * phentsize)) != sizeof(ph))
+            return -1;
+        if (!is64)
+        {
+            Elf32_Phdr p32;
+            if (pread(fd, &p32, sizeof(p32), (off_t)(phoff + (uint64_t)i * phentsize)) != sizeof(p32))
+                return -1;
+            ph.p_type = p32.p_type;
+            ph.p_offset = p32.p_offset;
+            ph.p_filesz = p32.p_filesz;
+        }
+        if (ph.p_type != PT_NOTE)
+            continue;
+        ssize_t len = pread(fd, notes, ph.p_filesz < sizeof(notes) ? ph.p_filesz : sizeof(notes),
+                            (off_t)ph.p_offset);
+        for (size_t off = 0; len > 0 && off + sizeof(Elf64_Nhdr) <= (size_t)len;)
+        { // Elf32_Nhdr and Elf64_Nhdr share one layout
+            Elf64_Nhdr nh;
+            memcpy(&nh, notes + off, sizeof(nh));
+            size_t name = off + sizeof(nh);                        // Name, 4-byte aligned
+            size_t desc = name + ((nh.n_namesz + 3) & ~3u);        // Descriptor
+            off = desc + ((nh.n_descsz + 3) & ~3u);
+            if (off > (size_t)len || nh.n_descsz == 0 || nh.n_descsz > 128)
+                continue;
+            if (nh.n_type == NT_GNU_BUILD_ID && nh.n_namesz == 4 && memcmp(notes + name, "GNU", 4) == 0)
+            {
+                size_t o = (size_t)snprintf(out, size, "gnu:");
+                for (unsigned k = 0; k < nh.n_descsz && o + 3 <= size; k++)
+                    o += (size_t)snprintf(out + o, size - o, "%02x", notes[desc + k]);
+                return 0;
+            }
+            if (nh.n_type == 4 && nh.n_namesz == 4 && memcmp(notes + name, "Go\0\0", 4) == 0)
+            {
+                snprintf(out, size, "go:%.*s", (int)nh.n_descsz, (const char *)notes + desc);
+                return 0;
+            }
+        }
+    }
+    return -1;
+}
+
+// Function to resolve a process's executable to its path and build identity (string
+// cache offsets). Identities are cached by the binary's (device, inode, mtime), so the
+// workers of one service cost one stat() each and the binary is parsed or hashed once.
+// Returns 0, or -1 when the executable cannot be reached (kernel thread, no access).
+int exe_identity(int pid, unsigned int *path, unsigned int *build)
+{
+    static struct exe_ident *cache;  // Open-addressed identity cache
+    static size_t cap, count;
+    char link[48], target[PATH_MAX]; // /proc/<pid>/exe and where it points
+    struct stat st;                  // The binary itself (stat follows the link)
+
+    snprintf(link, sizeof(link), "/proc/%d/exe", pid);
+    if (stat(link, &st) < 0)
+        return -1;
+    struct exe_ident key = {(uint64_t)st.st_dev, (uint64_t)st.st_ino, (int64_t)st.st_mtim.tv_sec,
+                            (int64_t)st.st_mtim.tv_nsec, 0, 0};
+    if (count * 2 >= cap)
+    { // Grow to keep the load at or below 1/2
+        size_t ncap = cap ? cap * 2 : 256;
+        struct exe_ident *n = alloc_calloc(ncap, sizeof(*n));
+        if (!n)
+            xrealloc(NULL, (size_t)-1); // Reports and exits
+        for (size_t i = 0; i < cap; i++)
+            if (cache[i].ino)
+            {
+                size_t j = hash_bytes(&cache[i], offsetof(struct exe_ident, path)) & (ncap - 1);
+                while (n[j].ino)
+                    j = (j + 1) & (ncap - 1);
+                n[j] = cache[i];
+            }
+        alloc_free(cache);
+        cache = n;
+        cap = ncap;
+    }
+    size_t i = hash_bytes(&key, offsetof(struct exe_ident, path)) & (cap - 1);
+    for (; cache[i].ino; i = (i + 1) & (cap - 1))
+        if (memcmp(&cache[i], &key, offsetof(struct exe_ident, path)) == 0)
+        {
+            *path = cache[i].path;
+            *build = cache[i].build;
+            return 0;
+        }
+
+    // First process running this binary: resolve the path and identify the contents
+    char id[160] = "-"; // Build identity text
+    ssize_t n = readlink(link, target, sizeof(target) - 1);
+    target[n > 0 ? n : 0] = '\0';
+    int fd = open(link, O_RDONLY | O_CLOEXEC); // Works even if the path was replaced
+    if (fd >= 0)
+    {
+        if (opts.exe == EXE_SHA256 || exe_build_id(fd, id, sizeof(id)) < 0)
+            if (exe_file_sha256(fd, id, sizeof(id)) < 0)
+                strcpy(id, "-");
+        close(fd);
+    }
+    key.path = str_intern(&strings, target[0] ? target : "-");
+    key.build = str_intern(&strings, id);
+    cache[i] = key;
+    count++;
+    *path = key.path;
+    *build = key.build;
+    return 0;
+}
+
+// Function to fill the --exe columns for the selected rows, resolving each owning
+// process once
+void result_exe(struct result_set *r, const uint32_t *rows, size_t n)
+{
+    uint32_t *memo = xrealloc(NULL, (2 * nowners + 2) * sizeof(*memo)); // Path, build per owner
+    unsigned char *done = alloc_calloc(nowners + 1, 1);                        // Owner resolved
+
+    if (!done)
+        xrealloc(NULL, (size_t)-1); // Reports and exits
+    r->exe = xrealloc(NULL, (r->n + 1) * sizeof(*r->exe));
+    r->build = xrealloc(NULL, (r->n + 1) * sizeof(*r->build));
+    for (size_t k = 0; k < n; k++)
+    {
+        uint32_t i = rows[k];
+        long o = r->pid[i] ? inode_find(&inodes, r->inode[i]) : -1; // Owner of the row
+        r->exe[i] = r->build[i] = NO_STRING;
+        if (o < 0)
+            continue;
+        if (!done[o] && exe_identity(owners[o].pid, &memo[2 * o], &memo[2 * o + 1]) < 0)
+            memo[2 * o] = memo[2 * o + 1] = NO_STRING;
+        done[o] = 1;
+        r->exe[i] = memo[2 * o];
+        r->build[i] = memo[2 * o + 1];
+    }
+    alloc_free(memo);
+    alloc_free(done);
+}
+
+// Function to fill the --mem columns of a result set from one inet_diag dump,
+// matching sockets by inode (by endpoints when they have none); returns 0, or -1
+// when the dump fails
+int result_meminfo(struct result_set *r)
+{
+    struct mem_dump md = {0};      // TCP/UDP sockets with their counters
+    struct inode_part part = {0};  // inode -> index into md
+    struct inode_index ix = {0};
+    int nl = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_SOCK_DIAG);
+
+    if (nl < 0 || mem_load(nl, &md) < 0)
+    {
+        if (nl >= 0)
+            close(nl);
+        alloc_free(md.recs);
+        return -1;
+    }
+    close(nl);
+    for (size_t i = 0; i < md.n; i++)
+    {
+        const struct sk_mem *s = &md.recs[i];
+        inode_part_add(&part, s->inode ? s->inode : mem_tuple_key(s->proto, s->laddr, s->lport, s->raddr, s->rport),
+                       (unsigned int)i);
+    }
+    inode_index_build(&ix, &part, 1);
+    r->rmem = xrealloc(NULL, (r->n + 1) * sizeof(*r->rmem));
+    r->wmem = xrealloc(NULL, (r->n + 1) * sizeof(*r->wmem));
+    r->queued = xrealloc(NULL, (r->n + 1) * sizeof(*r->queued));
+    r->drops = xrealloc(NULL, (r->n + 1) * sizeof(*r->drops));
+    for (size_t i = 0; i < r->n; i++)
+    {
+        unsigned long long key = r->inode[i]; // Lookup key
+        if (!key && r->proto[i] <= PROTO_UDP6)
+        {
+            struct sock_rec rec; // Endpoints of an inode-less socket
+            result_row(r, i, &rec);
+            key = mem_tuple_key(rec.proto, rec.laddr, rec.lport, rec.raddr, rec.rport);
+        }
+        long k = r->proto[i] <= PROTO_UDP6 ? inode_find(&ix, key) : -1;
+        const struct sk_mem *s = k >= 0 ? &md.recs[k] : NULL;
+        r->rmem[i] = s ? s->rmem : MEM_NONE;
+        r->wmem[i] = s ? s->wmem : 0;
+        r->queued[i] = s ? s->queued : 0;
+        r->drops[i] = s ? s->drops : 0;
+    }
+    inode_index_free(&ix);
+    alloc_free(part.inodes);
+    alloc_free(part.owners);
+    alloc_free(md.recs);
+    return 0;
+}
+
+// Function implementing --list: load, filter, sort and print the socket tables
+int run_list(const unsigned char *ports)
+{
+    struct result_set r = {0};          // All sockets
+    struct sort_key keys[SORT_MAX_KEYS]; // --sort keys
+    int nkeys = 0, state = -1;
+
+    if (opts.sort && (nkeys = parse_sort_keys(opts.sort, keys)) < 0)
+    {
+        fprintf(stderr, "Bad --sort keys: %s (use %s", opts.sort, sort_names[0]);
+        for (size_t i = 1; i < sizeof(sort_names) / sizeof(*sort_names); i++)
+            fprintf(stderr, ",%s", sort_names[i]);
+        fprintf(stderr, ", '-' prefix for descending)\n");
+        return 1;
+    }
+    if (opts.state && (state = parse_state(opts.state)) < 0)
+    {
+        fprintf(stderr, "Unknown state: %s\n", opts.state);
+        return 1;
+    }
+
+    for (int k = 0; k < nkeys; k++)
+        if (keys[k].col >= SORT_RMEM && !opts.mem)
+        {
+            fprintf(stderr, "--sort %s needs --mem\n", sort_names[keys[k].col]);
+            return 1;
+        }
+
+    load_result_set(&r);
+    if (opts.mem && result_meminfo(&r) < 0)
+    {
+        fprintf(stderr, "inet_diag dump failed\n");
+        return 1;
+    }
+    uint32_t *rows = xrealloc(NULL, (r.n + 1) * sizeof(*rows)); // Selected rows, in output order
+    size_t n = filter_rows(&r, ports, state, rows);
+    sort_rows(&r, rows, n, keys, nkeys);
+    if (opts.exe)
+    {
+        stats_begin(PHASE_ATTRIB);
+        result_exe(&r, rows, n); // Only the processes that are printed
+        stats_end();
+    }
+
+    int rc = print_result_table(STDOUT_FILENO, &r, rows, n, opts.json) < 0;
+    alloc_free(rows);
+    return rc;
+}
+
+// ---------------------------------------------------------------------------
+// Fleet collection (--agent / --collect / --query)
+//
+// Agents send their listener set to a collector as binary frames: a
+// snapshot (BEGIN, UPSERT..., END) on connect, then UPSERT/DELETE deltas
+// every --interval. The collector merges all hosts into one index keyed by
+// (host, proto, port) and answers QUERY frames from any client. Endpoints
+// are "unix:/path" or "ADDR:PORT", so a whole fleet can be simulated on one
+// machine with several agents using different --name values.
+//
+// Frame: 8-byte header (magic, type, flags, big-endian payload length)
+// followed by the payload. Multi-byte wire fields are big-endian.
+// ---------------------------------------------------------------------------
+
+// Frame header
+struct frame_hdr
+{
+    uint16_t magic; // FRAME_MAGIC, big-endian
+    uint8_t type;   // FRAME_* value
+    uint8_t flags;  // Reserved, zero
+    uint32_t len;   // Payload bytes, big-endian
+};
+
+// One listener on the wire (also the record of UPSERT/DELETE/RESULT frames)
+struct wire_rec
+{
+    uint8_t proto;     // PROTO_* value
+    uint8_t state;     // Kernel state number
+    uint16_t port;     // Local port, big-endian
+    uint32_t pid;      // Owning PID, big-endian, 0 when unknown
+    uint8_t addr[16];  // Bound local address (IPv4 in the first 4 bytes)
+    char comm[16];     // Process name, NUL-padded
+    char user[16];     // User name, NUL-padded
+};
+
+// One entry of the collector index
+struct fleet_entry
+{
+    uint64_t key;      // fleet_key(host, rec); 0 empty, FLEET_TOMB deleted
+    uint32_t gen;      // Snapshot generation that last wrote this entry
+    struct wire_rec rec; // Last reported listener
+};
+
+// One agent host known to the collector
+struct fleet_host
+{
+    unsigned int name; // Host name, offset into the string cache
+    uint32_t gen;      // Current snapshot generation
+    long entries;      // Live entries in the index
+    int conns;         // Agent connections announcing this host
+};
+
+// One collector connection (agent or query client)
+struct fleet_conn
+{
+    int fd;           // Non-blocking socket
+    int host;         // Index into fleet_hosts[], -1 until HELLO
+    size_t len;       // Bytes buffered in in
+    size_t cap;       // Bytes allocated for in
+    char *in;         // Partial frames
+    size_t out_len;   // Bytes pending in out
+    size_t out_off;   // Bytes of out already sent
+    size_t out_cap;   // Bytes allocated for out
+    char *out;        // Query replies not yet written
+    int closing;      // Peer half-closed: close once out is sent
+};
+
+// Collector state
+struct fleet_entry *fleet;     // Open-addressed (host, proto, port) index
+size_t fleet_cap, fleet_used;  // Slots allocated / occupied (live + tombstones)
+struct fleet_host *fleet_hosts; // Known hosts
+size_t fleet_nhosts, fleet_hosts_cap;
+unsigned long long fleet_updates; // Records applied since start
+
+// Function to build the collector key of a record (host id is 1-based so keys are never 0);
+// raw and packet sockets sharing a (proto, port) are told apart by 24 bits of a hash of
+// their type, address and PID (fully identical records stay one entry); NULL gives the
+// lowest key of the host
+uint64_t fleet_key(int host, const struct wire_rec *rec)
+{
+    uint64_t key = (uint64_t)(host + 1) << 48;
+    if (!rec)
+        return key;
+    key |= ((uint64_t)rec->proto << 16) | ntohs(rec->port);
+    if (rec->proto > PROTO_UDP6)
+        key |= (uint64_t)(hash_bytes_from(hash64(((uint64_t)rec->state << 32) | rec->pid), rec->addr,
+                                          sizeof(rec->addr)) & 0xffffff) << 24;
+    return key;
+}
+
+// Function to find a key's slot; returns the matching slot or the first reusable one
+size_t fleet_slot(uint64_t key, int *found)
+{
+    size_t tomb = (size_t)-1;                   // First tombstone seen
+    size_t i = hash64(key) & (fleet_cap - 1);   // Home slot
+    for (;;)
+    {
+        if (fleet[i].key == key)
+        {
+            *found = 1;
+            return i;
+        }
+        if (fleet[i].key == 0)
+        {
+            *found = 0;
+            return tomb != (size_t)-1 ? tomb : i;
+        }
+        if (fleet[i].key == FLEET_TOMB && tomb == (size_t)-1)
+            tomb = i;
+        i = (i + 1) & (fleet_cap - 1);
+    }
+}
+
+// Function to grow (or purge tombstones from) the collector index
+void fleet_rehash(size_t cap)
+{
+    struct fleet_entry *old = fleet; // Previous table
+    size_t old_cap = fleet_cap;
+    int found;
+
+    fleet = alloc_calloc(cap, sizeof(*fleet));
+    if (!fleet)
+        xrealloc(NULL, (size_t)-1); // Reports and exits
+    fleet_cap = cap;
+    fleet_used = 0;
+    for (size_t i = 0; i < old_cap; i++)
+    {
+        if (old[i].key == 0 || old[i].key == FLEET_TOMB)
+            continue;
+        fleet[fleet_slot(old[i].key, &found)] = old[i];
+        fleet_used++;
+    }
+    alloc_free(old);
+}
+
+// Function to insert or replace a host's listener
+void fleet_upsert(int host, const struct wire_rec *rec)
+{
+    int found;
+    if ((fleet_used + 1) * 4 >= fleet_cap * 3)
+        fleet_rehash(fleet_cap ? fleet_cap * 2 : 4096); // Also drops tombstones
+    size_t i = fleet_slot(fleet_key(host, rec), &found);
+    if (!found)
+    {
+        if (fleet[i].key == 0)
+            fleet_used++; // Tombstone reuse does not change occupancy
+        fleet_hosts[host].entries++;
+    }
+    fleet[i].key = fleet_key(host, rec);
+    fleet[i].gen = fleet_hosts[host].gen;
+    fleet[i].rec = *rec;
+    fleet_updates++;
+}
+
+// Function to delete a host's listener
+void fleet_delete(int host, const struct wire_rec *rec)
+{
+    int found;
+    if (!fleet_cap)
+        return;
+    size_t i = fleet_slot(fleet_key(host, rec), &found);
+    if (found)
+    {
+        fleet[i].key = FLEET_TOMB;
+        fleet_hosts[host].entries--;
+        fleet_updates++; // Deletes of unknown records change nothing
+    }
+}
+
+// Function to drop a host's entries older than its current snapshot
+void fleet_expire(int host)
+{
+    uint64_t lo = fleet_key(host, NULL);          // Smallest key of the host
+    uint64_t hi = fleet_key(host + 1, NULL);      // First key of the next host
+    for (size_t i = 0; i < fleet_cap; i++)
+    {
+        if (fleet[i].key >= lo && fleet[i].key < hi && fleet[i].gen != fleet_hosts[host].gen)
+        {
+            fleet[i].key = FLEET_TOMB;
+            fleet_hosts[host].entries--;
+        }
+    }
+}
+
+// Function to drop an agent connection from its host. When the last one goes away the
+// host's listeners go too: nothing would ever update or delete them.
+void fleet_release(int host)
+{
+    if (--fleet_hosts[host].conns > 0)
+        return;
+    fleet_hosts[host].gen++; // Every entry is now older than the current snapshot
+    fleet_expire(host);
+}
+
+// Function to find or add a host by name
+int fleet_host(const char *name)
+{
+    unsigned int off = str_intern(&strings, name); // Equal names share one offset
+    for (size_t i = 0; i < fleet_nhosts; i++)
+        if (fleet_hosts[i].name == off)
+            return (int)i;
+    if (fleet_nhosts == fleet_hosts_cap)
+    {
+        fleet_hosts_cap = fleet_hosts_cap ? fleet_hosts_cap * 2 : 64;
+        fleet_hosts = xrealloc(fleet_hosts, fleet_hosts_cap * sizeof(*fleet_hosts));
+    }
+    fleet_hosts[fleet_nhosts].name = off;
+    fleet_hosts[fleet_nhosts].gen = 0;
+    fleet_hosts[fleet_nhosts].entries = 0;
+    fleet_hosts[fleet_nhosts].conns = 0;
+    return (int)fleet_nhosts++;
+}
+
+// Function to parse "unix:/path" or "ADDR:PORT" into a socket address
+socklen_t parse_endpoint(const char *spec, struct sockaddr_storage *ss)
+{
+    memset(ss, 0, sizeof(*ss));
+    if (strncmp(spec, "unix:", 5) == 0)
+    {
+        struct sockaddr_un *un = (struct sockaddr_un *)ss;
+        if (strlen(spec + 5) >= sizeof(un->sun_path))
+            return 0; // Path too long
+        un->sun_family = AF_UNIX;
+        strcpy(un->sun_path, spec + 5);
+        return sizeof(*un);
+    }
+    char host[64];                     // Address part
+    const char *colon = strrchr(spec, ':');
+    struct sockaddr_in *in = (struct sockaddr_in *)ss;
+    if (!colon || colon - spec >= (long)sizeof(host))
+        return 0;
+    memcpy(host, spec, colon - spec);
+    host[colon - spec] = '\0';
+    in->sin_family = AF_INET;
+    in->sin_port = htons(atoi(colon + 1));
+    if (inet_pton(AF_INET, host, &in->sin_addr) != 1 || !in->sin_port)
+        return 0;
+    return sizeof(*in);
+}
+
+// Function to open a connected (listen == 0) or listening socket on an endpoint
+int open_endpoint(const char *spec, int listening)
+{
+    struct sockaddr_storage ss; // Parsed address
+    socklen_t len = parse_endpoint(spec, &ss);
+    int one = 1;
+    if (!len)
+    {
+        fprintf(stderr, "Bad endpoint: %s (use unix:/path or ADDR:PORT)\n", spec);
+        return -1;
+    }
+    int fd = socket(ss.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    if (listening)
+    {
+        if (ss.ss_family == AF_UNIX)
+            unlink(((struct sockaddr_un *)&ss)->sun_path); // Stale socket from a previous run
+        else
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(fd, (struct sockaddr *)&ss, len) < 0 || listen(fd, SOMAXCONN) < 0)
+        {
+            fprintf(stderr, "Cannot listen on %s: %s\n", spec, strerror(errno));
+            close(fd);
+            return -1;
+        }
+    }
+    else if (connect(fd, (struct sockaddr *)&ss, len) < 0)
+    {
+        fprintf(stderr, "Cannot connect to %s: %s\n", spec, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Function to append one frame to a growable buffer
+void frame_append(char **buf, size_t *len, size_t *cap, int type, const void *payload, size_t n)
+{
+    struct frame_hdr h = {htons(FRAME_MAGIC), (uint8_t)type, 0, htonl((uint32_t)n)};
+    if (*len + sizeof(h) + n > *cap)
+    {
+        *cap = (*len + sizeof(h) + n) * 2;
+        *buf = xrealloc(*buf, *cap);
+    }
+    memcpy(*buf + *len, &h, sizeof(h));
+    if (n)
+        memcpy(*buf + *len + sizeof(h), payload, n);
+    *len += sizeof(h) + n;
+}
+
+// Function to write a whole buffer to a blocking socket or file
+int write_all(int fd, const char *buf, size_t len)
+{
+    while (len)
+    {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL); // A closed peer gives EPIPE, not SIGPIPE
+        if (n < 0 && errno == ENOTSOCK)
+            n = write(fd, buf, len); // Snapshot file or pipe: a closed reader ends us as usual
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Function to read exactly len bytes from a blocking socket
+// Returns 0, -1 when the stream ends (or fails) before the first byte, -2 part way.
+int read_all(int fd, void *buf, size_t len)
+{
+    char *p = buf; // Next byte to fill
+    while (len)
+    {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return p == (char *)buf ? -1 : -2;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Function to read one frame from a blocking socket into *payload (malloc'ed)
+// Returns the frame type, -1 at end of stream, -2 for data that is not a frame,
+// -3 for a frame cut short by the end of the stream.
+int read_frame(int fd, char **payload, size_t *len)
+{
+    struct frame_hdr h; // Header in wire order
+    int r = read_all(fd, &h, sizeof(h));
+    if (r < 0)
+        return r == -1 ? -1 : -3;
+    if (ntohs(h.magic) != FRAME_MAGIC || ntohl(h.len) > FRAME_MAX)
+        return -2;
+    *len = ntohl(h.len);
+    *payload = xrealloc(*payload, *len + 1);
+    if (read_all(fd, *payload, *len) < 0)
+        return -3;
+    (*payload)[*len] = '\0'; // Convenience for string payloads
+    return h.type;
+}
+
+// Collector of an agent's current listener set
+struct listener_set
+{
+    struct wire_rec *recs;      // Listeners, sorted by (proto, port) once complete
+    size_t n;                   // Listeners stored
+    size_t cap;                 // Listeners allocated
+    const unsigned char *ports; // Local port filter, NULL for all
+    int others;                 // Port filter keeps raw/packet sockets
+};
+
+// Function to decide whether a socket offers or captures traffic (listeners, sniffers)
+int is_service_socket(const struct sock_rec *rec)
+{
+    switch (rec->proto)
+    {
+    case PROTO_TCP:
+    case PROTO_TCP6:
+        return rec->state == 10; // LISTEN
+    case PROTO_UDP:
+    case PROTO_UDP6:
+        return rec->state == 7 && rec->rport == 0; // Unconnected
+    case PROTO_RAW:
+    case PROTO_RAW6:
+    case PROTO_PACKET:
+        return 1; // Raw IP users and packet sniffers are always of interest
+    default:
+        return 0; // Netlink sockets are plumbing, not services
+    }
+}
+
+// Function to add a listening socket to a listener set (for_each_socket callback)
+int collect_listener(const struct sock_rec *rec, void *arg)
+{
+    struct listener_set *set = arg; // Destination
+
+    if (!is_service_socket(rec))
+        return 0;
+    if (!sock_port_selected(rec->proto, rec->lport, set->ports, set->others))
+        return 0; // Outside --ports / --shard
+    if (set->n == set->cap)
+    {
+        set->cap = set->cap ? set->cap * 2 : 256;
+        set->recs = xrealloc(set->recs, set->cap * sizeof(*set->recs));
+    }
+    struct wire_rec *w = &set->recs[set->n++];
+    const struct owner *o = inode_lookup(&inodes, rec->inode);
+    memset(w, 0, sizeof(*w));
+    w->proto = rec->proto;
+    w->state = rec->state;
+    w->port = htons(rec->lport);
+    memcpy(w->addr, rec->laddr, sizeof(w->addr));
+    if (o)
+    {
+        w->pid = htonl(o->pid);
+        strncpy(w->comm, strings.pool + o->comm, sizeof(w->comm) - 1);
+        strncpy(w->user, strings.pool + o->user, sizeof(w->user) - 1);
+    }
+    return 0;
+}
+
+// Function to order wire records by (proto, port); raw and packet sockets, whose
+// "port" is an IP protocol or ethertype shared by unrelated sockets, also by socket
+// type, address (packet: ifindex) and PID
+int cmp_wire_rec(const void *a, const void *b)
+{
+    const struct wire_rec *x = a, *y = b;
+    if (x->proto != y->proto)
+        return x->proto - y->proto;
+    if (x->port != y->port)
+        return (int)ntohs(x->port) - (int)ntohs(y->port);
+    if (x->proto <= PROTO_UDP6)
+        return 0;
+    if (x->state != y->state)
+        return x->state - y->state;
+    int c = memcmp(x->addr, y->addr, sizeof(x->addr));
+    if (c)
+        return c;
+    return ntohl(x->pid) < ntohl(y->pid) ? -1 : ntohl(x->pid) > ntohl(y->pid);
+}
+
+// Function to discard the attribution index so the next walk starts fresh
+void reset_attribution(void)
+{
+    inode_index_free(&inodes);
+    nowners = 0; // Interned names are kept: they are reused across ticks
+    nfd_counts = 0;
+}
+
+// Function to take the local listener snapshot (sorted, one record per TCP/UDP proto/port,
+// every raw and packet socket)
+void take_listener_snapshot(struct listener_set *set)
+{
+    size_t out = 0; // Records kept after dedup
+    set->n = 0;
+    reset_attribution();
+    build_inode_index();
+    for (int proto = 0; proto < NUM_PROTOS; proto++)
+        if (opts.protos & (1 << proto))
+            for_each_socket(proto, collect_listener, set);
+    qsort(set->recs, set->n, sizeof(*set->recs), cmp_wire_rec);
+    for (size_t i = 0; i < set->n; i++)
+        if (out == 0 || set->recs[i].proto > PROTO_UDP6 || cmp_wire_rec(&set->recs[out - 1], &set->recs[i]) != 0)
+            set->recs[out++] = set->recs[i]; // Same port on several addresses: keep the first
+    set->n = out;
+}
+
+// Function to append records as UPSERT or DELETE frames, batched
+void append_records(char **buf, size_t *len, size_t *cap, int type, const struct wire_rec *recs, size_t n)
+{
+    for (size_t i = 0; i < n; i += FRAME_BATCH)
+    {
+        size_t k = n - i < FRAME_BATCH ? n - i : FRAME_BATCH; // Records in this frame
+        frame_append(buf, len, cap, type, recs + i, k * sizeof(*recs));
+    }
+}
+
+// Function to determine the host name announced in snapshots (--name or hostname)
+void snapshot_name(char *name, size_t size)
+{
+    if (opts.name)
+        snprintf(name, size, "%s", opts.name);
+    else if (gethostname(name, size) < 0)
+        snprintf(name, size, "localhost");
+}
+
+// Function to append a complete snapshot (HELLO, BEGIN, UPSERT..., END)
+void append_snapshot(char **buf, size_t *len, size_t *cap, const char *name, const struct listener_set *set)
+{
+    frame_append(buf, len, cap, FRAME_HELLO, name, strlen(name));
+    frame_append(buf, len, cap, FRAME_SNAP_BEGIN, NULL, 0);
+    append_records(buf, len, cap, FRAME_UPSERT, set->recs, set->n);
+    frame_append(buf, len, cap, FRAME_SNAP_END, NULL, 0);
+}
+
+// Cheap change detection for periodic modes. A full listener snapshot walks
+// every /proc/<pid>/fd; the fingerprint costs a handful of syscalls: a
+// NETLINK_SOCK_DIAG dump of the TCP LISTEN and unconnected UDP sockets, plus
+// the (short) raw and packet socket tables, each socket hashed by identity so
+// one closing while another opens still changes it. Connected sockets and
+// counters are left out, as they move with every connection.
+struct change_gate
+{
+    int nl;            // NETLINK_SOCK_DIAG socket, reused across ticks
+    uint64_t last;     // Fingerprint of the last full scan
+    int valid;         // last holds a fingerprint
+    int skipped;       // Consecutive ticks skipped
+    long scans, skips; // Totals, for reporting
+};
+
+// Function to add one listener to an order-independent sum (diag_dump callback)
+void listen_fingerprint(const struct inet_diag_msg *d, size_t len, void *arg)
+{
+    uint64_t *acc = arg; // Sum, count
+    (void)len;
+    struct
+    {
+        uint32_t src[4], inode, uid;
+        uint16_t sport;
+    } key = {{0}, d->idiag_inode, d->idiag_uid, d->id.idiag_sport};
+    memcpy(key.src, d->id.idiag_src, sizeof(key.src));
+    acc[0] += hash_bytes(&key, sizeof(key));
+    acc[1]++;
+}
+
+// Function to fold the sockets of one family and protocol in the given states into h,
+// via inet_diag. Sockets are combined order-independently: the dump order is not stable.
+uint64_t diag_listen_fingerprint(int nl, int family, int protocol, uint32_t states, uint64_t h)
+{
+    uint64_t acc[2] = {0, 0}; // Sum of socket hashes, count
+
+    if (diag_dump(nl, family, protocol, states, 0, listen_fingerprint, acc) < 0)
+        return h ^ 1; // Unknown state: forces a rescan
+    h = hash_bytes_from(h, &acc[1], sizeof(acc[1]));
+    return hash_bytes_from(h, &acc[0], sizeof(acc[0]));
+}
+
+// Function to add one raw or packet socket to an order-independent sum (for_each_socket callback)
+int table_fingerprint(const struct sock_rec *rec, void *arg)
+{
+    uint64_t *acc = arg; // Sum, count
+    struct
+    {
+        unsigned long long inode;
+        unsigned char addr[16];
+        unsigned short port;
+        unsigned char state;
+    } key;
+    memset(&key, 0, sizeof(key)); // No padding garbage in the hash
+    key.inode = rec->inode;
+    memcpy(key.addr, rec->laddr, sizeof(key.addr));
+    key.port = rec->lport;
+    key.state = rec->state;
+    acc[0] += hash_bytes(&key, sizeof(key));
+    acc[1]++;
+    return 0;
+}
+
+// Function to fold one socket table (raw, raw6, packet) into h
+uint64_t table_listen_fingerprint(int proto, uint64_t h)
+{
+    uint64_t acc[2] = {0, 0}; // Sum of socket hashes, count
+
+    if (for_each_socket(proto, table_fingerprint, acc) < 0)
+        return h; // Table absent (module not loaded): nothing to see
+    h = hash_bytes_from(h, &acc[1], sizeof(acc[1]));
+    return hash_bytes_from(h, &acc[0], sizeof(acc[0]));
+}
+
+// Function to decide whether a full rescan is due: the fingerprint changed,
+// no previous scan exists, or GATE_MAX_SKIP ticks were skipped in a row (a
+// socket passed to another process keeps its inode, so attribution can still
+// drift under an unchanged fingerprint).
+int gate_changed(struct change_gate *g)
+{
+    uint64_t h = 1469598103934665603ULL; // FNV offset basis
+
+    if (g->nl < 0)
+        g->nl = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_SOCK_DIAG);
+    for (int proto = PROTO_RAW; proto <= PROTO_PACKET; proto++)
+        h = table_listen_fingerprint(proto, h);
+    if (g->nl >= 0)
+    { // TCP LISTEN and UDP unconnected (TCP_CLOSE) sockets
+        h = diag_listen_fingerprint(g->nl, AF_INET, IPPROTO_TCP, 1 << 10, h);
+        h = diag_listen_fingerprint(g->nl, AF_INET6, IPPROTO_TCP, 1 << 10, h);
+        h = diag_listen_fingerprint(g->nl, AF_INET, IPPROTO_UDP, 1 << 7, h);
+        h = diag_listen_fingerprint(g->nl, AF_INET6, IPPROTO_UDP, 1 << 7, h);
+    }
+    if (g->valid && h == g->last && g->nl >= 0 && g->skipped < GATE_MAX_SKIP)
+    {
+        g->skipped++;
+        g->skips++;
+        return 0;
+    }
+    g->last = h;
+    g->valid = 1;
+    g->skipped = 0;
+    g->scans++;
+    return 1;
+}
+
+// Function to merge-walk two sorted listener sets and report the differences:
+// cb(ctx, FRAME_UPSERT, rec) for new or changed records, FRAME_DELETE for gone ones
+void diff_listeners(const struct listener_set *prev, const struct listener_set *cur,
+                    void (*cb)(void *, int, const struct wire_rec *), void *ctx)
+{
+    size_t i = 0, j = 0; // Positions in cur / prev
+    while (i < cur->n || j < prev->n)
+    {
+        int c = i == cur->n ? 1 : j == prev->n ? -1 : cmp_wire_rec(&cur->recs[i], &prev->recs[j]);
+        if (c < 0)
+            cb(ctx, FRAME_UPSERT, &cur->recs[i++]);
+        else if (c > 0)
+            cb(ctx, FRAME_DELETE, &prev->recs[j++]);
+        else
+        {
+            if (memcmp(&cur->recs[i], &prev->recs[j], sizeof(struct wire_rec)) != 0)
+                cb(ctx, FRAME_UPSERT, &cur->recs[i]);
+            i++;
+            j++;
+        }
+    }
+}
+
+// Outgoing frame buffer of an agent tick
+struct agent_out
+{
+    char *buf;
+    size_t len, cap;
+};
+
+// Function to queue one listener change as a frame (diff_listeners callback)
+void agent_delta(void *arg, int type, const struct wire_rec *rec)
+{
+    struct agent_out *o = arg; // Frames of this tick
+    frame_append(&o->buf, &o->len, &o->cap, type, rec, sizeof(*rec));
+}
+
+// Function implementing --agent: stream the listener snapshot and deltas to a collector
+int run_agent(const unsigned char *ports)
+{
+    struct listener_set cur = {0}, prev = {0}; // This and the previous tick
+    char name[256];                            // Host name announced in HELLO
+    struct agent_out o = {0};                  // Outgoing frames
+    struct change_gate gate = {.nl = -1};      // Skips rescans of an unchanged host
+    int fd = open_endpoint(opts.agent, 0);
+    int rc = 0;
+
+    if (fd < 0)
+        return 1;
+    snapshot_name(name, sizeof(name));
+    cur.ports = prev.ports = ports;
+    cur.others = prev.others = port_selection_others();
+
+    for (long tick = 0; opts.iterations == 0 || tick < opts.iterations; tick++)
+    {
+        if (tick)
+            sleep(opts.interval);
+        if (!gate_changed(&gate))
+            continue; // Nothing moved: prev is still current
+        take_listener_snapshot(&cur);
+        o.len = 0;
+        if (tick == 0)
+            append_snapshot(&o.buf, &o.len, &o.cap, name, &cur); // Full snapshot first
+        else
+            diff_listeners(&prev, &cur, agent_delta, &o); // New or changed -> UPSERT, gone -> DELETE
+        if (o.len && write_all(fd, o.buf, o.len) < 0)
+        {
+            fprintf(stderr, "Collector closed the connection\n");
+            rc = 1; // Let a supervisor restart us
+            break;
+        }
+        struct listener_set t = prev; // Swap buffers: cur becomes the delta base
+        prev = cur;
+        cur = t;
+    }
+    close(fd);
+    if (gate.nl >= 0)
+        close(gate.nl);
+    alloc_free(o.buf);
+    alloc_free(cur.recs);
+    alloc_free(prev.recs);
+    return rc;
+}
+
+// Function to queue a frame for a collector connection, arming EPOLLOUT when the
+// buffer goes from empty to non-empty
+void conn_queue(int ep, struct fleet_conn *c, int type, const void *payload, size_t n)
+{
+    int idle = c->out_off == c->out_len; // Nothing pending: EPOLLOUT is not armed
+    if (idle)
+        c->out_off = c->out_len = 0; // Drained: restart at the front
+    frame_append(&c->out, &c->out_len, &c->out_cap, type, payload, n);
+    if (idle)
+    {
+        struct epoll_event ev = {EPOLLIN | EPOLLOUT, {.ptr = c}};
+        epoll_ctl(ep, EPOLL_CTL_MOD, c->fd, &ev);
+    }
+}
+
+// Function to answer a QUERY frame: payload is a PROTO_* mask and an optional port bitmap
+void fleet_query(int ep, struct fleet_conn *c, const char *payload, size_t n)
+{
+    uint32_t mask;                                 // Selected protocols
+    const unsigned char *ports = NULL;             // Selected ports, NULL for all
+    char row[sizeof(struct wire_rec) + 256];       // RESULT payload: record + host name
+
+    if (n < 4)
+        return;
+    memcpy(&mask, payload, 4);
+    mask = ntohl(mask);
+    if (n >= 4 + (END_PORT + 1) / 8)
+        ports = (const unsigned char *)payload + 4;
+    for (size_t i = 0; i < fleet_cap; i++)
+    {
+        const struct fleet_entry *e = &fleet[i];
+        if (e->key == 0 || e->key == FLEET_TOMB)
+            continue;
+        if (!(mask & (1u << e->rec.proto)) ||
+            !sock_port_selected(e->rec.proto, ntohs(e->rec.port), ports, 0))
+            continue; // A raw/packet "port" is a protocol or ethertype: --ports drops them
+        const char *host = strings.pool + fleet_hosts[(e->key >> 48) - 1].name;
+        size_t hl = strlen(host) + 1;
+        memcpy(row, &e->rec, sizeof(e->rec));
+        memcpy(row + sizeof(e->rec), host, hl);
+        conn_queue(ep, c, FRAME_RESULT, row, sizeof(e->rec) + hl);
+    }
+    conn_queue(ep, c, FRAME_END, NULL, 0);
+}
+
+// Function to apply all complete frames buffered on a connection; -1 drops the connection
+int fleet_frames(int ep, struct fleet_conn *c)
+{
+    size_t off = 0; // Start of the next unparsed frame
+    while (c->len - off >= sizeof(struct frame_hdr))
+    {
+        struct frame_hdr h;
+        memcpy(&h, c->in + off, sizeof(h));
+        size_t n = ntohl(h.len); // Payload bytes
+        if (ntohs(h.magic) != FRAME_MAGIC || n > FRAME_MAX)
+            return -1; // Not our protocol
+        if (c->len - off < sizeof(h) + n)
+            break; // Incomplete frame
+        const char *p = c->in + off + sizeof(h);
+        if (h.type == FRAME_HELLO)
+        {
+            char name[256];
+            snprintf(name, sizeof(name), "%.*s", (int)n, p);
+            if (c->host >= 0)
+                fleet_release(c->host); // Renamed mid-stream
+            c->host = fleet_host(name);
+            fleet_hosts[c->host].conns++;
+        }
+        else if (h.type == FRAME_QUERY)
+            fleet_query(ep, c, p, n);
+        else if (c->host < 0)
+            return -1; // Data before HELLO
+        else if (h.type == FRAME_SNAP_BEGIN)
+            fleet_hosts[c->host].gen++;
+        else if (h.type == FRAME_SNAP_END)
+            fleet_expire(c->host);
+        else if (h.type == FRAME_UPSERT || h.type == FRAME_DELETE)
+        {
+            for (size_t i = 0; i + sizeof(struct wire_rec) <= n; i += sizeof(struct wire_rec))
+            {
+                struct wire_rec r;
+                memcpy(&r, p + i, sizeof(r)); // Payload is not aligned
+                if (r.proto >= NUM_PROTOS)
+                    continue;
+                if (h.type == FRAME_UPSERT)
+                    fleet_upsert(c->host, &r);
+                else
+                    fleet_delete(c->host, &r);
+            }
+        }
+        off += sizeof(h) + n;
+    }
+    memmove(c->in, c->in + off, c->len - off);
+    c->len -= off;
+    return 0;
+}
+
+// Function to close and free a collector connection
+void conn_close(int ep, struct fleet_conn *c)
+{
+    if (c->host >= 0)
+        fleet_release(c->host);
+    epoll_ctl(ep, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    alloc_free(c->in);
+    alloc_free(c->out);
+    alloc_free(c);
+}
+
+// Function implementing --collect: merge agent streams and answer queries
+int run_collector(void)
+{
+    struct epoll_event evs[64];                // Ready events
+    int lfd = open_endpoint(opts.collect, 1);  // Listening socket
+    int ep = epoll_create1(EPOLL_CLOEXEC);
+    long long report = now_ns();               // Next throughput report
+    unsigned long long reported = 0;           // fleet_updates at the last report
+
+    if (lfd < 0 || ep < 0)
+        return 1;
+    fcntl(lfd, F_SETFL, O_NONBLOCK);
+    struct epoll_event lev = {EPOLLIN, {.ptr = NULL}}; // NULL marks the listener
+    epoll_ctl(ep, EPOLL_CTL_ADD, lfd, &lev);
+    fprintf(stderr, "Collector listening on %s\n", opts.collect);
+
+    for (;;)
+    {
+        int n = epoll_wait(ep, evs, 64, 1000);
+        for (int i = 0; i < n; i++)
+        {
+            struct fleet_conn *c = evs[i].data.ptr;
+            if (!c)
+            { // Accept every pending connection
+                int fd;
+                while ((fd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+                {
+                    c = alloc_calloc(1, sizeof(*c));
+                    if (!c)
+                    {
+                        close(fd);
+                        continue;
+                    }
+                    c->fd = fd;
+                    c->host = -1;
+                    struct epoll_event ev = {EPOLLIN, {.ptr = c}};
+                    epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev);
+                }
+                continue;
+            }
+            if (evs[i].events & EPOLLOUT)
+            { // Drain queued replies
+                ssize_t w = send(c->fd, c->out + c->out_off, c->out_len - c->out_off, MSG_NOSIGNAL);
+                if (w > 0)
+                    c->out_off += w;
+                else if (w < 0 && errno != EAGAIN && errno != EINTR)
+                {
+                    conn_close(ep, c); // Reader went away
+                    continue;
+                }
+                if (c->out_off == c->out_len && c->closing)
+                {
+                    conn_close(ep, c); // Reply finished after a half-close
+                    continue;
+                }
+                if (c->out_off == c->out_len)
+                {
+                    struct epoll_event ev = {EPOLLIN, {.ptr = c}};
+                    epoll_ctl(ep, EPOLL_CTL_MOD, c->fd, &ev);
+                }
+            }
+            if (c->closing)
+            { // Only the reply is left: nothing more to read
+                if (evs[i].events & (EPOLLHUP | EPOLLERR))
+                    conn_close(ep, c);
+                continue;
+            }
+            if (evs[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+            {
+                int dead = 0;
+                for (;;)
+                { // Read until the socket is drained
+                    if (c->cap - c->len < READ_BUF_SIZE)
+                    {
+                        c->cap = c->cap ? c->cap * 2 : 2 * READ_BUF_SIZE;
+                        c->in = xrealloc(c->in, c->cap);
+                    }
+                    ssize_t r = read(c->fd, c->in + c->len, c->cap - c->len);
+                    if (r > 0)
+                    {
+                        c->len += r;
+                        if (fleet_frames(ep, c) < 0)
+                        {
+                            dead = 1;
+                            break;
+                        }
+                        continue;
+                    }
+                    if (r < 0 && (errno == EAGAIN || errno == EINTR))
+                        break;
+                    dead = 1; // EOF or error
+                    break;
+                }
+                if (dead && c->out_off == c->out_len)
+                    conn_close(ep, c);
+                else if (dead)
+                { // Peer half-closed after a query: finish the reply without blocking, then close
+                    struct epoll_event ev = {EPOLLOUT, {.ptr = c}};
+                    c->closing = 1;
+                    epoll_ctl(ep, EPOLL_CTL_MOD, c->fd, &ev);
+                }
+            }
+        }
+        if (now_ns() >= report)
+        { // Periodic throughput line
+            if (fleet_updates != reported)
+                fprintf(stderr, "collector: %zu hosts, %llu updates/s\n", fleet_nhosts,
+                        (fleet_updates - reported) * 1000000000ULL / (unsigned long long)(now_ns() - report + 1000000000LL));
+            reported = fleet_updates;
+            report = now_ns() + 1000000000LL;
+        }
+    }
+}
+
+// Function to turn a wire record into the cells of a listener table row.
+// local needs 64 bytes and pid 16; returns 0 for records of unknown tables.
+int listener_cells(const struct wire_rec *r, const char *cells[7], char *local, char *pid)
+{
+    struct sock_rec s = {.proto = r->proto, .state = r->state, .lport = ntohs(r->port)};
+
+    if (r->proto >= NUM_PROTOS)
+        return 0;
+    s.family = sock_tables[r->proto].family;
+    memcpy(s.laddr, r->addr, sizeof(s.laddr));
+    format_sock_endpoint(local, 64, &s, 0);
+    if (r->pid)
+        format_uint(pid, ntohl(r->pid));
+    else
+        strcpy(pid, "-");
+    cells[1] = sock_tables[r->proto].name;
+    cells[2] = local;
+    cells[3] = state_name(&s);
+    cells[4] = pid;
+    cells[5] = r->comm[0] ? r->comm : "-"; // comm/user are not terminated when 16 bytes long
+    cells[6] = r->user[0] ? r->user : "-";
+    return 1;
+}
+
+// Function to print the header of a host listener table
+void print_listener_header(void)
+{
+    printf("%-20s %-*s %-*s %-*s %-*s %-15s %s\n", "HOST", COL_PROTO, "PROTO", COL_ADDR, "LOCAL",
+           COL_STATE, "STATE", COL_PID, "PID", "PROCESS", "USER");
+}
+
+// Function to print one wire record of a host listener table
+void print_listener_row(const char *host, const struct wire_rec *r)
+{
+    char local[64];        // Formatted endpoint
+    char pid[16];          // PID or '-' when unattributed
+    const char *cells[7];  // Row cells, HOST first
+
+    if (!listener_cells(r, cells, local, pid))
+        return; // Not a socket table we know
+    printf("%-20s %-*s %-*s %-*s %-*s %-15.16s %.16s\n", host,
+           COL_PROTO, cells[1], COL_ADDR, cells[2], COL_STATE, cells[3],
+           COL_PID, cells[4], cells[5], cells[6]);
+}
+
+// Function to print query rows (wire record followed by host name) as a measured table
+void print_listener_table(char *const *rows, size_t nrows)
+{
+    static const char *const headers[] = {"HOST", "PROTO", "LOCAL", "STATE", "PID", "PROCESS", "USER"};
+    static struct out_buf out;  // Buffered output
+    struct table t;             // Column widths
+    const char *cells[7];       // Current row
+    char local[64], pid[16];
+
+    out_init(&out, STDOUT_FILENO);
+    table_init(&t, headers, 7);
+    for (int pass = 0; pass < 2; pass++)
+    { // Pass 0 measures, pass 1 prints
+        if (pass)
+            table_header(&out, &t);
+        for (size_t i = 0; i < nrows; i++)
+        {
+            struct wire_rec r; // Aligned copy
+            memcpy(&r, rows[i], sizeof(r));
+            if (!listener_cells(&r, cells, local, pid))
+                continue;
+            cells[0] = rows[i] + sizeof(r);
+            for (int c = 0; c < 7; c++)
+            {
+                size_t len = c >= 5 ? strnlen(cells[c], sizeof(r.comm)) : strlen(cells[c]);
+                if (pass)
+                    table_cell(&out, &t, c, cells[c], len);
+                else
+                    table_measure(&t, c, len);
+            }
+        }
+    }
+    out_flush(&out);
+}
+
+// Function to print one listener change of --watch (diff_listeners callback)
+void watch_delta(void *arg, int type, const struct wire_rec *rec)
+{
+    const char *stamp = arg; // Time of this tick
+    const char *cells[7];    // Row cells (cells[0], the host, is unused)
+    char local[64], pid[16];
+
+    if (!listener_cells(rec, cells, local, pid))
+        return;
+    printf("%s %c %-*s %-*s %-*s %-*s %-15.16s %.16s\n", stamp, type == FRAME_UPSERT ? '+' : '-',
+           COL_PROTO, cells[1], COL_ADDR, cells[2], COL_STATE, cells[3], COL_PID, cells[4], cells[5], cells[6]);
+}
+
+// Function implementing --watch: print listener changes every --interval,
+// rescanning only when the change gate sees a different fingerprint
+int run_watch(const unsigned char *ports)
+{
+    struct listener_set cur = {0}, prev = {0}; // This and the previous scan
+    struct change_gate gate = {.nl = -1};      // Skips rescans of an unchanged host
+    long long spent = 0;                       // Nanoseconds in gate + scans
+
+    cur.ports = prev.ports = ports;
+    cur.others = prev.others = port_selection_others();
+    for (long tick = 0; opts.iterations == 0 || tick < opts.iterations; tick++)
+    {
+        char stamp[32]; // HH:MM:SS of this tick
+        if (tick)
+            sleep(opts.interval);
+        time_t now = time(NULL);
+        strftime(stamp, sizeof(stamp), "%H:%M:%S", localtime(&now));
+        long long t0 = now_ns();
+        if (gate_changed(&gate))
+        {
+            take_listener_snapshot(&cur);
+            diff_listeners(&prev, &cur, watch_delta, stamp); // First tick lists everything as '+'
+            fflush(stdout);
+            struct listener_set t = prev;
+            prev = cur;
+            cur = t;
+        }
+        spent += now_ns() - t0;
+    }
+    fprintf(stderr, "%ld ticks: %ld full scans, %ld skipped by the change gate, %.1f us per tick\n",
+            gate.scans + gate.skips, gate.scans, gate.skips,
+            gate.scans + gate.skips ? spent / 1e3 / (gate.scans + gate.skips) : 0.0);
+    if (gate.nl >= 0)
+        close(gate.nl);
+    alloc_free(cur.recs);
+    alloc_free(prev.recs);
+    return 0;
+}
+
+// Leak tracking state of one process for --leaks. Each metric keeps its current
+// run of non-decreasing samples: where and when the run began and its length.
+struct leak_proc
+{
+    int pid;                          // Process ID
+    unsigned int comm;                // Name (string cache offset); with pid, the identity
+    unsigned int cur[LEAK_METRICS];   // Latest CLOSE_WAIT, FIN_WAIT2, socket counts
+    unsigned int base[LEAK_METRICS];  // Value when the current run began
+    double since[LEAK_METRICS];       // Time (s) the current run began
+    int run[LEAK_METRICS];            // Samples in the current run
+    unsigned int hist[LEAK_METRICS][LEAK_MIN_SAMPLES]; // Last samples of the run, by run % N
+    unsigned char fresh;              // Socket total re-read this tick
+};
+
+// Problem sockets of one tick (CLOSE_WAIT and FIN_WAIT2), from inet_diag
+struct leak_dump
+{
+    unsigned long long *inodes; // Socket inodes, 0 for orphans
+    unsigned char *states;      // TCP state of each
+    size_t n, cap;
+};
+
+// Function to collect one CLOSE_WAIT or FIN_WAIT2 socket (diag_dump callback)
+void leak_collect(const struct inet_diag_msg *d, size_t len, void *arg)
+{
+    struct leak_dump *ld = arg; // This tick's sockets
+    (void)len;
+    if (ld->n == ld->cap)
+    {
+        ld->cap = ld->cap ? ld->cap * 2 : 1024;
+        ld->inodes = xrealloc(ld->inodes, ld->cap * sizeof(*ld->inodes));
+        ld->states = xrealloc(ld->states, ld->cap);
+    }
+    ld->inodes[ld->n] = d->idiag_inode;
+    ld->states[ld->n++] = d->idiag_state;
+}
+
+// Function to order leak records by (pid, name)
+int cmp_leak_proc(const void *a, const void *b)
+{
+    const struct leak_proc *x = a, *y = b;
+    if (x->pid != y->pid)
+        return x->pid < y->pid ? -1 : 1;
+    return x->comm < y->comm ? -1 : x->comm > y->comm;
+}
+
+// Function to fold one sample into a metric's run: a drop, or no growth over the
+// last LEAK_MIN_SAMPLES samples (a plateau), starts a new run
+void leak_sample(struct leak_proc *p, int m, unsigned int v, double now)
+{
+    int slot = p->run[m] % LEAK_MIN_SAMPLES; // Holds the sample LEAK_MIN_SAMPLES ago
+    if (p->run[m] == 0 || v < p->cur[m] ||
+        (p->run[m] >= LEAK_MIN_SAMPLES && v <= p->hist[m][slot]))
+    {
+        p->base[m] = v;
+        p->since[m] = now;
+        p->run[m] = 0;
+        slot = 0;
+    }
+    p->hist[m][slot] = v;
+    p->cur[m] = v;
+    p->run[m]++;
+}
+
+// Function to decide whether a metric grew monotonically long enough to report;
+// leak_sample ends runs that stop growing, so this holds only while it still grows
+int leak_growing(const struct leak_proc *p, int m)
+{
+    return p->run[m] >= LEAK_MIN_SAMPLES && p->cur[m] > p->base[m];
+}
+
+// Function to format a metric cell: the count, plus the growth rate when growing
+size_t leak_cell(char *buf, size_t size, const struct leak_proc *p, int m, double now)
+{
+    if (!leak_growing(p, m))
+        return (size_t)snprintf(buf, size, "%u", p->cur[m]);
+    double secs = now - p->since[m] > 1e-3 ? now - p->since[m] : 1e-3;
+    return (size_t)snprintf(buf, size, "%u (+%.1f/min)", p->cur[m],
+                            (p->cur[m] - p->base[m]) * 60.0 / secs);
+}
+
+// Function implementing --leaks: track per-process CLOSE_WAIT, FIN_WAIT2 and socket
+// counts across ticks and report processes whose counts keep growing. Every tick
+// dumps only the CLOSE_WAIT/FIN_WAIT2 sockets (kernel-side state filter) and
+// attributes them through the retained inode index; the fd walk reruns only when
+// one of them is unknown to the index or the change gate's skip budget runs out,
+// and socket totals are refreshed on those walks.
+int run_leaks(void)
+{
+    static const char *const headers[] = {"TIME", "PID", "PROCESS", "CLOSE_WAIT", "FIN_WAIT2",
+                                          "SOCKETS"};
+    struct change_gate gate = {.nl = -1}; // Walk accounting, skip budget
+    struct leak_dump ld = {0};            // Problem sockets of this tick
+    struct leak_proc *state = NULL;       // Tracked processes, sorted by (pid, name)
+    struct leak_proc *next = NULL;        // Next tick's state
+    size_t nstate = 0;
+    unsigned int *counts = NULL;          // Per owner: CLOSE_WAIT, FIN_WAIT2, sockets
+    unsigned char *fresh = NULL;          // Per owner: socket total re-read this tick
+    unsigned int *suspects = NULL;        // Owners holding problem sockets last tick
+    unsigned int *held = NULL;            // Their socket totals after a rescan
+    size_t counts_cap = 0;
+    size_t last_n = 0;                    // Problem sockets in the previous dump
+    long long spent = 0;                  // Nanoseconds in dumps, walks and bookkeeping
+    double start = now_ns() / 1e9;
+
+    gate.nl = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_SOCK_DIAG);
+    if (gate.nl < 0)
+    {
+        perror("NETLINK_SOCK_DIAG");
+        return 1;
+    }
+    printf("%-8s %-*s %-15s %-22s %-22s %s\n", headers[0], COL_PID, headers[1], headers[2],
+           headers[3], headers[4], headers[5]);
+    for (long tick = 0; opts.iterations == 0 || tick < opts.iterations; tick++)
+    {
+        if (tick)
+            sleep(opts.interval);
+        long long t0 = now_ns();
+        double now = t0 / 1e9 - start;
+        uint32_t states = (1 << 8) | (1 << 5); // CLOSE_WAIT, FIN_WAIT2
+
+        ld.n = 0;
+        if (diag_dump(gate.nl, AF_INET, IPPROTO_TCP, states, 0, leak_collect, &ld) < 0 ||
+            diag_dump(gate.nl, AF_INET6, IPPROTO_TCP, states, 0, leak_collect, &ld) < 0)
+        {
+            fprintf(stderr, "inet_diag dump failed\n");
+            break;
+        }
+        int walk = tick == 0 || gate.skipped >= GATE_MAX_SKIP;
+        int changed = ld.n < last_n; // Problem sockets closed (or their process exited)
+        for (size_t i = 0; i < ld.n && !walk && !changed; i++)
+            changed = ld.inodes[i] && !inode_lookup(&inodes, ld.inodes[i]); // New socket
+        size_t nsus = 0; // Owners rescanned this tick
+        last_n = ld.n;
+        if (changed && !walk)
+        { // Usually the processes already holding problem sockets: rescan just those
+            for (size_t i = 0; i < nowners; i++)
+                if (counts[i * LEAK_METRICS] || counts[i * LEAK_METRICS + 1])
+                    suspects[nsus++] = (unsigned int)i;
+            inode_index_rescan(suspects, nsus, held);
+            for (size_t i = 0; i < ld.n && !walk; i++)
+                walk = ld.inodes[i] && !inode_lookup(&inodes, ld.inodes[i]); // Someone else's
+        }
+        if (walk)
+        {
+            reset_attribution();
+            build_inode_index();
+            gate.scans++;
+            gate.skipped = 0;
+            nsus = 0;
+        }
+        else
+        {
+            gate.skips++;
+            gate.skipped++;
+        }
+
+        // Count per owner: problem sockets from the dump, totals from the walk or rescan
+        if (nowners * LEAK_METRICS > counts_cap)
+        {
+            counts_cap = nowners * LEAK_METRICS;
+            counts = xrealloc(counts, counts_cap * sizeof(*counts));
+            fresh = xrealloc(fresh, nowners);
+            suspects = xrealloc(suspects, nowners * sizeof(*suspects));
+            held = xrealloc(held, nowners * sizeof(*held));
+        }
+        memset(counts, 0, nowners * LEAK_METRICS * sizeof(*counts));
+        memset(fresh, walk, nowners);
+        for (size_t i = 0; i < ld.n; i++)
+        {
+            const struct owner *o = inode_lookup(&inodes, ld.inodes[i]);
+            if (o)
+                counts[(o - owners) * LEAK_METRICS + (ld.states[i] == 8 ? 0 : 1)]++;
+        }
+        for (size_t i = 0; walk && i < inodes.cap; i++)
+            if (inodes.ctrl[i] != INODE_EMPTY)
+                counts[inodes.slots[i].owner * LEAK_METRICS + 2]++;
+        for (size_t k = 0; k < nsus; k++)
+        {
+            counts[suspects[k] * LEAK_METRICS + 2] = held[k];
+            fresh[suspects[k]] = 1;
+        }
+
+        // Owners of this tick, sorted, then merged with the tracked state
+        next = xrealloc(next, (nowners + 1) * sizeof(*next));
+        size_t n = 0;
+        for (size_t i = 0; i < nowners; i++)
+        {
+            next[n].pid = owners[i].pid;
+            next[n].comm = owners[i].comm;
+            next[n].fresh = fresh[i];
+            memcpy(next[n].cur, counts + i * LEAK_METRICS, sizeof(next[n].cur));
+            n++;
+        }
+        qsort(next, n, sizeof(*next), cmp_leak_proc);
+        size_t out = 0, j = 0;
+        for (size_t i = 0; i < n; i++)
+        {
+            if (out && cmp_leak_proc(&next[out - 1], &next[i]) == 0)
+            { // Same process listed twice (threads with their own fd table)
+                for (int m = 0; m < LEAK_METRICS; m++)
+                    next[out - 1].cur[m] += next[i].cur[m];
+                next[out - 1].fresh &= next[i].fresh;
+                continue;
+            }
+            next[out++] = next[i];
+        }
+        for (size_t i = 0; i < out; i++)
+        {
+            struct leak_proc sample = next[i]; // This tick's counts
+            while (j < nstate && cmp_leak_proc(&state[j], &sample) < 0)
+                j++; // Gone since the last tick
+            if (j < nstate && cmp_leak_proc(&state[j], &sample) == 0)
+                next[i] = state[j++]; // Continue its runs
+            else
+                memset(next[i].run, 0, sizeof(next[i].run)); // New process
+            for (int m = 0; m < LEAK_METRICS; m++)
+                if (m < 2 || sample.fresh)
+                    leak_sample(&next[i], m, sample.cur[m], now); // Totals only when re-read
+        }
+        struct leak_proc *t = state; // Swap: next becomes the state
+        state = next;
+        next = t;
+        nstate = out;
+
+        // Report processes with a growing metric
+        char stamp[32]; // HH:MM:SS
+        time_t wall = time(NULL);
+        strftime(stamp, sizeof(stamp), "%H:%M:%S", localtime(&wall));
+        for (size_t i = 0; i < nstate; i++)
+        {
+            const struct leak_proc *p = &state[i];
+            char cell[LEAK_METRICS][48];
+            if (!leak_growing(p, 0) && !leak_growing(p, 1) && !leak_growing(p, 2))
+                continue;
+            for (int m = 0; m < LEAK_METRICS; m++)
+                leak_cell(cell[m], sizeof(cell[m]), p, m, now);
+            printf("%-8s %-*d %-15.15s %-22s %-22s %s\n", stamp, COL_PID, p->pid,
+                   strings.pool + p->comm, cell[0], cell[1], cell[2]);
+        }
+        fflush(stdout);
+        spent += now_ns() - t0;
+    }
+    fprintf(stderr, "%ld ticks: %ld full fd walks, %ld from the retained index, %.1f us per tick\n",
+            gate.scans + gate.skips, gate.scans, gate.skips,
+            gate.scans + gate.skips ? spent / 1e3 / (gate.scans + gate.skips) : 0.0);
+    close(gate.nl);
+    alloc_free(ld.inodes);
+    alloc_free(ld.states);
+    alloc_free(state);
+    alloc_free(next);
+    alloc_free(counts);
+    alloc_free(fresh);
+    alloc_free(suspects);
+    alloc_free(held);
+    return 0;
+}
+
+// Function to order query rows by (port, proto, host)
+int cmp_query_row(const void *a, const void *b)
+{
+    const struct wire_rec *x = *(const struct wire_rec *const *)a;
+    const struct wire_rec *y = *(const struct wire_rec *const *)b;
+    if (x->port != y->port)
+        return (int)ntohs(x->port) - (int)ntohs(y->port);
+    if (x->proto != y->proto)
+        return x->proto - y->proto;
+    return strcmp((const char *)(x + 1), (const char *)(y + 1)); // Host name follows the record
+}
+
+// Function implementing --query: ask a collector which hosts run which listeners
+int run_query(const unsigned char *set)
+{
+    char q[4 + (END_PORT + 1) / 8];            // QUERY payload
+    uint32_t mask = htonl((uint32_t)opts.protos);
+    char *buf = NULL, *payload = NULL;         // Request frame / reply payload
+    size_t len = 0, cap = 0, n;
+    char **rows = NULL;                        // Received RESULT payloads
+    size_t nrows = 0, rows_cap = 0;
+    int fd = open_endpoint(opts.query, 0);
+    int type;
+
+    if (fd < 0)
+        return 1;
+    memcpy(q, &mask, 4);
+    if (set)
+        memcpy(q + 4, set, (END_PORT + 1) / 8);
+    frame_append(&buf, &len, &cap, FRAME_QUERY, q, set ? sizeof(q) : 4);
+    if (write_all(fd, buf, len) < 0)
+        return 1;
+    while ((type = read_frame(fd, &payload, &n)) == FRAME_RESULT)
+    {
+        if (n <= sizeof(struct wire_rec))
+            continue;
+        if (nrows == rows_cap)
+        {
+            rows_cap = rows_cap ? rows_cap * 2 : 256;
+            rows = xrealloc(rows, rows_cap * sizeof(*rows));
+        }
+        rows[nrows++] = payload; // Keep the buffer, read_frame allocates a new one
+        payload = NULL;
+    }
+    close(fd);
+    if (type != FRAME_END)
+        fprintf(stderr, "Query reply truncated\n");
+
+    qsort(rows, nrows, sizeof(*rows), cmp_query_row);
+    print_listener_table(rows, nrows);
+    for (size_t i = 0; i < nrows; i++)
+        alloc_free(rows[i]);
+    alloc_free(rows);
+    alloc_free(buf);
+    alloc_free(payload);
+    return type == FRAME_END ? 0 : 1;
+}
+
+// ---------------------------------------------------------------------------
+// Snapshot files and k-way merge (--snapshot / --merge / --dump)
+//
+// A snapshot file is the agent's frame stream written to disk: HELLO,
+// SNAP_BEGIN, UPSERT frames sorted by (proto, port), SNAP_END. Shards from
+// --shard runs (or any producer of sorted snapshots) are combined with a
+// loser tree: each input is read one frame at a time, so memory is bounded
+// by k frames regardless of the input sizes. Equal keys are deduplicated,
+// keeping the record from the lowest-numbered input; all inputs must come from
+// one host (same HELLO name).
+// ---------------------------------------------------------------------------
+
+// One merge input
+struct merge_cursor
+{
+    int fd;               // Snapshot stream
+    char *frame;          // Current UPSERT payload (owned, reused)
+    size_t n;             // Records in frame
+    size_t i;             // Next record in frame
+    struct wire_rec cur;  // Current record (aligned copy)
+    int done;             // Input exhausted
+    int ended;            // SNAP_END seen: the input is complete
+    char name[256];       // Host name from the input's HELLO
+};
+
+// Merge state: k cursors and a loser tree over them
+struct merge_tree
+{
+    struct merge_cursor *in; // Inputs
+    int k;                   // Number of inputs
+    int *ls;                 // ls[0] = winner, ls[1..k-1] = losers of internal nodes
+};
+
+// Function to advance a cursor to its next record; returns -1 on malformed, truncated
+// or unsorted input
+int merge_advance(struct merge_cursor *c)
+{
+    struct wire_rec prev = c->cur; // For the sortedness check
+    int had = c->i > 0 || c->n > 0;
+
+    while (c->i == c->n)
+    { // Current frame used up: read frames until the next non-empty UPSERT
+        size_t len;
+        int type = read_frame(c->fd, &c->frame, &len);
+        if (type < 0)
+        {
+            c->done = 1; // End of stream
+            if (type == -1 && c->ended)
+                return 0;
+            fprintf(stderr, "%s\n", type == -2 ? "Not a snapshot frame"
+                                   : type == -3 ? "Snapshot truncated inside a frame"
+                                                : "Snapshot truncated before its end frame");
+            return -1;
+        }
+        if (type == FRAME_HELLO)
+            snprintf(c->name, sizeof(c->name), "%s", c->frame);
+        else if (type == FRAME_DELETE)
+            return -1; // Deltas are not snapshots
+        else if (type == FRAME_SNAP_END)
+            c->ended = 1;
+        else if (type == FRAME_UPSERT)
+        {
+            c->n = len / sizeof(struct wire_rec);
+            c->i = 0;
+        }
+    }
+    memcpy(&c->cur, c->frame + c->i++ * sizeof(struct wire_rec), sizeof(c->cur));
+    if (had && cmp_wire_rec(&prev, &c->cur) > 0)
+        return -1; // Input not sorted: a merge would silently misorder
+    return 0;
+}
+
+// Function to decide whether input a loses against input b (sentinel k always wins)
+int merge_loses(const struct merge_tree *t, int a, int b)
+{
+    if (b == t->k)
+        return 1; // Initialisation sentinel beats everything
+    if (a == t->k)
+        return 0;
+    if (t->in[a].done || t->in[b].done)
+        return t->in[a].done && (!t->in[b].done || a > b); // Exhausted inputs sort last
+    int c = cmp_wire_rec(&t->in[a].cur, &t->in[b].cur);
+    return c > 0 || (c == 0 && a > b); // Ties go to the lower input: deterministic dedup
+}
+
+// Function to replay the path from leaf s to the root after s changed
+void merge_adjust(struct merge_tree *t, int s)
+{
+    for (int node = (s + t->k) / 2; node > 0; node /= 2)
+    {
+        if (merge_loses(t, s, t->ls[node]))
+        { // s loses here: it stays, the previous loser moves up
+            int w = t->ls[node];
+            t->ls[node] = s;
+            s = w;
+        }
+    }
+    t->ls[0] = s;
+}
+
+// Function to k-way merge sorted snapshot streams into one sorted, deduplicated snapshot
+// Returns the number of records written, or -1 on malformed input or write failure.
+long merge_snapshots(const int *in_fds, int k, int out_fd)
+{
+    struct merge_tree t = {alloc_calloc(k, sizeof(struct merge_cursor)), k, alloc_realloc(NULL, (k + 1) * sizeof(int))};
+    struct wire_rec batch[FRAME_BATCH]; // Output records awaiting an UPSERT frame
+    struct wire_rec last;               // Last record written, for dedup
+    int last_in = -1;                   // Input that record came from
+    char *buf = NULL;                   // Encoded output frames
+    size_t len = 0, cap = 0, nb = 0;
+    long written = 0;
+    int err = 0;
+
+    if (!t.in || !t.ls)
+        xrealloc(NULL, (size_t)-1); // Reports and exits
+    for (int i = 0; i < k; i++)
+    { // Prime every cursor with its first record
+        t.in[i].fd = in_fds[i];
+        if (merge_advance(&t.in[i]) < 0)
+            err = 1;
+    }
+    for (int i = 1; i < k && !err; i++)
+        if (strcmp(t.in[i].name, t.in[0].name) != 0)
+        { // Dedup by (proto, addr, port) would fold one host's listeners into another's
+            fprintf(stderr, "Inputs come from different hosts: %s and %s\n", t.in[0].name,
+                    t.in[i].name);
+            err = 1;
+        }
+    for (int i = 0; i <= k; i++)
+        t.ls[i] = k; // Everything starts behind the sentinel
+    for (int i = k - 1; i >= 0; i--)
+        merge_adjust(&t, i);
+
+    // The merged snapshot carries the inputs' common host name
+    const char *name = k && t.in[0].name[0] ? t.in[0].name : "merged";
+    frame_append(&buf, &len, &cap, FRAME_HELLO, name, strlen(name));
+    frame_append(&buf, &len, &cap, FRAME_SNAP_BEGIN, NULL, 0);
+
+    while (!err && k && !t.in[t.ls[0]].done)
+    {
+        int w = t.ls[0]; // Input holding the smallest record
+        // Equal raw/packet records of one input are distinct sockets: only keys seen in
+        // another input are duplicates
+        if (written == 0 || cmp_wire_rec(&last, &t.in[w].cur) != 0 ||
+            (t.in[w].cur.proto > PROTO_UDP6 && w == last_in))
+        { // New key: queue it
+            last = t.in[w].cur;
+            last_in = w;
+            batch[nb++] = last;
+            written++;
+            if (nb == FRAME_BATCH)
+            { // Flush a full frame so the output buffer stays bounded
+                frame_append(&buf, &len, &cap, FRAME_UPSERT, batch, sizeof(batch));
+                nb = 0;
+                if (write_all(out_fd, buf, len) < 0)
+                    err = 1;
+                len = 0;
+            }
+        }
+        if (merge_advance(&t.in[w]) < 0)
+            err = 1;
+        merge_adjust(&t, w);
+    }
+    if (nb)
+        frame_append(&buf, &len, &cap, FRAME_UPSERT, batch, nb * sizeof(*batch));
+    frame_append(&buf, &len, &cap, FRAME_SNAP_END, NULL, 0);
+    if (!err && write_all(out_fd, buf, len) < 0)
+        err = 1;
+
+    for (int i = 0; i < k; i++)
+        alloc_free(t.in[i].frame);
+    alloc_free(t.in);
+    alloc_free(t.ls);
+    alloc_free(buf);
+    return err ? -1 : written;
+}
+
+// Function to open a snapshot file for reading or writing ("-" is stdin/stdout)
+int open_snapshot_file(const char *path, int writing)
+{
+    if (strcmp(path, "-") == 0)
+        return writing ? STDOUT_FILENO : STDIN_FILENO;
+    int fd = writing ? open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)
+                     : open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+    return fd;
+}
+
+// Function implementing --snapshot: write the local listener set as a sorted snapshot file
+int run_snapshot(const unsigned char *ports)
+{
+    struct listener_set set = {NULL, 0, 0, ports, port_selection_others()}; // Listeners of this shard
+    char name[256];                                // Host name for HELLO
+    char *buf = NULL;                              // Encoded frames
+    size_t len = 0, cap = 0;
+    int fd = open_snapshot_file(opts.snapshot, 1);
+
+    if (fd < 0)
+        return 1;
+    snapshot_name(name, sizeof(name));
+    take_listener_snapshot(&set);
+    append_snapshot(&buf, &len, &cap, name, &set);
+    int rc = write_all(fd, buf, len) < 0 ? 1 : 0;
+    if (fd != STDOUT_FILENO)
+        close(fd);
+    alloc_free(buf);
+    alloc_free(set.recs);
+    return rc;
+}
+
+// Function implementing --merge OUT IN...: k-way merge of shard snapshots
+int run_merge(void)
+{
+    int *fds = alloc_realloc(NULL, (opts.ninputs ? opts.ninputs : 1) * sizeof(int)); // Input descriptors
+    int out, rc = 0;
+
+    for (int i = 0; i < opts.ninputs; i++)
+        if ((fds[i] = open_snapshot_file(opts.inputs[i], 0)) < 0)
+            return 1;
+    if ((out = open_snapshot_file(opts.merge, 1)) < 0)
+        return 1;
+    long n = merge_snapshots(fds, opts.ninputs, out);
+    if (n < 0)
+    {
+        fprintf(stderr, "Merge failed: inputs must be complete, sorted snapshot files of one host\n");
+        rc = 1;
+    }
+    else
+        fprintf(stderr, "Merged %d inputs into %ld records\n", opts.ninputs, n);
+    for (int i = 0; i < opts.ninputs; i++)
+        if (fds[i] != STDIN_FILENO)
+            close(fds[i]);
+    if (out != STDOUT_FILENO)
+        close(out);
+    alloc_free(fds);
+    return rc;
+}
+
+// Function implementing --dump FILE: print a snapshot file as a table
+int run_dump(void)
+{
+    char *payload = NULL;  // Current frame payload
+    char host[256] = "-";  // Host name from HELLO
+    size_t len;
+    int type;
+    int fd = open_snapshot_file(opts.dump, 0);
+
+    if (fd < 0)
+        return 1;
+    print_listener_header();
+    while ((type = read_frame(fd, &payload, &len)) >= 0)
+    {
+        if (type == FRAME_HELLO)
+            snprintf(host, sizeof(host), "%s", payload);
+        if (type != FRAME_UPSERT)
+            continue;
+        for (size_t i = 0; i + sizeof(struct wire_rec) <= len; i += sizeof(struct wire_rec))
+        {
+            struct wire_rec r; // Aligned copy
+            memcpy(&r, payload + i, sizeof(r));
+            print_listener_row(host, &r);
+        }
+    }
+    if (fd != STDIN_FILENO)
+        close(fd);
+    alloc_free(payload);
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Probe engine (--probe)
+//
+// A single-threaded epoll event loop drives many non-blocking connects at
+// once. Each in-flight target occupies one fixed-size struct probe slot;
+// after the connect completes, the slot's kind-specific state machine is
+// resumed on every event (data, EOF, timeout) with explicit states instead
+// of a blocking call chain, so a slow service only holds its own slot.
+// Deadlines all use the same timeout, so a FIFO of (deadline, slot,
+// generation) entries replaces a timer heap; stale entries are skipped.
+// ---------------------------------------------------------------------------
+
+// One in-flight probe: the whole per-target state
+struct probe
+{
+    int fd;            // Non-blocking socket, -1 when the slot is free
+    uint32_t addr;     // Target IPv4 address (network order), 0 for IPv6 targets
+    uint32_t acc;      // Accumulator for multi-byte fields
+    uint32_t tag;      // Caller's id of the target (probe_target.tag)
+    uint16_t port;     // Target port
+    uint8_t kind;      // PROBE_* index into probe_kinds[]
+    uint8_t state;     // 0 while connecting, then the kind's own states
+    uint8_t result;    // RES_* outcome once finished
+    uint8_t dlen;      // Bytes used in detail
+    uint16_t gen;      // Timer generation; stale FIFO entries carry older values
+    uint16_t need;     // Bytes still to consume in the current parse field
+    uint16_t aux;      // Kind-specific scratch (e.g. TLS extension type)
+    uint16_t left;     // Kind-specific counter (e.g. TLS extension bytes left)
+    uint16_t err;      // errno of a failed connect (RES_CLOSED / RES_ERROR)
+    long long start;   // Connect start, for the RTT column
+    char detail[24];   // Short human-readable outcome (banner head, version...)
+};
+_Static_assert(sizeof(struct probe) <= 64, "probe contexts must stay cache-line sized");
+
+// One probe target produced by a target iterator
+struct probe_target
+{
+    uint32_t addr;          // IPv4 address (network order)
+    uint16_t port;          // Port
+    uint8_t kind;           // PROBE_* kind
+    uint8_t family;         // AF_INET, or AF_INET6 to connect to addr6 instead
+    unsigned char addr6[16]; // IPv6 address when family is AF_INET6
+    uint32_t tag;           // Opaque id handed back in probe.tag
+};
+
+// Pending deadline (FIFO order == deadline order, since all timeouts are equal)
+struct probe_timer
+{
+    long long deadline; // Monotonic expiry
+    uint32_t slot;      // Probe slot
+    uint16_t gen;       // Slot generation when armed
+};
+
+// Engine state
+struct probe_engine
+{
+    int ep;                                // epoll instance
+    struct probe *slots;                   // Fixed pool of contexts
+    int nslots;                            // Pool size (concurrency)
+    int active;                            // Slots in use
+    uint32_t *free_slots;                  // Stack of free slot indexes
+    int nfree;                             // Entries on the free stack
+    struct probe_timer *timers;            // FIFO ring of deadlines
+    size_t tcap, thead, tlen;              // Ring capacity / first entry / entries
+    long long timeout_ns;                  // Per-step timeout
+    int (*next)(void *, struct probe_target *); // Target iterator: 0 when exhausted, -1 to hold off
+    void *next_ctx;
+    void (*done)(void *, const struct probe *); // Completion callback
+    void *done_ctx;
+};
+
+// Function signature of a kind's state machine step
+// ev is one of EV_*; data/len carry received bytes for EV_READ.
+// Returns STEP_READ to wait for more input or STEP_DONE when finished.
+typedef int (*probe_step_fn)(struct probe *p, int ev, const unsigned char *data, size_t len);
+
+// A probe kind
+struct probe_kind
+{
+    const char *name;   // Name used by --probe and in output
+    probe_step_fn step; // State machine
+};
+
+// Function to record a textual outcome in the probe's detail buffer
+void probe_detail(struct probe *p, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+void probe_detail(struct probe *p, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(p->detail, sizeof(p->detail), fmt, ap);
+    va_end(ap);
+    p->dlen = n < 0 ? 0 : n >= (int)sizeof(p->detail) ? (int)sizeof(p->detail) - 1 : n;
+}
+
+// Function to copy the printable head of a reply into the detail buffer
+void probe_detail_text(struct probe *p, const unsigned char *data, size_t len)
+{
+    size_t n = 0; // Bytes copied
+    while (n < len && n < sizeof(p->detail) - 1 && data[n] != '\r' && data[n] != '\n')
+    {
+        p->detail[n] = isprint(data[n]) ? data[n] : '.';
+        n++;
+    }
+    p->detail[n] = '\0';
+    p->dlen = n;
+}
+
+// Function to send a request on a freshly connected socket (fits the send buffer)
+int probe_send(struct probe *p, const void *data, size_t len)
+{
+    return send(p->fd, data, len, MSG_NOSIGNAL) == (ssize_t)len ? 0 : -1;
+}
+
+// State machine: plain connect (reachability only)
+int step_connect(struct probe *p, int ev, const unsigned char *data, size_t len)
+{
+    (void)ev, (void)data, (void)len;
+    p->result = RES_OPEN;
+    return STEP_DONE;
+}
+
+// State machine: wait for an unsolicited banner (SSH, SMTP, FTP, ...)
+int step_banner(struct probe *p, int ev, const unsigned char *data, size_t len)
+{
+    p->result = RES_OPEN;
+    if (ev == EV_CONNECTED)
+        return STEP_READ; // Servers that talk first do so right away
+    if (ev == EV_READ)
+        probe_detail_text(p, data, len);
+    else
+        probe_detail(p, ev == EV_TIMEOUT ? "(silent)" : "(closed)");
+    return STEP_DONE;
+}
+
+// Function to append received bytes to the detail buffer, which holds the head of a
+// reply until the state machine can classify it; returns the bytes held so far
+size_t probe_gather(struct probe *p, const unsigned char *data, size_t len)
+{
+    size_t room = sizeof(p->detail) - 1 - p->dlen; // Head bytes still to keep
+    size_t n = len < room ? len : room;
+    memcpy(p->detail + p->dlen, data, n);
+    p->dlen += n;
+    p->detail[p->dlen] = '\0';
+    return p->dlen;
+}
+
+// State machine: Redis PING -> +PONG / -NOAUTH
+int step_redis(struct probe *p, int ev, const unsigned char *data, size_t len)
+{
+    p->result = RES_OPEN;
+    if (ev == EV_CONNECTED)
+    {
+        if (probe_send(p, "PING\r\n", 6) < 0)
+            return STEP_DONE;
+        return STEP_READ;
+    }
+    size_t held = ev == EV_READ ? probe_gather(p, data, len) : p->dlen; // Reply head in detail
+    if (ev == EV_READ && held < 5 && p->detail[0] == '+')
+        return STEP_READ; // "+PONG" may arrive split
+    if (held >= 5 && memcmp(p->detail, "+PONG", 5) == 0)
+        probe_detail(p, "redis");
+    else if (held >= 1 && p->detail[0] == '-')
+        probe_detail(p, "redis (auth required)");
+    else
+        probe_detail(p, "not redis");
+    return STEP_DONE;
+}
+
+// State machine: PostgreSQL SSLRequest -> 'S' / 'N'
+int step_postgres(struct probe *p, int ev, const unsigned char *data, size_t len)
+{
+    static const unsigned char ssl_request[8] = {0, 0, 0, 8, 0x04, 0xd2, 0x16, 0x2f};
+    p->result = RES_OPEN;
+    if (ev == EV_CONNECTED)
+        return probe_send(p, ssl_request, sizeof(ssl_request)) < 0 ? STEP_DONE : STEP_READ;
+    // The answer is a single byte, after which the server waits for us: any
+    // further byte in the head means something else is talking
+    size_t held = ev == EV_READ ? probe_gather(p, data, len) : p->dlen; // Reply head in detail
+    if (held == 1 && (p->detail[0] == 'S' || p->detail[0] == 'N'))
+        probe_detail(p, p->detail[0] == 'S' ? "postgres (ssl)" : "postgres (no ssl)");
+    else
+        probe_detail(p, "not postgres");
+    return STEP_DONE;
+}
+
+// State machine: HTTP HEAD -> status line
+int step_http(struct probe *p, int ev, const unsigned char *data, size_t len)
+{
+    static const char req[] = "HEAD / HTTP/1.0\r\nUser-Agent: quickdirtyscan\r\n\r\n";
+    p->result = RES_OPEN;
+    if (ev == EV_CONNECTED)
+        return probe_send(p, req, sizeof(req) - 1) < 0 ? STEP_DONE : STEP_READ;
+    size_t held = ev == EV_READ ? probe_gather(p, data, len) : p->dlen; // Reply head in detail
+    int prefix = memcmp(p->detail, "HTTP/", held < 5 ? held : 5) == 0; // Matches so far
+    if (ev == EV_READ && prefix && held < sizeof(p->detail) - 1 && !memchr(p->detail, '\n', held))
+        return STEP_READ; // Status line not complete yet
+    if (held >= 5 && prefix)
+        probe_detail_text(p, (const unsigned char *)p->detail, held);
+    else
+        probe_detail(p, "not http");
+    return STEP_DONE;
+}
+
+// Function to append big-endian integers while building the TLS ClientHello
+unsigned char *put_be(unsigned char *p, unsigned int v, int bytes)
+{
+    while (bytes--)
+        *p++ = (unsigned char)(v >> (8 * bytes));
+    return p;
+}
+
+// Function to build a TLS 1.2/1.3 ClientHello record; returns its length
+size_t build_client_hello(unsigned char *buf)
+{
+    static const unsigned short suites[] = {0x1301, 0x1302, 0x1303, 0xc02b, 0xc02f, 0xc02c,
+                                            0xc030, 0x009c, 0x009d, 0x002f, 0x0035};
+    static const unsigned short sigalgs[] = {0x0403, 0x0804, 0x0401, 0x0503, 0x0805,
+                                             0x0501, 0x0806, 0x0601, 0x0201};
+    unsigned char *p = buf + 9; // After record (5) and handshake (4) headers
+    unsigned char *ext;         // Start of the extensions block
+
+    p = put_be(p, 0x0303, 2); // legacy_version TLS 1.2
+    for (int i = 0; i < 32; i++)
+        *p++ = (unsigned char)(rand() >> 7); // Random (not security relevant here)
+    *p++ = 0;                                // Empty session id
+    p = put_be(p, sizeof(suites), 2);
+    for (size_t i = 0; i < sizeof(suites) / sizeof(*suites); i++)
+        p = put_be(p, suites[i], 2);
+    p = put_be(p, 0x0100, 2); // One compression method: null
+    ext = p;
+    p += 2;
+    p = put_be(p, 0x000a, 2); // supported_groups: x25519, P-256, P-384
+    p = put_be(p, 8, 2);
+    p = put_be(p, 6, 2);
+    p = put_be(p, 0x001d, 2);
+    p = put_be(p, 0x0017, 2);
+    p = put_be(p, 0x0018, 2);
+    p = put_be(p, 0x000b, 2); // ec_point_formats: uncompressed
+    p = put_be(p, 2, 2);
+    p = put_be(p, 0x0100, 2);
+    p = put_be(p, 0x000d, 2); // signature_algorithms
+    p = put_be(p, sizeof(sigalgs) + 2, 2);
+    p = put_be(p, sizeof(sigalgs), 2);
+    for (size_t i = 0; i < sizeof(sigalgs) / sizeof(*sigalgs); i++)
+        p = put_be(p, sigalgs[i], 2);
+    p = put_be(p, 0x002b, 2); // supported_versions: 1.3, 1.2
+    p = put_be(p, 5, 2);
+    p = put_be(p, 4, 1);
+    p = put_be(p, 0x0304, 2);
+    p = put_be(p, 0x0303, 2);
+    p = put_be(p, 0x0033, 2); // key_share: one x25519 share
+    p = put_be(p, 38, 2);
+    p = put_be(p, 36, 2);
+    p = put_be(p, 0x001d, 2);
+    p = put_be(p, 32, 2);
+    for (int i = 0; i < 32; i++)
+        *p++ = (unsigned char)(rand() >> 7); // Any 32 bytes make a valid X25519 share
+    put_be(ext, (unsigned int)(p - ext - 2), 2);
+
+    size_t hs = p - buf - 9; // Handshake body length
+    buf[0] = 0x16;           // Record: handshake, TLS 1.0 framing
+    put_be(buf + 1, 0x0301, 2);
+    put_be(buf + 3, (unsigned int)(hs + 4), 2);
+    buf[5] = 0x01; // ClientHello
+    put_be(buf + 6, (unsigned int)hs, 3);
+    return p - buf;
+}
+
+// Function to name a TLS protocol version
+const char *tls_version_name(unsigned int v)
+{
+    switch (v)
+    {
+    case 0x0300:
+        return "SSLv3";
+    case 0x0301:
+        return "TLSv1.0";
+    case 0x0302:
+        return "TLSv1.1";
+    case 0x0303:
+        return "TLSv1.2";
+    case 0x0304:
+        return "TLSv1.3";
+    default:
+        return "TLS?";
+    }
+}
+
+// State machine: TLS ClientHello -> streaming ServerHello parse down to the version
+// Each state consumes p->need bytes (accumulated in p->acc) before moving on,
+// so the parse resumes correctly however the reply is split across reads.
+int step_tls(struct probe *p, int ev, const unsigned char *data, size_t len)
+{
+    p->result = RES_OPEN;
+    if (ev == EV_CONNECTED)
+    {
+        unsigned char hello[256]; // ClientHello is ~170 bytes
+        if (probe_send(p, hello, build_client_hello(hello)) < 0)
+            return STEP_DONE;
+        p->state = TLS_REC_TYPE;
+        p->need = 1;
+        p->acc = 0;
+        return STEP_READ;
+    }
+    if (ev != EV_READ)
+    { // EOF or timeout in the middle of the ServerHello
+        if (p->state >= TLS_EXT_LEN && p->dlen)
+            return STEP_DONE; // Version already known from legacy_version
+        probe_detail(p, "no tls reply");
+        return STEP_DONE;
+    }
+    for (size_t i = 0; i < len; i++)
+    {
+        p->acc = (p->acc << 8) | data[i];
+        if (--p->need)
+            continue; // Field not complete yet
+        unsigned int v = p->acc; // Completed field value (only meaningful for <= 4 bytes)
+        p->acc = 0;
+        switch (p->state)
+        {
+        case TLS_REC_TYPE:
+            if (v == 0x15)
+            { // Alert: TLS, but it rejected our hello
+                probe_detail(p, "tls (alert)");
+                return STEP_DONE;
+            }
+            if (v != 0x16)
+            {
+                probe_detail(p, "not tls");
+                return STEP_DONE;
+            }
+            p->state = TLS_REC_REST, p->need = 4; // Record version and length
+            break;
+        case TLS_REC_REST:
+            p->state = TLS_HS_TYPE, p->need = 1;
+            break;
+        case TLS_HS_TYPE:
+            if (v != 0x02)
+            {
+                probe_detail(p, "tls (no server hello)");
+                return STEP_DONE;
+            }
+            p->state = TLS_HS_LEN, p->need = 3;
+            break;
+        case TLS_HS_LEN:
+            p->state = TLS_VERSION, p->need = 2;
+            break;
+        case TLS_VERSION:
+            probe_detail(p, "%s", tls_version_name(v)); // Final unless supported_versions says 1.3
+            p->state = TLS_RANDOM, p->need = 32;
+            break;
+        case TLS_RANDOM:
+            p->state = TLS_SID_LEN, p->need = 1;
+            break;
+        case TLS_SID_LEN:
+            p->state = v ? TLS_SID : TLS_CIPHER, p->need = v ? v : 2;
+            break;
+        case TLS_SID:
+            p->state = TLS_CIPHER, p->need = 2;
+            break;
+        case TLS_CIPHER:
+            p->state = TLS_COMP, p->need = 1;
+            break;
+        case TLS_COMP:
+            p->state = TLS_EXT_LEN, p->need = 2;
+            break;
+        case TLS_EXT_LEN:
+            if (v < 4)
+                return STEP_DONE; // No extensions: legacy_version is the answer
+            p->left = (uint16_t)v;
+            p->state = TLS_EXT_TYPE, p->need = 2;
+            break;
+        case TLS_EXT_TYPE:
+            p->aux = (uint16_t)v;
+            p->state = TLS_EXT_SIZE, p->need = 2;
+            break;
+        case TLS_EXT_SIZE:
+            p->left -= 4 + v < p->left ? 4 + v : p->left;
+            if (p->aux == 0x002b && v == 2)
+                p->state = TLS_SV, p->need = 2; // supported_versions: the real version
+            else if (v)
+                p->state = TLS_EXT_SKIP, p->need = v;
+            else if (p->left >= 4)
+                p->state = TLS_EXT_TYPE, p->need = 2;
+            else
+                return STEP_DONE;
+            break;
+        case TLS_SV:
+            probe_detail(p, "%s", tls_version_name(v));
+            return STEP_DONE;
+        case TLS_EXT_SKIP:
+            if (p->left < 4)
+                return STEP_DONE; // Extensions exhausted without supported_versions
+            p->state = TLS_EXT_TYPE, p->need = 2;
+            break;
+        }
+    }
+    return STEP_READ;
+}
+
+// Known probe kinds, indexed by PROBE_* value
+const struct probe_kind probe_kinds[] = {
+    {"connect", step_connect},
+    {"banner", step_banner},
+    {"redis", step_redis},
+    {"postgres", step_postgres},
+    {"http", step_http},
+    {"tls", step_tls},
+};
+
+// Function to pick a probe kind for a port in --probe auto mode
+int auto_probe_kind(int port)
+{
+    switch (port)
+    {
+    case 6379:
+        return PROBE_REDIS;
+    case 5432:
+        return PROBE_POSTGRES;
+    case 443:
+    case 465:
+    case 636:
+    case 853:
+    case 993:
+    case 995:
+    case 8443:
+        return PROBE_TLS;
+    case 80:
+    case 3000:
+    case 5000:
+    case 8000:
+    case 8008:
+    case 8080:
+        return PROBE_HTTP;
+    default:
+        return PROBE_BANNER;
+    }
+}
+
+// Function to arm a slot's timeout
+void probe_arm(struct probe_engine *e, struct probe *p)
+{
+    if (e->tlen == e->tcap)
+    { // Grow the ring, unwrapping it into the new buffer
+        size_t cap = e->tcap ? e->tcap * 2 : 1024;
+        struct probe_timer *t = xrealloc(NULL, cap * sizeof(*t));
+        for (size_t i = 0; i < e->tlen; i++)
+            t[i] = e->timers[(e->thead + i) % e->tcap];
+        alloc_free(e->timers);
+        e->timers = t;
+        e->tcap = cap;
+        e->thead = 0;
+    }
+    struct probe_timer *t = &e->timers[(e->thead + e->tlen++) % e->tcap];
+    t->deadline = now_ns() + e->timeout_ns;
+    t->slot = (uint32_t)(p - e->slots);
+    t->gen = ++p->gen; // Invalidates any earlier deadline of this slot
+}
+
+// Function to finish a probe, report it and free its slot
+void probe_finish(struct probe_engine *e, struct probe *p)
+{
+    if (p->fd >= 0)
+        close(p->fd); // Also removes it from the epoll set
+    e->done(e->done_ctx, p);
+    p->fd = -1;
+    p->gen++; // Pending timers of this probe become stale
+    e->active--;
+    e->free_slots[e->nfree++] = (uint32_t)(p - e->slots);
+}
+
+// Function to start probes in free slots until the pool is full or targets run out
+// Returns 0 once the target iterator is exhausted. An iterator holding off
+// (e.g. a full reorder window) leaves the rest for a later call.
+int probe_fill(struct probe_engine *e, int *more)
+{
+    while (*more && e->nfree)
+    {
+        struct probe_target t = {0}; // Next target
+        struct sockaddr_storage ss;  // Its address
+        socklen_t slen;
+        int got = e->next(e->next_ctx, &t);
+        if (got < 0)
+            break;
+        if (got == 0)
+        {
+            *more = 0;
+            break;
+        }
+        uint32_t i = e->free_slots[--e->nfree]; // Slot for this target
+        struct probe *p = &e->slots[i];
+        uint16_t gen = p->gen;
+        memset(p, 0, sizeof(*p));
+        p->gen = gen;
+        p->addr = t.addr;
+        p->port = t.port;
+        p->kind = t.kind;
+        p->tag = t.tag;
+        p->start = now_ns();
+        p->fd = socket(t.family == AF_INET6 ? AF_INET6 : AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        e->active++;
+        if (p->fd < 0)
+        { // Out of descriptors: report as an error rather than stall
+            p->result = RES_ERROR;
+            p->err = (uint16_t)errno;
+            probe_finish(e, p);
+            continue;
+        }
+        memset(&ss, 0, sizeof(ss));
+        if (t.family == AF_INET6)
+        {
+            struct sockaddr_in6 *sa6 = (struct sockaddr_in6 *)&ss;
+            sa6->sin6_family = AF_INET6;
+            memcpy(&sa6->sin6_addr, t.addr6, sizeof(t.addr6));
+            sa6->sin6_port = htons(t.port);
+            slen = sizeof(*sa6);
+        }
+        else
+        {
+            struct sockaddr_in *sa = (struct sockaddr_in *)&ss;
+            sa->sin_family = AF_INET;
+            sa->sin_addr.s_addr = t.addr;
+            sa->sin_port = htons(t.port);
+            slen = sizeof(*sa);
+        }
+        if (connect(p->fd, (struct sockaddr *)&ss, slen) < 0 && errno != EINPROGRESS)
+        { // Loopback refuses synchronously
+            p->result = errno == ECONNREFUSED ? RES_CLOSED : RES_ERROR;
+            p->err = (uint16_t)errno;
+            probe_finish(e, p);
+            continue;
+        }
+        struct epoll_event ev = {EPOLLOUT, {.u32 = i}};
+        epoll_ctl(e->ep, EPOLL_CTL_ADD, p->fd, &ev);
+        probe_arm(e, p);
+    }
+    return *more;
+}
+
+// Function to feed one event into a probe's state machine and act on the result
+void probe_dispatch(struct probe_engine *e, struct probe *p, int ev, const unsigned char *data, size_t len)
+{
+    if (probe_kinds[p->kind].step(p, ev, data, len) == STEP_DONE)
+    {
+        probe_finish(e, p);
+        return;
+    }
+    struct epoll_event ee = {EPOLLIN, {.u32 = (uint32_t)(p - e->slots)}}; // Wait for more input
+    epoll_ctl(e->ep, EPOLL_CTL_MOD, p->fd, &ee);
+    probe_arm(e, p);
+}
+
+// Function to size the descriptor budget of the probe modes once, up front:
+// raise the soft RLIMIT_NOFILE to the hard one and clamp --concurrency to it
+void probe_fd_budget(void)
+{
+    struct rlimit rl; // Descriptor limit
+    if (getrlimit(RLIMIT_NOFILE, &rl) < 0)
+        return;
+    if (rl.rlim_cur < rl.rlim_max)
+    {
+        rlim_t soft = rl.rlim_cur; // Kept if the raise is refused
+        rl.rlim_cur = rl.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &rl) < 0)
+            rl.rlim_cur = soft;
+    }
+    if (rl.rlim_cur != RLIM_INFINITY && (rlim_t)opts.concurrency + 32 > rl.rlim_cur)
+    {
+        int n = rl.rlim_cur > 64 ? (int)rl.rlim_cur - 32 : 32; // Leave room for stdio and the epoll fd
+        fprintf(stderr, "Descriptor limit %lu: --concurrency lowered from %d to %d\n",
+                (unsigned long)rl.rlim_cur, opts.concurrency, n);
+        opts.concurrency = n;
+    }
+}
+
+// Function to run the probe engine until every target has completed
+int probe_run(int (*next)(void *, struct probe_target *), void *next_ctx,
+              void (*done)(void *, const struct probe *), void *done_ctx,
+              int concurrency, int timeout_ms)
+{
+    unsigned char rbuf[PROBE_READ_SIZE];        // Receive scratch shared by all slots: contexts keep only a reply head
+    struct epoll_event evs[256];                // Ready events
+    struct probe_engine e = {0};
+    int more = 1;                               // Targets left in the iterator
+
+    e.ep = epoll_create1(EPOLL_CLOEXEC);
+    if (e.ep < 0)
+        return -1;
+    e.nslots = concurrency;
+    e.slots = xrealloc(NULL, concurrency * sizeof(*e.slots));
+    e.free_slots = xrealloc(NULL, concurrency * sizeof(*e.free_slots));
+    e.timeout_ns = (long long)timeout_ms * 1000000LL;
+    e.next = next;
+    e.next_ctx = next_ctx;
+    e.done = done;
+    e.done_ctx = done_ctx;
+    for (int i = 0; i < concurrency; i++)
+    {
+        e.slots[i].fd = -1;
+        e.slots[i].gen = 0;
+        e.free_slots[e.nfree++] = concurrency - 1 - i; // Low slots are handed out first
+    }
+
+    stats_begin(PHASE_PROBE);
+    while (probe_fill(&e, &more) || e.active)
+    {
+        // Sleep until the oldest deadline at most
+        int wait_ms = -1;
+        if (e.tlen)
+        {
+            long long d = e.timers[e.thead].deadline - now_ns();
+            wait_ms = d <= 0 ? 0 : (int)(d / 1000000) + 1;
+        }
+        int n = epoll_wait(e.ep, evs, 256, wait_ms);
+        for (int i = 0; i < n; i++)
+        {
+            struct probe *p = &e.slots[evs[i].data.u32];
+            if (p->fd < 0)
+                continue; // Finished earlier in this batch
+            if (p->state == 0)
+            { // Connect completed one way or the other
+                int err = 0;
+                socklen_t elen = sizeof(err);
+                getsockopt(p->fd, SOL_SOCKET, SO_ERROR, &err, &elen);
+                if (err)
+                {
+                    p->result = err == ECONNREFUSED ? RES_CLOSED : RES_ERROR;
+                    p->err = (uint16_t)err;
+                    probe_finish(&e, p);
+                    continue;
+                }
+                p->state = 1; // Kinds start in state 1
+                probe_dispatch(&e, p, EV_CONNECTED, NULL, 0);
+                continue;
+            }
+            ssize_t r = recv(p->fd, rbuf, sizeof(rbuf), 0);
+            if (r < 0 && (errno == EAGAIN || errno == EINTR))
+                continue;
+            probe_dispatch(&e, p, r > 0 ? EV_READ : EV_EOF, rbuf, r > 0 ? (size_t)r : 0);
+        }
+
+        // Expire deadlines in FIFO order
+        long long now = now_ns();
+        while (e.tlen && e.timers[e.thead].deadline <= now)
+        {
+            struct probe_timer t = e.timers[e.thead];
+            struct probe *p = &e.slots[t.slot];
+            e.thead = (e.thead + 1) % e.tcap;
+            e.tlen--;
+            if (p->fd < 0 || p->gen != t.gen)
+                continue; // Finished or re-armed since
+            if (p->state == 0)
+            { // No SYN-ACK and no RST: dropped by a filter
+                p->result = RES_FILTERED;
+                probe_finish(&e, p);
+            }
+            else
+                probe_dispatch(&e, p, EV_TIMEOUT, NULL, 0);
+        }
+    }
+    stats_end();
+    close(e.ep);
+    alloc_free(e.slots);
+    alloc_free(e.free_slots);
+    alloc_free(e.timers);
+    return 0;
+}
+
+// Reorder buffer: results arrive in completion order and leave in issue order.
+// A sliding bitmap marks completed sequence numbers in [base, base + window);
+// rows are emitted as soon as every lower sequence number is done, and issuing
+// stops at base + window, so memory stays bounded however late a probe is.
+struct reorder
+{
+    uint64_t *done;      // Completion bitmap, bit (seq & (window - 1))
+    unsigned char *rows; // Row storage, row_size bytes per window slot
+    size_t row_size;     // Bytes per row
+    size_t window;       // Slots (power of two, multiple of 64)
+    uint64_t base;       // Lowest sequence number not yet emitted
+    void (*emit)(void *, void *); // Row consumer
+    void *emit_ctx;
+};
+
+// Function to set up a reorder buffer of at least window slots
+void reorder_init(struct reorder *r, size_t window, size_t row_size, void (*emit)(void *, void *), void *ctx)
+{
+    size_t w = 64; // Window rounded up to a power of two
+    while (w < window)
+        w *= 2;
+    r->window = w;
+    r->row_size = row_size;
+    r->done = xrealloc(NULL, w / 64 * sizeof(*r->done));
+    r->rows = xrealloc(NULL, w * row_size);
+    memset(r->done, 0, w / 64 * sizeof(*r->done));
+    r->base = 0;
+    r->emit = emit;
+    r->emit_ctx = ctx;
+}
+
+// Function to tell whether a sequence number fits in the window yet
+int reorder_admit(const struct reorder *r, uint64_t seq)
+{
+    return seq < r->base + r->window;
+}
+
+// Function to give the row storage of an admitted sequence number
+void *reorder_row(struct reorder *r, uint64_t seq)
+{
+    return r->rows + (seq & (r->window - 1)) * r->row_size;
+}
+
+// Function to mark a row complete and emit every row that is now in order
+void reorder_complete(struct reorder *r, uint64_t seq)
+{
+    size_t mask = r->window - 1; // Slot of a sequence number
+    r->done[(seq & mask) / 64] |= 1ULL << (seq & 63);
+    for (;;)
+    {
+        size_t slot = r->base & mask;
+        uint64_t word = r->done[slot / 64] >> (slot & 63); // Done flags from base on
+        size_t run = word == ~0ULL >> (slot & 63) ? 64 - (slot & 63) : (size_t)__builtin_ctzll(~word);
+        if (run == 0)
+            break; // base itself still in flight
+        for (size_t i = 0; i < run; i++)
+            r->emit(r->emit_ctx, r->rows + (slot + i) * r->row_size);
+        r->done[slot / 64] &= run == 64 ? 0 : ~(((1ULL << run) - 1) << (slot & 63));
+        r->base += run;
+    }
+}
+
+// Function to release a reorder buffer
+void reorder_free(struct reorder *r)
+{
+    alloc_free(r->done);
+    alloc_free(r->rows);
+}
+
+// Iterator over the port selection of the --probe target
+struct port_iter
+{
+    const unsigned char *set; // Selected ports, NULL for all
+    uint32_t addr;            // Target address
+    int port;                 // Next port to consider
+    int kind;                 // Fixed kind, or -1 for auto
+    struct reorder *order;    // Issue-order window to respect, NULL for none
+    uint32_t seq;             // Targets issued so far (tagged on each target)
+};
+
+// Function to produce the next (addr, port, kind) of a port selection
+int next_port_target(void *arg, struct probe_target *t)
+{
+    struct port_iter *it = arg; // Iterator state
+    while (it->port <= END_PORT && it->set && !port_in_set(it->set, it->port))
+        it->port++;
+    if (it->port > END_PORT)
+        return 0;
+    if (it->order && !reorder_admit(it->order, it->seq))
+        return -1; // Oldest probe still running: wait for the window to slide
+    t->addr = it->addr;
+    t->port = (uint16_t)it->port;
+    t->kind = (uint8_t)(it->kind >= 0 ? it->kind : auto_probe_kind(it->port));
+    t->tag = it->seq++;
+    it->port++;
+    return 1;
+}
+
+// One --probe outcome waiting in the reorder buffer
+struct probe_row
+{
+    uint16_t port;   // Probed port
+    uint8_t kind;    // PROBE_* kind
+    uint8_t result;  // RES_* outcome
+    float us;        // Elapsed microseconds
+    char detail[24]; // probe.detail, NUL-terminated
+};
+
+// Function to print one --probe row in port order (open ports only)
+void print_probe_row(void *arg, void *row)
+{
+    long *open = arg;          // Count of open ports
+    struct probe_row *r = row; // Row being emitted
+    if (r->result != RES_OPEN)
+        return;
+    (*open)++;
+    printf("%-*u %-10s %10.1f  %s\n", COL_PORT, r->port, probe_kinds[r->kind].name, r->us, r->detail);
+    fflush(stdout); // Stream results as soon as they are in order
+}
+
+// Function to queue one finished --probe target into the reorder buffer
+void print_probe_result(void *arg, const struct probe *p)
+{
+    struct reorder *order = arg;                    // Port-order window
+    struct probe_row *r = reorder_row(order, p->tag); // Row slot of this target
+    r->port = p->port;
+    r->kind = p->kind;
+    r->result = p->result;
+    r->us = (float)((now_ns() - p->start) / 1e3);
+    memcpy(r->detail, p->detail, p->dlen);
+    r->detail[p->dlen < sizeof(r->detail) ? p->dlen : sizeof(r->detail) - 1] = '\0';
+    reorder_complete(order, p->tag);
+}
+
+// Function to parse a --probe kind name ("auto" is -1), -2 if unknown
+int parse_probe_kind(const char *name)
+{
+    if (strcmp(name, "auto") == 0)
+        return -1;
+    for (size_t i = 0; i < sizeof(probe_kinds) / sizeof(*probe_kinds); i++)
+        if (strcmp(name, probe_kinds[i].name) == 0)
+            return (int)i;
+    return -2;
+}
+
+// Function implementing --probe: concurrent connect + application probes
+int run_probe(const unsigned char *set)
+{
+    struct port_iter it = {set, inet_addr(opts.host), START_PORT, parse_probe_kind(opts.probe), NULL, 0};
+    struct reorder order; // Completion -> port order
+    long open = 0;        // Open ports reported
+
+    if (it.kind == -2)
+    {
+        fprintf(stderr, "Unknown probe: %s\n", opts.probe);
+        return 1;
+    }
+    printf("Probing %s ports %s (%s probes, concurrency %d, timeout %d ms)\n\n", opts.host,
+           opts.ports ? opts.ports : "1-65535", opts.probe, opts.concurrency, opts.timeout_ms);
+    printf("%-*s %-10s %10s  %s\n", COL_PORT, "PORT", "PROBE", "TIME(us)", "RESULT");
+    size_t window = (size_t)opts.concurrency * PROBE_REORDER_SPAN; // Rows a slow probe may fall behind
+    reorder_init(&order, window > PROBE_REORDER_MIN ? window : PROBE_REORDER_MIN, sizeof(struct probe_row),
+                 print_probe_row, &open);
+    it.order = &order;
+    if (probe_run(next_port_target, &it, print_probe_result, &order, opts.concurrency, opts.timeout_ms) < 0)
+    {
+        reorder_free(&order);
+        return 1;
+    }
+    reorder_free(&order);
+    printf("\n%ld open ports\n", open);
+    return 0;
+}
+
+// Function to tell whether a connect errno means a local firewall rejected the probe
+int verify_rejected(int err)
+{
+    return err == EHOSTUNREACH || err == EACCES || err == EPERM;
+}
+
+// Function to tell whether a connect errno means there is no route to the target
+int verify_no_route(int err)
+{
+    return err == ENETUNREACH || err == EADDRNOTAVAIL;
+}
+
+// Iterator over the kernel's TCP listeners for --verify
+struct verify_iter
+{
+    const struct wire_rec *recs; // Listeners (tcp and tcp6 LISTEN)
+    size_t n;                    // Listener count
+    size_t next;                 // Next listener to probe
+    uint32_t host;               // Address probed for 0.0.0.0 listeners, 0 for none
+    unsigned char host6[16];     // Address probed for [::] listeners, :: for none
+    int foreign;                 // Probing from another netns: loopback is not ours
+};
+
+// Function to produce the connect target of the next listener.
+// Wildcard listeners are probed at the iterator's host address, bound ones
+// at their own address; v4-mapped IPv6 addresses go out as IPv4. Listeners
+// with no usable address (loopback-only from a foreign netns) are skipped.
+int next_verify_target(void *arg, struct probe_target *t)
+{
+    static const unsigned char v4mapped[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+    struct verify_iter *it = arg; // Iterator state
+    while (it->next < it->n)
+    {
+        const struct wire_rec *r = &it->recs[it->next];
+        t->port = ntohs(r->port);
+        t->kind = PROBE_CONNECT;
+        t->tag = (uint32_t)it->next++;
+        if (r->proto == PROTO_TCP || memcmp(r->addr, v4mapped, sizeof(v4mapped)) == 0)
+        {
+            memcpy(&t->addr, r->proto == PROTO_TCP ? r->addr : r->addr + 12, 4);
+            if (t->addr == INADDR_ANY)
+                t->addr = it->host;
+            t->family = AF_INET;
+            if (t->addr == INADDR_ANY || (it->foreign && (ntohl(t->addr) >> 24) == 127))
+                continue;
+        }
+        else
+        {
+            memcpy(t->addr6, r->addr, sizeof(t->addr6));
+            if (memcmp(t->addr6, &in6addr_any, sizeof(t->addr6)) == 0)
+                memcpy(t->addr6, it->host6, sizeof(t->addr6));
+            t->family = AF_INET6;
+            if (memcmp(t->addr6, &in6addr_any, sizeof(t->addr6)) == 0 ||
+                (it->foreign && memcmp(t->addr6, &in6addr_loopback, sizeof(t->addr6)) == 0))
+                continue;
+        }
+        return 1;
+    }
+    return 0;
+}
+
+// Outcome of one --verify probe
+struct verify_result
+{
+    uint8_t result; // RES_* of the connect
+    uint16_t err;   // errno when refused or failed
+    float us;       // Connect time in microseconds
+};
+
+// Function to record a finished --verify probe (probe engine callback)
+void record_verify_result(void *arg, const struct probe *p)
+{
+    struct verify_result *res = arg; // Indexed by listener
+    res[p->tag].result = p->result;
+    res[p->tag].err = p->err;
+    res[p->tag].us = (float)((now_ns() - p->start) / 1e3);
+}
+
+// Function to describe a --verify outcome. A kernel listener that does not
+// accept is filtered: dropped (timeout), or rejected by RST/ICMP/local rule.
+const char *verify_verdict(const struct verify_result *v)
+{
+    switch (v->result)
+    {
+    case 0:
+        return "not probed (no reachable address)";
+    case RES_OPEN:
+        return "reachable";
+    case RES_FILTERED:
+        return "listening but filtered (dropped)";
+    case RES_CLOSED:
+        return "listening but filtered (reset)";
+    default:
+        if (verify_no_route(v->err))
+            return "no route";
+        return verify_rejected(v->err) ? "listening but filtered (rejected)" : "error";
+    }
+}
+
+// Function to collect the TCP listeners of the current netns, sorted by (proto, port)
+void collect_tcp_listeners(struct listener_set *ls)
+{
+    build_inode_index();
+    for (int proto = PROTO_TCP; proto <= PROTO_TCP6; proto++)
+        if (opts.protos & (1 << proto))
+            for_each_socket(proto, collect_listener, ls);
+    qsort(ls->recs, ls->n, sizeof(*ls->recs), cmp_wire_rec);
+}
+
+// Function implementing --verify: probe only the listeners the kernel reports
+int run_verify(const unsigned char *set)
+{
+    static const char *const headers[] = {"PROTO", "LISTEN", "PID", "PROCESS", "TIME(us)", "RESULT"};
+    static struct out_buf out;             // Buffered report
+    struct listener_set ls = {NULL, 0, 0, set, 0}; // Kernel TCP listeners
+    struct verify_iter it = {0};           // Listener targets
+    struct verify_result *res;             // Outcome per listener
+    struct table t;                        // Report column widths
+    long reachable = 0, filtered = 0;      // Summary counts
+
+    out_init(&out, STDOUT_FILENO);
+    collect_tcp_listeners(&ls);
+    it.recs = ls.recs;
+    it.n = ls.n;
+    it.host = inet_addr(opts.host);
+    memcpy(it.host6, &in6addr_loopback, sizeof(it.host6));
+    res = alloc_calloc(ls.n + 1, sizeof(*res));
+    if (!res)
+        xrealloc(NULL, (size_t)-1); // Reports and exits
+    if (probe_run(next_verify_target, &it, record_verify_result, res, opts.concurrency, opts.timeout_ms) < 0)
+    {
+        alloc_free(res);
+        alloc_free(ls.recs);
+        return 1;
+    }
+
+    table_init(&t, headers, 6);
+    for (int pass = 0; pass < 2; pass++)
+    { // Pass 0 measures, pass 1 prints (in port order, not completion order)
+        if (pass)
+            table_header(&out, &t);
+        for (size_t i = 0; i < ls.n; i++)
+        {
+            const struct wire_rec *r = &ls.recs[i];
+            struct sock_rec s = {.proto = r->proto, .family = sock_tables[r->proto].family, .lport = ntohs(r->port)};
+            char local[64], pid[16], us[32];
+            const char *cells[6];
+            memcpy(s.laddr, r->addr, sizeof(s.laddr));
+            format_sock_endpoint(local, sizeof(local), &s, 0);
+            if (r->pid)
+                format_uint(pid, ntohl(r->pid));
+            else
+                strcpy(pid, "-");
+            snprintf(us, sizeof(us), "%.1f", res[i].us);
+            cells[0] = sock_tables[r->proto].name;
+            cells[1] = local;
+            cells[2] = pid;
+            cells[3] = r->comm[0] ? r->comm : "-";
+            cells[4] = us;
+            cells[5] = verify_verdict(&res[i]);
+            for (int c = 0; c < 6; c++)
+            {
+                size_t len = c == 3 ? strnlen(cells[c], sizeof(r->comm)) : strlen(cells[c]);
+                if (pass)
+                    table_cell(&out, &t, c, cells[c], len);
+                else
+                    table_measure(&t, c, len);
+            }
+            if (pass && res[i].result == RES_OPEN)
+                reachable++;
+            else if (pass && strncmp(cells[5], "listening", 9) == 0)
+                filtered++;
+        }
+    }
+    out_printf(&out, "\n%zu listeners: %ld reachable, %ld filtered, %ld errors\n", ls.n,
+               reachable, filtered, (long)ls.n - reachable - filtered);
+    out_flush(&out);
+    alloc_free(res);
+    alloc_free(ls.recs);
+    return 0;
+}
+
+// A network namespace taking part in --reach
+struct reach_ns
+{
+    int fd;            // Open /proc/<pid>/ns/net (or /run/netns/NAME)
+    ino_t ino;         // Namespace inode, its identity
+    int pid;           // First process seen in it, 0 for bind-mounted names
+    char label[32];    // netns name or process name
+};
+
+// Shared state of the --reach worker threads
+struct reach_ctx
+{
+    struct reach_ns *ns;          // Namespaces to probe from
+    size_t nns;                   // Namespace count
+    atomic_size_t next;           // Next namespace to claim
+    ino_t self;                   // Our own namespace
+    struct verify_iter proto_it;  // Listener iterator template (addresses filled in)
+    struct verify_result *matrix; // nns x listeners outcomes
+    int concurrency;              // Probes in flight per thread
+};
+
+// Function to probe the listener set from every namespace a worker claims.
+// setns() only moves the calling thread, so each worker switches once per
+// namespace and runs a whole concurrent probe batch there.
+void *reach_worker(void *arg)
+{
+    struct reach_ctx *c = arg; // Shared state
+    size_t i;
+    while ((i = atomic_fetch_add(&c->next, 1)) < c->nns)
+    {
+        struct verify_iter it = c->proto_it; // Fresh iterator per namespace
+        struct verify_result *row = c->matrix + i * it.n;
+        if (setns(c->ns[i].fd, CLONE_NEWNET) < 0)
+        {
+            for (size_t j = 0; j < it.n; j++)
+                row[j].result = RES_ERROR, row[j].err = (uint16_t)errno;
+            continue;
+        }
+        it.foreign = c->ns[i].ino != c->self;
+        probe_run(next_verify_target, &it, record_verify_result, row, c->concurrency, opts.timeout_ms);
+    }
+    return NULL;
+}
+
+// Function to add a namespace unless its inode is already known; -1 if inaccessible
+int reach_add_ns(struct reach_ns **ns, size_t *n, size_t *cap, const char *path, int pid, const char *label)
+{
+    struct stat st; // Namespace identity
+    if (stat(path, &st) < 0)
+        return -1;
+    for (size_t i = 0; i < *n; i++)
+        if ((*ns)[i].ino == st.st_ino)
+            return 0; // Same namespace through another process
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    if (*n == *cap)
+    {
+        *cap = *cap ? *cap * 2 : 64;
+        *ns = xrealloc(*ns, *cap * sizeof(**ns));
+    }
+    struct reach_ns *e = &(*ns)[(*n)++];
+    e->fd = fd;
+    e->ino = st.st_ino;
+    e->pid = pid;
+    snprintf(e->label, sizeof(e->label), "%s", label);
+    return 0;
+}
+
+// Function to close and free the namespaces found by reach_find_ns
+void reach_free_ns(struct reach_ns *ns, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        close(ns[i].fd);
+    alloc_free(ns);
+}
+
+// Function to find the namespaces to probe from: --netns entries (PIDs or
+// /run/netns names), else named namespaces followed by every process's one
+size_t reach_find_ns(struct reach_ns **ns)
+{
+    size_t n = 0, cap = 0; // Namespaces found
+    char path[300], comm[64];
+    DIR *d;
+    struct dirent *de;
+
+    if (opts.netns)
+    {
+        char buf[1024];
+        snprintf(buf, sizeof(buf), "%s", opts.netns);
+        for (char *save, *tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save))
+        {
+            if (isdigit((unsigned char)*tok))
+                snprintf(path, sizeof(path), "/proc/%s/ns/net", tok);
+            else
+                snprintf(path, sizeof(path), "/run/netns/%s", tok);
+            if (reach_add_ns(ns, &n, &cap, path, atoi(tok), tok) < 0)
+                fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+        }
+        return n;
+    }
+    if ((d = opendir("/run/netns")))
+    {
+        while ((de = readdir(d)))
+            if (de->d_name[0] != '.')
+            {
+                snprintf(path, sizeof(path), "/run/netns/%s", de->d_name);
+                reach_add_ns(ns, &n, &cap, path, 0, de->d_name);
+            }
+        closedir(d);
+    }
+    if ((d = opendir("/proc")))
+    {
+        while ((de = readdir(d)))
+        {
+            if (!isdigit((unsigned char)de->d_name[0]))
+                continue;
+            int dirfd;
+            snprintf(path, sizeof(path), "/proc/%s", de->d_name);
+            strcpy(comm, "?");
+            if ((dirfd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) >= 0)
+            {
+                if (read_small_file(dirfd, "comm", comm, sizeof(comm)) > 0)
+                    comm[strcspn(comm, "\n")] = '\0';
+                close(dirfd);
+            }
+            snprintf(path, sizeof(path), "/proc/%s/ns/net", de->d_name);
+            reach_add_ns(ns, &n, &cap, path, atoi(de->d_name), comm);
+        }
+        closedir(d);
+    }
+    return n;
+}
+
+// Function to pick the addresses wildcard listeners are probed at from
+// other namespaces: --host unless loopback, else the first global address
+void reach_host_addrs(struct verify_iter *it)
+{
+    struct ifaddrs *ifa, *i; // Our interfaces
+    it->host = inet_addr(opts.host);
+    if ((ntohl(it->host) >> 24) == 127)
+        it->host = 0;
+    memset(it->host6, 0, sizeof(it->host6));
+    if (getifaddrs(&ifa) < 0)
+        return;
+    for (i = ifa; i; i = i->ifa_next)
+    {
+        if (!i->ifa_addr || (i->ifa_flags & IFF_LOOPBACK))
+            continue;
+        if (i->ifa_addr->sa_family == AF_INET && !it->host)
+            it->host = ((struct sockaddr_in *)i->ifa_addr)->sin_addr.s_addr;
+        if (i->ifa_addr->sa_family == AF_INET6 && it->host6[0] == 0 && it->host6[15] == 0)
+        {
+            const struct in6_addr *a = &((struct sockaddr_in6 *)i->ifa_addr)->sin6_addr;
+            if (!IN6_IS_ADDR_LINKLOCAL(a))
+                memcpy(it->host6, a, sizeof(it->host6));
+        }
+    }
+    freeifaddrs(ifa);
+}
+
+// Function to give the matrix character of one outcome
+char reach_mark(const struct verify_result *v)
+{
+    switch (v->result)
+    {
+    case 0:
+        return '.'; // Not probed: loopback-only listener of another netns
+    case RES_OPEN:
+        return '+';
+    case RES_FILTERED:
+        return 'd'; // Dropped
+    case RES_CLOSED:
+        return 'r'; // Reset
+    default:
+        if (verify_no_route(v->err))
+            return 'n';
+        return verify_rejected(v->err) ? 'j' : '?'; // Rejected / error
+    }
+}
+
+// Function implementing --reach: netns x listener reachability matrix
+int run_reach(const unsigned char *set)
+{
+    static struct out_buf out;                  // Buffered report
+    struct listener_set ls = {NULL, 0, 0, set, 0}; // Our TCP listeners
+    struct reach_ctx c = {0};
+    struct stat st;
+    pthread_t *tids;
+    int nthreads, err = 0;
+    long long start = now_ns();
+
+    out_init(&out, STDOUT_FILENO);
+    collect_tcp_listeners(&ls);
+    c.nns = reach_find_ns(&c.ns);
+    if (ls.n == 0 || c.nns == 0)
+    {
+        fprintf(stderr, "Nothing to do: %zu listeners, %zu namespaces\n", ls.n, c.nns);
+        reach_free_ns(c.ns, c.nns);
+        alloc_free(ls.recs);
+        return 1;
+    }
+    if (stat("/proc/self/ns/net", &st) == 0)
+        c.self = st.st_ino;
+    c.proto_it.recs = ls.recs;
+    c.proto_it.n = ls.n;
+    reach_host_addrs(&c.proto_it);
+    c.matrix = alloc_calloc(c.nns * ls.n, sizeof(*c.matrix));
+    if (!c.matrix)
+        xrealloc(NULL, (size_t)-1); // Reports and exits
+
+    // Threads mostly wait on connects: run many, splitting the descriptor budget
+    nthreads = c.nns < REACH_THREADS ? (int)c.nns : REACH_THREADS;
+    c.concurrency = opts.concurrency / nthreads;
+    if (c.concurrency < 16)
+        c.concurrency = 16;
+    tids = xrealloc(NULL, nthreads * sizeof(*tids));
+    for (int i = 0; i < nthreads; i++)
+        if ((err = pthread_create(&tids[i], NULL, reach_worker, &c)) != 0)
+            nthreads = i; // Run with the threads we got
+    if (nthreads == 0)
+    {
+        // Not on the main thread: setns() would leave it in the last namespace probed
+        fprintf(stderr, "Cannot start probe threads: %s\n", strerror(err));
+        alloc_free(tids);
+        alloc_free(c.matrix);
+        reach_free_ns(c.ns, c.nns);
+        alloc_free(ls.recs);
+        return 1;
+    }
+    for (int i = 0; i < nthreads; i++)
+        pthread_join(tids[i], NULL);
+
+    // Legend: one matrix column per listener
+    out_printf(&out, "Listeners (matrix columns):\n");
+    for (size_t j = 0; j < ls.n; j++)
+    {
+        const struct wire_rec *r = &ls.recs[j];
+        struct sock_rec s = {.proto = r->proto, .family = sock_tables[r->proto].family, .lport = ntohs(r->port)};
+        char local[64];
+        long reach = 0; // Namespaces reaching this listener
+        memcpy(s.laddr, r->addr, sizeof(s.laddr));
+        format_sock_endpoint(local, sizeof(local), &s, 0);
+        for (size_t i = 0; i < c.nns; i++)
+            reach += c.matrix[i * ls.n + j].result == RES_OPEN;
+        out_printf(&out, "  %4zu  %-5s %-24s %-16.16s reachable from %ld/%zu\n", j,
+                   sock_tables[r->proto].name, local, r->comm[0] ? r->comm : "-", reach, c.nns);
+    }
+    out_printf(&out, "\n+ reachable  d dropped  r reset  j rejected  n no route  ? error  . loopback-only\n\n");
+    out_printf(&out, "%-12s %-7s %-16s ", "NETNS", "PID", "NAME");
+    for (size_t j = 0; j < ls.n; j += 10)
+        out_printf(&out, "%-11zu", j);
+    out_printf(&out, "\n");
+    for (size_t i = 0; i < c.nns; i++)
+    {
+        out_printf(&out, "%-12lu %-7d %-16.16s ", (unsigned long)c.ns[i].ino, c.ns[i].pid,
+                   c.ns[i].ino == c.self ? "(self)" : c.ns[i].label);
+        for (size_t j = 0; j < ls.n; j++)
+        {
+            char mark[2] = {reach_mark(&c.matrix[i * ls.n + j]), '\0'};
+            if (j && j % 10 == 0)
+                out_write(&out, " ", 1);
+            out_write(&out, mark, 1);
+        }
+        out_write(&out, "\n", 1);
+    }
+    out_printf(&out, "\n%zu namespaces x %zu listeners in %.2f s (%d threads)\n", c.nns, ls.n,
+               (now_ns() - start) / 1e9, nthreads);
+    out_flush(&out);
+    alloc_free(tids);
+    alloc_free(c.matrix);
+    reach_free_ns(c.ns, c.nns);
+    alloc_free(ls.recs);
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Active UDP scan (--udp)
+//
+// One unconnected socket with IP_RECVERR sends a protocol payload per port;
+// replies mark a port open and ICMP errors, read from the socket error queue,
+// mark it closed or filtered. Silence is ambiguous: the kernel rate-limits
+// ICMP errors (net.ipv4.icmp_msgs_per_sec globally, icmp_ratelimit per
+// peer), so unanswered probes are retried and the send rate follows the
+// ICMP rate actually observed instead of outrunning it.
+// ---------------------------------------------------------------------------
+
+// Pending UDP probe (FIFO order == deadline order)
+struct udp_timer
+{
+    long long deadline; // Monotonic expiry
+    uint16_t port;      // Probed port
+    uint8_t tries;      // Attempt this timer belongs to
+};
+
+// UDP scan state
+struct udp_scan
+{
+    int fd;                            // Unconnected IPv4 UDP socket
+    uint32_t addr;                     // Target address (network order)
+    uint16_t self_port;                // Our own source port, never probed
+    uint8_t *status;                   // UDP_* per port
+    uint8_t *tries;                    // Probes sent per port
+    char (*detail)[32];                // Reply summary per open port (lazily allocated)
+    struct udp_timer *timers;          // FIFO ring of deadlines
+    size_t tcap, thead, tlen;          // Ring capacity / first entry / entries
+    uint16_t *retry;                   // Ports waiting to be re-sent
+    size_t nretry, retry_cap;
+    double rate;                       // Current send rate (probes per second)
+    double tokens;                     // Send credit of the token bucket
+    long long last_refill;             // Last token refill
+    long window_sent, window_icmp;     // Per-window counters for rate control
+    long window_answered, window_silent;
+    long long window_start;
+    long sent, retries;                // Totals
+    long unreachable;                  // ICMP port unreachables received so far
+};
+
+// Function to build the payload sent to a UDP port; returns its length
+// Ports without a known protocol get an empty datagram: open services rarely
+// answer it, but closed ports still produce ICMP port unreachable.
+size_t udp_payload(int port, unsigned char *buf)
+{
+    static const unsigned char dns[] = {
+        0x51, 0x44, 0x01, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // id, RD, 1 question
+        0x00, 0x00, 0x02, 0x00, 0x01};                                         // ". IN NS"
+    static const unsigned char snmp[] = {                                      // v2c get sysDescr.0, "public"
+        0x30, 0x29, 0x02, 0x01, 0x01, 0x04, 0x06, 'p', 'u', 'b', 'l', 'i', 'c',
+        0xa0, 0x1c, 0x02, 0x04, 0x51, 0x44, 0x51, 0x44, 0x02, 0x01, 0x00, 0x02, 0x01, 0x00,
+        0x30, 0x0e, 0x30, 0x0c, 0x06, 0x08, 0x2b, 0x06, 0x01, 0x02, 0x01, 0x01, 0x01, 0x00, 0x05, 0x00};
+    static const unsigned char memcached[] = {
+        0x51, 0x44, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 'v', 'e', 'r', 's', 'i', 'o', 'n', '\r', '\n'};
+
+    switch (port)
+    {
+    case 53:
+    case 5353:
+        memcpy(buf, dns, sizeof(dns));
+        return sizeof(dns);
+    case 123:
+        memset(buf, 0, 48);
+        buf[0] = 0x1b; // LI 0, version 3, mode 3 (client)
+        return 48;
+    case 161:
+        memcpy(buf, snmp, sizeof(snmp));
+        return sizeof(snmp);
+    case 11211:
+        memcpy(buf, memcached, sizeof(memcached));
+        return sizeof(memcached);
+    case 443:
+    case 4433:
+    case 8443:
+        // QUIC long-header Initial with a reserved version: servers answer with
+        // Version Negotiation without any handshake crypto. Padded to the 1200
+        // bytes servers require before answering an Initial.
+        memset(buf, 0, 1200);
+        buf[0] = 0xc0;                                             // Long header, Initial
+        put_be(buf + 1, 0x1a2a3a4a, 4);                            // Reserved (greased) version
+        buf[5] = 8;                                                // DCID length
+        memcpy(buf + 6, "\x51\x44\x51\x44\x51\x44\x51\x44", 8);    // DCID
+        buf[14] = 0;                                               // SCID length
+        return 1200;
+    default:
+        return 0;
+    }
+}
+
+// Function to summarise a UDP reply into detail (recognised protocols only)
+void udp_describe(int port, const unsigned char *p, size_t n, char *detail, size_t size)
+{
+    if ((port == 53 || port == 5353) && n >= 12 && (p[2] & 0x80))
+        snprintf(detail, size, "dns rcode=%d answers=%d", p[3] & 0x0f, p[6] << 8 | p[7]);
+    else if (port == 123 && n >= 48 && (p[0] & 7) == 4)
+        snprintf(detail, size, "ntp v%d stratum %d", (p[0] >> 3) & 7, p[1]);
+    else if (port == 161 && n > 2 && p[0] == 0x30)
+        snprintf(detail, size, "snmp response");
+    else if (port == 11211 && n > 16 && memcmp(p + 8, "VERSION ", 8) == 0)
+    {
+        size_t k = 16; // End of the version string
+        while (k < n && p[k] != '\r' && p[k] != '\n')
+            k++;
+        snprintf(detail, size, "memcached %.*s", (int)(k - 16), p + 16);
+    }
+    else if ((port == 443 || port == 4433 || port == 8443) && n >= 11 && (p[0] & 0x80) &&
+             p[1] == 0 && p[2] == 0 && p[3] == 0 && p[4] == 0)
+    { // Version Negotiation: skip DCID/SCID, then list supported versions
+        size_t off = 5 + 1 + p[5];
+        off += off < n ? 1 + p[off] : 0;
+        int len = snprintf(detail, size, "quic");
+        for (; off + 4 <= n && len < (int)size - 12; off += 4)
+        {
+            uint32_t v = (uint32_t)p[off] << 24 | p[off + 1] << 16 | p[off + 2] << 8 | p[off + 3];
+            if ((v & 0x0f0f0f0f) == 0x0a0a0a0a)
+                continue; // Greased entry
+            len += snprintf(detail + len, size - len, v == 1 ? " v1" : v == 0x6b3343cf ? " v2" : " %08x", v);
+        }
+    }
+    else
+    {
+        size_t k = 0; // Printable head of an unknown reply
+        for (size_t i = 0; i < n && k + 1 < size && k < 24; i++)
+            detail[k++] = isprint(p[i]) ? (char)p[i] : '.';
+        detail[k] = '\0';
+    }
+}
+
+// Function to queue a deadline for the probe just sent to port
+void udp_arm(struct udp_scan *u, uint16_t port)
+{
+    if (u->tlen == u->tcap)
+    { // Grow the ring, unwrapping it into the new buffer
+        size_t cap = u->tcap ? u->tcap * 2 : 1024;
+        struct udp_timer *t = xrealloc(NULL, cap * sizeof(*t));
+        for (size_t i = 0; i < u->tlen; i++)
+            t[i] = u->timers[(u->thead + i) % u->tcap];
+        alloc_free(u->timers);
+        u->timers = t;
+        u->tcap = cap;
+        u->thead = 0;
+    }
+    struct udp_timer *t = &u->timers[(u->thead + u->tlen++) % u->tcap];
+    t->deadline = now_ns() + (long long)opts.timeout_ms * 1000000LL;
+    t->port = port;
+    t->tries = u->tries[port];
+}
+
+// Function to send one probe to a port
+void udp_send(struct udp_scan *u, uint16_t port)
+{
+    static unsigned char buf[1200]; // Payload scratch (largest is QUIC)
+    struct sockaddr_in sa = {0};
+    size_t n = udp_payload(port, buf);
+
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = u->addr;
+    sa.sin_port = htons(port);
+    if (sendto(u->fd, buf, n, 0, (struct sockaddr *)&sa, sizeof(sa)) < 0 && errno == ECONNREFUSED)
+        sendto(u->fd, buf, n, 0, (struct sockaddr *)&sa, sizeof(sa)); // Pending error of an earlier probe
+    u->tries[port]++;
+    u->sent++;
+    u->window_sent++;
+    udp_arm(u, port);
+}
+
+// Function to drain replies and ICMP errors from the socket
+void udp_receive(struct udp_scan *u)
+{
+    unsigned char buf[PROBE_READ_SIZE]; // Datagram or quoted packet
+    char ctl[512];                      // Ancillary data (sock_extended_err)
+    struct sockaddr_in sa;
+    struct iovec iov = {buf, sizeof(buf)};
+    struct msghdr mh;
+    ssize_t n;
+
+    for (;;)
+    { // ICMP errors: the error queue holds the original destination in msg_name
+        memset(&mh, 0, sizeof(mh));
+        mh.msg_name = &sa;
+        mh.msg_namelen = sizeof(sa);
+        mh.msg_iov = &iov;
+        mh.msg_iovlen = 1;
+        mh.msg_control = ctl;
+        mh.msg_controllen = sizeof(ctl);
+        if (recvmsg(u->fd, &mh, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+            break;
+        for (struct cmsghdr *c = CMSG_FIRSTHDR(&mh); c; c = CMSG_NXTHDR(&mh, c))
+        {
+            struct sock_extended_err ee;
+            if (c->cmsg_level != IPPROTO_IP || c->cmsg_type != IP_RECVERR)
+                continue;
+            memcpy(&ee, CMSG_DATA(c), sizeof(ee));
+            uint16_t port = ntohs(sa.sin_port);
+            if (ee.ee_origin != SO_EE_ORIGIN_ICMP || sa.sin_addr.s_addr != u->addr ||
+                u->status[port] != UDP_PENDING)
+                continue;
+            u->window_icmp++;
+            u->window_answered++;
+            // Port unreachable means closed; codes 9, 10, 13 and host unreachable mean a filter
+            u->status[port] = ee.ee_type == 3 && ee.ee_code == 3 ? UDP_CLOSED : UDP_FILTERED;
+            u->unreachable += u->status[port] == UDP_CLOSED;
+        }
+    }
+    for (;;)
+    { // Replies
+        socklen_t slen = sizeof(sa);
+        n = recvfrom(u->fd, buf, sizeof(buf), MSG_DONTWAIT, (struct sockaddr *)&sa, &slen);
+        if (n < 0 && errno == ECONNREFUSED)
+            continue; // Error already taken from the queue above
+        if (n < 0)
+            break;
+        uint16_t port = ntohs(sa.sin_port);
+        if (sa.sin_addr.s_addr != u->addr || u->status[port] == UDP_OPEN)
+            continue;
+        u->status[port] = UDP_OPEN;
+        u->window_answered++;
+        if (!u->detail)
+            u->detail = alloc_calloc(END_PORT + 1, sizeof(*u->detail));
+        if (u->detail)
+            udp_describe(port, buf, (size_t)n, u->detail[port], sizeof(u->detail[port]));
+    }
+}
+
+// Function to adapt the send rate once per window. Unanswered probes in a
+// window of a target that has answered with port unreachables mean its ICMP
+// budget is exhausted: fall back to the ICMP rate just observed, at least
+// halving. A target that never sent one drops silently (a firewall), and
+// slowing down would not bring answers back: its rate is left alone. Clean
+// windows grow the rate by a quarter (AIMD), so the scan tracks the limiter's
+// refill rate. Windows span at least ten probes so slow rates are judged on
+// enough samples.
+void udp_adapt(struct udp_scan *u, long long now)
+{
+    double secs = (now - u->window_start) / 1e9; // Window length
+    if (secs < UDP_WINDOW_MS / 1e3 || secs < 10 / u->rate)
+        return;
+    int silent = u->window_silent * 10 > u->window_answered + u->window_silent; // Over 10%
+    if (silent && u->unreachable)
+    { // ICMP dropped by the limiter
+        double icmp_rate = u->window_icmp / secs;
+        u->rate = icmp_rate < u->rate / 2 ? icmp_rate : u->rate / 2;
+    }
+    else if (!silent && u->window_sent)
+        u->rate += u->rate / 4;
+    if (u->rate < UDP_RATE_MIN)
+        u->rate = UDP_RATE_MIN;
+    if (u->rate > UDP_RATE_MAX)
+        u->rate = UDP_RATE_MAX;
+    u->window_start = now;
+    u->window_sent = u->window_icmp = u->window_answered = u->window_silent = 0;
+}
+
+// Function to expire deadlines: retry silent ports, give up after UDP_RETRIES
+void udp_expire(struct udp_scan *u, long long now)
+{
+    while (u->tlen && u->timers[u->thead].deadline <= now)
+    {
+        struct udp_timer t = u->timers[u->thead];
+        u->thead = (u->thead + 1) % u->tcap;
+        u->tlen--;
+        if (u->status[t.port] != UDP_PENDING || u->tries[t.port] != t.tries)
+            continue; // Answered, or superseded by a retry
+        u->window_silent++;
+        if (t.tries > UDP_RETRIES)
+        {
+            u->status[t.port] = UDP_SILENT;
+            continue;
+        }
+        if (u->nretry == u->retry_cap)
+        {
+            u->retry_cap = u->retry_cap ? u->retry_cap * 2 : 1024;
+            u->retry = xrealloc(u->retry, u->retry_cap * sizeof(*u->retry));
+        }
+        u->retry[u->nretry++] = t.port;
+    }
+}
+
+// Function to pick the initial send rate: the local ICMP budget for loopback
+// targets (every closed port costs one token of it), a default otherwise
+double udp_initial_rate(uint32_t addr)
+{
+    char buf[32]; // Sysctl value
+    if ((ntohl(addr) >> 24) != 127 ||
+        read_sysctl("/proc/sys/net/ipv4/icmp_msgs_per_sec", buf, sizeof(buf)) < 0)
+        return UDP_RATE_START;
+    return atoi(buf) > 0 ? atoi(buf) : UDP_RATE_START;
+}
+
+// Function implementing --udp: active UDP scan of --ports at --host
+int run_udp(const unsigned char *set)
+{
+    struct port_iter it = {set, inet_addr(opts.host), START_PORT, PROBE_CONNECT, NULL, 0}; // Shared with --probe
+    struct udp_scan u = {0};
+    struct probe_target t;
+    int on = 1, more = 1;
+    long counts[UDP_SILENT + 1] = {0};
+    long long start = now_ns();
+
+    u.fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    struct sockaddr_in self = {.sin_family = AF_INET};                   // Bound source
+    socklen_t slen = sizeof(self);
+    if (u.fd < 0 || setsockopt(u.fd, IPPROTO_IP, IP_RECVERR, &on, sizeof(on)) < 0 ||
+        bind(u.fd, (struct sockaddr *)&self, sizeof(self)) < 0 ||
+        getsockname(u.fd, (struct sockaddr *)&self, &slen) < 0)
+    {
+        perror("socket");
+        return 1;
+    }
+    u.self_port = ntohs(self.sin_port);
+    u.addr = it.addr;
+    u.status = alloc_calloc(END_PORT + 1, 1);
+    u.tries = alloc_calloc(END_PORT + 1, 1);
+    if (!u.status || !u.tries)
+        xrealloc(NULL, (size_t)-1); // Reports and exits
+    u.rate = udp_initial_rate(u.addr);
+    u.last_refill = u.window_start = start;
+    u.tokens = 1;
+
+    printf("UDP scan of %s ports %s (start rate %.0f/s, timeout %d ms, %d retries)\n\n", opts.host,
+           opts.ports ? opts.ports : "1-65535", u.rate, opts.timeout_ms, UDP_RETRIES);
+    while (more || u.nretry || u.tlen)
+    {
+        long long now = now_ns();
+        u.tokens += (now - u.last_refill) / 1e9 * u.rate;
+        if (u.tokens > UDP_BURST)
+            u.tokens = UDP_BURST;
+        u.last_refill = now;
+        while (u.tokens >= 1)
+        { // Retries first: they decide ports that are already late
+            if (u.nretry)
+            {
+                uint16_t port = u.retry[--u.nretry];
+                u.retries++;
+                udp_send(&u, port);
+            }
+            else if (more && (more = next_port_target(&it, &t)))
+            {
+                if (t.port == u.self_port && (ntohl(u.addr) >> 24) == 127)
+                    continue; // Would probe ourselves
+                udp_send(&u, t.port);
+            }
+            else
+                break;
+            u.tokens--;
+        }
+
+        // Sleep until the next token or deadline, whichever is first
+        long long wake = u.tokens < 1 && (more || u.nretry) ? now + (long long)((1 - u.tokens) / u.rate * 1e9) : now + 1000000000LL;
+        if (u.tlen && u.timers[u.thead].deadline < wake)
+            wake = u.timers[u.thead].deadline;
+        struct pollfd pfd = {u.fd, POLLIN | POLLERR, 0};
+        int ms = (int)((wake - now_ns() + 999999) / 1000000);
+        if (poll(&pfd, 1, ms > 0 ? ms : 0) > 0)
+            udp_receive(&u);
+        now = now_ns();
+        udp_expire(&u, now);
+        udp_adapt(&u, now);
+    }
+
+    printf("%-*s %-14s %s\n", COL_PORT, "PORT", "STATE", "DETAIL");
+    for (int port = START_PORT; port <= END_PORT; port++)
+    {
+        if (!u.tries[port])
+            continue;
+        counts[u.status[port]]++;
+        if (u.status[port] == UDP_CLOSED)
+            continue;
+        printf("%-*d %-14s %s\n", COL_PORT, port,
+               u.status[port] == UDP_OPEN ? "open" : u.status[port] == UDP_FILTERED ? "filtered" : "open|filtered",
+               u.status[port] == UDP_OPEN && u.detail ? u.detail[port] : "");
+    }
+    printf("\n%ld open, %ld closed, %ld filtered, %ld open|filtered; %ld probes (%ld retries) in %.2f s, final rate %.0f/s\n",
+           counts[UDP_OPEN], counts[UDP_CLOSED], counts[UDP_FILTERED], counts[UDP_SILENT],
+           u.sent, u.retries, (now_ns() - start) / 1e9, u.rate);
+    close(u.fd);
+    alloc_free(u.status);
+    alloc_free(u.tries);
+    alloc_free(u.detail);
+    alloc_free(u.timers);
+    alloc_free(u.retry);
+    return 0;
+}
+
+// Outgoing TCP connections sharing one (source, destination, destination port) tuple;
+// the kernel needs a distinct ephemeral source port for each of them
+struct eph_tuple
+{
+    unsigned char family;             // AF_INET or AF_INET6
+    unsigned char saddr[16];          // Source address
+    unsigned char daddr[16];          // Destination address
+    unsigned short dport;             // Destination port
+    unsigned int used;                // Sockets holding a port, 0 marks a free slot
+    unsigned int time_wait;           // ... of which in TIME_WAIT
+    unsigned int owner[EPH_OWNERS];   // Heaviest owners (index into owners[] + 1, 0 none)
+    unsigned int owner_n[EPH_OWNERS]; // Sockets counted per owner
+};
+
+// Bounded per-tuple aggregation for --ephemeral
+struct eph_table
+{
+    struct eph_tuple *slots;       // EPH_SLOTS open-addressed slots
+    struct eph_tuple *spare;       // Survivors while the table is thinned
+    size_t n;                      // Tuples stored (at most EPH_MAX_TUPLES)
+    unsigned long long sockets;    // Outgoing sockets seen
+    unsigned long long time_wait;  // ... of which in TIME_WAIT
+    unsigned long long slack;      // Most any count may be under-reported by
+    const unsigned char *ports;    // Destination port filter, NULL for all
+    int low, high;                 // ip_local_port_range
+    unsigned char listen[(END_PORT + 1) / 8]; // Local ports with a listener
+};
+
+// Function to find a tuple's slot: the match, or the free slot where it belongs
+struct eph_tuple *eph_slot(struct eph_table *e, const struct eph_tuple *key)
+{
+    size_t h = hash_bytes(&key->family, 1);
+    h = hash_bytes_from(h, key->saddr, sizeof(key->saddr));
+    h = hash_bytes_from(h, key->daddr, sizeof(key->daddr));
+    h = hash_bytes_from(h, &key->dport, sizeof(key->dport));
+    for (size_t i = h & (EPH_SLOTS - 1);; i = (i + 1) & (EPH_SLOTS - 1))
+    {
+        struct eph_tuple *t = &e->slots[i];
+        if (!t->used || (t->dport == key->dport && t->family == key->family &&
+                         memcmp(t->saddr, key->saddr, sizeof(t->saddr)) == 0 &&
+                         memcmp(t->daddr, key->daddr, sizeof(t->daddr)) == 0))
+            return t;
+    }
+}
+
+// Function to make room once EPH_MAX_TUPLES tuples are tracked: every count drops by
+// the smallest one (Misra-Gries), which frees at least one slot and never drops a
+// tuple holding more than sockets / EPH_MAX_TUPLES ports
+void eph_thin(struct eph_table *e)
+{
+    unsigned int min = UINT_MAX; // Smallest count
+    size_t kept = 0;
+
+    for (size_t i = 0; i < EPH_SLOTS; i++)
+        if (e->slots[i].used && e->slots[i].used < min)
+            min = e->slots[i].used;
+    for (size_t i = 0; i < EPH_SLOTS; i++)
+    {
+        struct eph_tuple *t = &e->slots[i];
+        if (t->used > min)
+        {
+            e->spare[kept] = *t;
+            e->spare[kept].used -= min;
+            e->spare[kept].time_wait = t->time_wait > min ? t->time_wait - min : 0;
+            kept++;
+        }
+    }
+    memset(e->slots, 0, EPH_SLOTS * sizeof(*e->slots));
+    for (size_t i = 0; i < kept; i++)
+        *eph_slot(e, &e->spare[i]) = e->spare[i]; // Rehash the survivors
+    e->n = kept;
+    e->slack += min;
+}
+
+// Function to charge a socket to one of a tuple's owner counters (Misra-Gries over
+// EPH_OWNERS counters: an owner holding most of the sockets always survives)
+void eph_owner(struct eph_tuple *t, unsigned int owner)
+{
+    int free_slot = -1; // First unused counter
+    for (int i = 0; i < EPH_OWNERS; i++)
+    {
+        if (t->owner[i] == owner)
+        {
+            t->owner_n[i]++;
+            return;
+        }
+        if (!t->owner[i] && free_slot < 0)
+            free_slot = i;
+    }
+    if (free_slot >= 0)
+    {
+        t->owner[free_slot] = owner;
+        t->owner_n[free_slot] = 1;
+        return;
+    }
+    for (int i = 0; i < EPH_OWNERS; i++)
+        if (--t->owner_n[i] == 0)
+            t->owner[i] = 0;
+}
+
+// Function to mark a listener's port (for_each_socket callback). Runs over every
+// table before eph_socket: a dual-stack [::] listener in tcp6 accepts the IPv4
+// connections listed in tcp.
+int eph_listener(const struct sock_rec *rec, void *arg)
+{
+    struct eph_table *e = arg; // Aggregation state
+    if (rec->state == 10)
+        e->listen[rec->lport >> 3] |= 1 << (rec->lport & 7);
+    return 0;
+}
+
+// Function to count an outgoing connection against its tuple (for_each_socket callback)
+int eph_socket(const struct sock_rec *rec, void *arg)
+{
+    struct eph_table *e = arg; // Aggregation state
+
+    if (rec->state == 10 || !rec->rport || rec->lport < e->low || rec->lport > e->high ||
+        port_in_set(e->listen, rec->lport))
+        return 0; // Unconnected, not an ephemeral port, or the server side
+    if (e->ports && !port_in_set(e->ports, rec->rport))
+        return 0; // Outside --ports (destination ports)
+
+    struct eph_tuple key; // Lookup key
+    memset(&key, 0, sizeof(key));
+    key.family = rec->family;
+    memcpy(key.saddr, rec->laddr, sizeof(key.saddr));
+    memcpy(key.daddr, rec->raddr, sizeof(key.daddr));
+    key.dport = rec->rport;
+
+    struct eph_tuple *t = eph_slot(e, &key);
+    if (!t->used)
+    { // New tuple: thin the table first if it is full
+        if (e->n == EPH_MAX_TUPLES)
+        {
+            eph_thin(e);
+            t = eph_slot(e, &key);
+        }
+        *t = key;
+        e->n++;
+    }
+    t->used++;
+    e->sockets++;
+    if (rec->state == 6)
+    { // TIME_WAIT: port held, no owner any more
+        t->time_wait++;
+        e->time_wait++;
+    }
+    else
+    {
+        const struct owner *o = inode_lookup(&inodes, rec->inode);
+        if (o)
+            eph_owner(t, (unsigned int)(o - owners) + 1);
+    }
+    return 0;
+}
+
+// Function to order tuples by ports in use, busiest first
+int cmp_eph_used(const void *a, const void *b)
+{
+    const struct eph_tuple *x = a, *y = b;
+    return x->used != y->used ? (x->used < y->used ? 1 : -1) : (int)x->dport - (int)y->dport;
+}
+
+// Function to decide whether TIME_WAIT ports of a tuple can be reused by connect()
+// (net.ipv4.tcp_tw_reuse: 1 everywhere, 2 for loopback only)
+int eph_tw_reusable(const struct eph_tuple *t, int tw_reuse)
+{
+    static const unsigned char mapped[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+    if (tw_reuse != 2)
+        return tw_reuse == 1;
+    if (t->family == AF_INET)
+        return t->daddr[0] == 127;
+    return memcmp(t->daddr, &in6addr_loopback, 16) == 0 ||
+           (memcmp(t->daddr, mapped, 12) == 0 && t->daddr[12] == 127);
+}
+
+// Function implementing --ephemeral: report (source, destination, port) tuples close
+// to running out of ephemeral ports, with the processes holding them; memory is fixed
+// (EPH_SLOTS tuples) whatever the number of sockets
+int run_ephemeral(const unsigned char *set)
+{
+    static const char *const headers[] = {"SOURCE", "DESTINATION", "USED", "TIME_WAIT", "USE%",
+                                          "PROCESSES"};
+    static struct eph_table e;      // Aggregation state (large: keep it off the stack)
+    static struct out_buf out;      // Buffered report
+    unsigned char reserved[(END_PORT + 1) / 8]; // ip_local_reserved_ports
+    char buf[4096];                 // Sysctl text
+    struct table t;                 // Report column widths
+    int tw_reuse = 2, avail, near = 0;
+
+    out_init(&out, STDOUT_FILENO);
+    if (read_sysctl("/proc/sys/net/ipv4/ip_local_port_range", buf, sizeof(buf)) < 0 ||
+        sscanf(buf, "%d %d", &e.low, &e.high) != 2 || e.low > e.high)
+    {
+        fprintf(stderr, "Cannot read net.ipv4.ip_local_port_range\n");
+        return 1;
+    }
+    avail = e.high - e.low + 1;
+    buf[0] = '\0';
+    read_sysctl("/proc/sys/net/ipv4/ip_local_reserved_ports", buf, sizeof(buf));
+    buf[strcspn(buf, "\n")] = '\0';
+    if (buf[0] && parse_port_list(buf, reserved) > 0)
+        for (int p = e.low; p <= e.high; p++)
+            avail -= port_in_set(reserved, p) ? 1 : 0; // Never handed out by connect()
+    if (read_sysctl("/proc/sys/net/ipv4/tcp_tw_reuse", buf, sizeof(buf)) == 0)
+        tw_reuse = atoi(buf);
+    if (avail <= 0)
+        avail = 1;
+
+    e.ports = set;
+    e.slots = alloc_calloc(EPH_SLOTS, sizeof(*e.slots));
+    e.spare = alloc_realloc(NULL, EPH_MAX_TUPLES * sizeof(*e.spare));
+    if (!e.slots || !e.spare)
+        xrealloc(NULL, (size_t)-1); // Reports and exits
+    build_inode_index();
+    for (int proto = PROTO_TCP; proto <= PROTO_TCP6; proto++)
+        if (opts.protos & (1 << proto))
+            for_each_socket(proto, eph_listener, &e); // Server ports first, from every table
+    for (int proto = PROTO_TCP; proto <= PROTO_TCP6; proto++)
+        if (opts.protos & (1 << proto))
+            for_each_socket(proto, eph_socket, &e);
+
+    // Compact the tuples to the front of the slot array and sort them
+    size_t n = 0;
+    for (size_t i = 0; i < EPH_SLOTS; i++)
+        if (e.slots[i].used)
+            e.slots[n++] = e.slots[i];
+    qsort(e.slots, n, sizeof(*e.slots), cmp_eph_used);
+    for (size_t i = 0; i < n; i++)
+    {
+        unsigned int held = e.slots[i].used -
+                            (eph_tw_reusable(&e.slots[i], tw_reuse) ? e.slots[i].time_wait : 0);
+        near += held * 100ULL >= (unsigned long long)avail * EPH_WARN_PCT;
+    }
+
+    table_init(&t, headers, 6);
+    for (int pass = 0; pass < 2; pass++)
+    { // Pass 0 measures, pass 1 prints
+        if (pass)
+            table_header(&out, &t);
+        for (size_t i = 0; i < n && i < EPH_TOP; i++)
+        {
+            struct eph_tuple *u = &e.slots[i];
+            char src[64], dst[64], used[24], tw[24], pct[16], procs[128];
+            const char *cells[6] = {src, dst, used, tw, pct, procs};
+            unsigned int held = u->used - (eph_tw_reusable(u, tw_reuse) ? u->time_wait : 0);
+            size_t plen = 0;
+
+            format_address(src, sizeof(src), u->family, u->saddr); // The source port varies
+            format_endpoint(dst, sizeof(dst), u->family, u->daddr, u->dport);
+            format_uint(used, u->used);
+            format_uint(tw, u->time_wait);
+            snprintf(pct, sizeof(pct), "%.1f", 100.0 * held / avail);
+            procs[0] = '\0';
+            for (int k = 0; k < EPH_OWNERS && plen < sizeof(procs); k++)
+                if (u->owner[k])
+                {
+                    const struct owner *o = &owners[u->owner[k] - 1];
+                    plen += (size_t)snprintf(procs + plen, sizeof(procs) - plen, "%s%s/%d(%u)",
+                                             plen ? "," : "", strings.pool + o->comm, o->pid,
+                                             u->owner_n[k]);
+                }
+            if (!procs[0])
+                strcpy(procs, "-");
+            for (int c = 0; c < 6; c++)
+            {
+                if (pass)
+                    table_cell(&out, &t, c, cells[c], strlen(cells[c]));
+                else
+                    table_measure(&t, c, strlen(cells[c]));
+            }
+        }
+    }
+    out_printf(&out, "\n%llu outgoing connections (%llu TIME_WAIT) over %zu tuples; "
+                     "%d ephemeral ports (%d-%d), tcp_tw_reuse=%d\n",
+               e.sockets, e.time_wait, n, avail, e.low, e.high, tw_reuse);
+    out_printf(&out, "%d tuple%s at or above %d%% of the range\n", near, near == 1 ? "" : "s",
+               EPH_WARN_PCT);
+    if (e.slack)
+        out_printf(&out, "More than %d tuples: counts may be low by up to %llu\n",
+                   EPH_MAX_TUPLES, e.slack);
+    out_flush(&out);
+    alloc_free(e.slots);
+    alloc_free(e.spare);
+    return 0;
+}
+
+// A process checked against its descriptor limit by --fds
+struct fd_risk
+{
+    int pid;              // Process ID
+    unsigned int fds;     // Open descriptors
+    unsigned int sockets; // ... of which sockets
+    unsigned long limit;  // Soft RLIMIT_NOFILE
+    unsigned int comm;    // Process name (string cache offset)
+    unsigned int user;    // User name (string cache offset)
+};
+
+// Function to read the soft RLIMIT_NOFILE of a process from /proc/<pid>/limits;
+// returns 0 when the process is gone or the limit is unlimited
+unsigned long fd_soft_limit(int pid)
+{
+    char path[48];  // /proc/<pid>/limits
+    char buf[4096]; // Whole file (about 1.5 KiB)
+    const char *l;
+
+    snprintf(path, sizeof(path), "/proc/%d/limits", pid);
+    if (read_sysctl(path, buf, sizeof(buf)) < 0 || !(l = strstr(buf, "\nMax open files")))
+        return 0;
+    for (l += 15; *l == ' '; l++)
+        ;
+    return isdigit((unsigned char)*l) ? strtoul(l, NULL, 10) : 0;
+}
+
+// Function to order checked processes by the share of their limit in use, highest first
+int cmp_fd_risk(const void *a, const void *b)
+{
+    const struct fd_risk *x = a, *y = b;
+    unsigned long long ux = (unsigned long long)x->fds * y->limit; // Cross-multiplied shares
+    unsigned long long uy = (unsigned long long)y->fds * x->limit;
+    if (ux != uy)
+        return ux < uy ? 1 : -1;
+    return x->pid - y->pid;
+}
+
+// Function implementing --fds: processes close to their descriptor limit. The owner
+// walk already lists every fd table, so the counts come with it; /proc/<pid>/limits
+// is read only for processes holding FDS_MIN_OPEN descriptors or more.
+int run_fds(void)
+{
+    static const char *const headers[] = {"PID", "PROCESS", "USER", "FDS", "LIMIT", "USE%",
+                                          "SOCKETS", "SOCK%"};
+    static struct out_buf out;     // Buffered report
+    struct fd_risk *risk = NULL;   // Processes checked against their limit
+    size_t nrisk = 0;
+    unsigned long long total = 0;  // Descriptors across all walked processes
+    char buf[1024];                // comm, status head, file-nr
+    struct table t;                // Report column widths
+    int near = 0;
+
+    out_init(&out, STDOUT_FILENO);
+    build_inode_index();
+    for (size_t i = 0; i < nfd_counts; i++)
+    {
+        const struct fd_count *c = &fd_counts[i];
+        char dir[32], comm[64], status[1024];
+        unsigned int uid;
+        total += c->fds;
+        if (c->fds < FDS_MIN_OPEN || (opts.pid >= 0 && c->pid != opts.pid))
+            continue;
+        unsigned long limit = fd_soft_limit(c->pid);
+        if (!limit)
+            continue; // Exited, or no limit to run into
+        snprintf(dir, sizeof(dir), "/proc/%d/", c->pid);
+        int dirfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        int have_comm = dirfd >= 0 && read_small_file(dirfd, "comm", buf, sizeof(buf)) > 0;
+        int have_status = dirfd >= 0 && read_small_file(dirfd, "status", status, sizeof(status)) > 0;
+        if (dirfd >= 0)
+            close(dirfd);
+        parse_owner_text(have_comm ? buf : NULL, have_status ? status : NULL, comm, sizeof(comm), &uid);
+        risk = xrealloc(risk, (nrisk + 1) * sizeof(*risk));
+        risk[nrisk++] = (struct fd_risk){c->pid, c->fds, c->sockets, limit,
+                                         str_intern(&strings, comm), user_name(uid)};
+        near += c->fds * 100ULL >= limit * (unsigned long long)FDS_WARN_PCT;
+    }
+    qsort(risk, nrisk, sizeof(*risk), cmp_fd_risk);
+
+    table_init(&t, headers, 8);
+    for (int pass = 0; pass < 2; pass++)
+    { // Pass 0 measures, pass 1 prints
+        if (pass)
+            table_header(&out, &t);
+        for (size_t i = 0; i < nrisk && i < FDS_TOP; i++)
+        {
+            const struct fd_risk *r = &risk[i];
+            char pid[24], fds[24], limit[24], pct[16], socks[24], spct[16];
+            const char *cells[8] = {pid, strings.pool + r->comm, strings.pool + r->user, fds,
+                                    limit, pct, socks, spct};
+            format_uint(pid, (unsigned)r->pid);
+            format_uint(fds, r->fds);
+            format_uint(limit, r->limit);
+            snprintf(pct, sizeof(pct), "%.1f", 100.0 * r->fds / r->limit);
+            format_uint(socks, r->sockets);
+            snprintf(spct, sizeof(spct), "%.0f", 100.0 * r->sockets / r->fds);
+            for (int c = 0; c < 8; c++)
+            {
+                if (pass)
+                    table_cell(&out, &t, c, cells[c], strlen(cells[c]));
+                else
+                    table_measure(&t, c, strlen(cells[c]));
+            }
+        }
+    }
+    out_printf(&out, "\n%zu processes hold %llu descriptors; %zu with %d or more checked against "
+                     "their limit, %d at or above %d%%\n",
+               nfd_counts, total, nrisk, FDS_MIN_OPEN, near, FDS_WARN_PCT);
+    if (read_sysctl("/proc/sys/fs/file-nr", buf, sizeof(buf)) == 0)
+    { // System-wide file table: allocated, free, fs.file-max
+        unsigned long long used = 0, unused = 0, max = 0;
+        if (sscanf(buf, "%llu %llu %llu", &used, &unused, &max) == 3 && max)
+            out_printf(&out, "System file table: %llu of %llu in use (%.2f%%)\n", used - unused, max,
+                       100.0 * (used - unused) / max);
+    }
+    out_flush(&out);
+    alloc_free(risk);
+    return 0;
+}
+
+// Function to order --stats rows by phase, then thread label ("walk-2" before "walk-10")
+int cmp_stats_row(const void *a, const void *b)
+{
+    const struct stats_row *x = a, *y = b;
+    if (x->phase != y->phase)
+        return x->phase - y->phase;
+    return strverscmp(x->thread, y->thread);
+}
+
+// Function to format the cells of one --stats row; counters no thread could open are '-'
+void stats_cells(const struct stats_row *r, char cells[11][24])
+{
+    const unsigned long long *v = r->count;
+    int col = 4;
+
+    snprintf(cells[0], 24, "%s", phase_names[r->phase]);
+    snprintf(cells[1], 24, "%s", r->thread);
+    snprintf(cells[2], 24, "%ld", r->calls);
+    snprintf(cells[3], 24, "%.3f", r->wall_ns / 1e6);
+    if (stats_have[0])
+        snprintf(cells[col], 24, "%.3f", v[0] / 1e6); // task-clock counts nanoseconds on CPU
+    else
+        snprintf(cells[col], 24, "-");
+    for (int e = 1; e < PERF_EVENTS; e++)
+    {
+        if (++col == 7)
+        { // IPC sits after the instructions column
+            if (stats_have[1] && stats_have[2] && v[1])
+                snprintf(cells[col++], 24, "%.2f", (double)v[2] / v[1]);
+            else
+                snprintf(cells[col++], 24, "-");
+        }
+        if (stats_have[e])
+            snprintf(cells[col], 24, "%llu", v[e]);
+        else
+            snprintf(cells[col], 24, "-");
+    }
+}
+
+// Function to append the allocation table and the process memory peaks to the --stats report
+void stats_memory(struct out_buf *out)
+{
+    static const char *const headers[] = {"PHASE", "ALLOCS", "ALLOC_KB", "PEAK_HEAP_KB"};
+    char cells[4][24];
+    char status[4096];     // /proc/self/status
+    long long peak = 0;    // Highest live heap over all phases
+    struct table t;
+
+    table_init(&t, headers, 4);
+    for (int pass = 0; pass < 2; pass++)
+    { // Pass 0 measures, pass 1 prints
+        if (pass)
+        {
+            out_write(out, "\n", 1);
+            table_header(out, &t);
+        }
+        for (int p = 0; p <= NUM_PHASES; p++)
+        {
+            long long calls = atomic_load(&alloc_calls[p]), top = atomic_load(&alloc_peak[p]);
+            if (!calls && !top)
+                continue; // Phase did not run, or never allocated
+            peak = top > peak ? top : peak;
+            snprintf(cells[0], 24, "%s", p < NUM_PHASES ? phase_names[p] : "other");
+            snprintf(cells[1], 24, "%lld", calls);
+            snprintf(cells[2], 24, "%.1f", atomic_load(&alloc_bytes[p]) / 1024.0);
+            snprintf(cells[3], 24, "%.1f", top / 1024.0);
+            for (int c = 0; c < 4; c++)
+            {
+                if (pass)
+                    table_cell(out, &t, c, cells[c], strlen(cells[c]));
+                else
+                    table_measure(&t, c, strlen(cells[c]));
+            }
+        }
+    }
+    out_printf(out, "heap: %.1f KiB live at exit, peak %.1f KiB", atomic_load(&alloc_live) / 1024.0,
+               peak / 1024.0);
+    if (read_sysctl("/proc/self/status", status, sizeof(status)) == 0)
+    { // Whole process, libc buffers and stacks included
+        const char *hwm = strstr(status, "\nVmHWM:"), *rss = strstr(status, "\nVmRSS:");
+        if (hwm && rss)
+            out_printf(out, "; VmHWM %ld kB, VmRSS %ld kB", strtol(hwm + 7, NULL, 10),
+                       strtol(rss + 7, NULL, 10));
+    }
+    out_write(out, "\n", 1);
+}
+
+// Function to print the --stats report on stderr (atexit handler)
+void stats_report(void)
+{
+    static const char *const headers[] = {"PHASE", "THREAD", "CALLS", "WALL_MS", "CPU_MS", "CYCLES",
+                                          "INSTR", "IPC", "CACHE_MISS", "BR_MISS", "CTX_SW"};
+    static const char *const event_names[PERF_EVENTS] = {"task-clock", "cycles", "instructions",
+                                                         "cache-misses", "branch-misses",
+                                                         "context-switches"};
+    static struct out_buf out;          // Report text
+    struct stats_row total[NUM_PHASES]; // Phase totals over all threads
+    int threads[NUM_PHASES] = {0};      // Threads that ran each phase
+    long long inside = 0;               // Main thread time spent in phases
+    char cells[11][24];
+    char buf[64];
+    struct table t;
+
+    out_init(&out, STDERR_FILENO);
+    if (stats_self.ready && stats_self.depth)
+        stats_charge(&stats_self, -1); // exit() from inside a phase: close its last interval
+    opts.stats = 0;                     // The report's own writes are not a phase
+    qsort(stats_rows, nstats_rows, sizeof(*stats_rows), cmp_stats_row);
+    memset(total, 0, sizeof(total));
+    for (size_t i = 0; i < nstats_rows; i++)
+    {
+        const struct stats_row *r = &stats_rows[i];
+        struct stats_row *s = &total[r->phase];
+        s->phase = r->phase;
+        s->calls += r->calls;
+        s->wall_ns += r->wall_ns;
+        for (int e = 0; e < PERF_EVENTS; e++)
+            s->count[e] += r->count[e];
+        threads[r->phase]++;
+        if (strcmp(r->thread, "main") == 0)
+            inside += r->wall_ns;
+    }
+    for (int p = 0; p < NUM_PHASES; p++)
+        snprintf(total[p].thread, sizeof(total[p].thread), "all");
+
+    table_init(&t, headers, 11);
+    for (int pass = 0; pass < 2; pass++)
+    { // Pass 0 measures, pass 1 prints
+        if (pass)
+            table_header(&out, &t);
+        for (size_t i = 0; i < nstats_rows; i++)
+        {
+            const struct stats_row *r = &stats_rows[i];
+            int last = i + 1 == nstats_rows || stats_rows[i + 1].phase != r->phase;
+            for (int k = 0; k < (last && threads[r->phase] > 1 ? 2 : 1); k++)
+            { // Per-thread row, then the phase total when several threads ran it
+                stats_cells(k ? &total[r->phase] : r, cells);
+                for (int c = 0; c < 11; c++)
+                {
+                    if (pass)
+                        table_cell(&out, &t, c, cells[c], strlen(cells[c]));
+                    else
+                        table_measure(&t, c, strlen(cells[c]));
+                }
+            }
+        }
+    }
+    out_printf(&out, "main thread: %.3f ms in phases of %.3f ms run time\n", inside / 1e6,
+               (now_ns() - stats_start_ns) / 1e6);
+    stats_memory(&out);
+    if (!stats_have[0])
+    {
+        if (read_sysctl("/proc/sys/kernel/perf_event_paranoid", buf, sizeof(buf)) < 0)
+            snprintf(buf, sizeof(buf), "?");
+        buf[strcspn(buf, "\n")] = '\0';
+        out_printf(&out, "perf_event_open: %s (kernel.perf_event_paranoid=%s): wall time only\n",
+                   strerror(stats_errno[0]), buf);
+    }
+    else
+    { // One line for the refused counters, with the first refusal's reason
+        int err = 0;
+        for (int e = 1; e < PERF_EVENTS; e++)
+            if (!stats_have[e])
+            {
+                out_printf(&out, "%s%s", err ? ", " : "", event_names[e]);
+                err = err ? err : stats_errno[e];
+            }
+        if (err)
+            out_printf(&out, " not counted: %s%s\n", strerror(err),
+                       err == ENOENT || err == EOPNOTSUPP ? " (no hardware PMU, e.g. in a VM)" : "");
+    }
+    if (stats_user_only)
+        out_printf(&out, "counters exclude kernel time (perf_event_paranoid)\n");
+    out_flush(&out);
+}
+
+// Function to print command line help
+void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  --host ADDR       Target IPv4 address (default 127.0.0.1)\n"
+            "  --ports LIST      Ports to scan/probe, e.g. 22,80,8000-8100 (default 1-65535)\n"
+            "  --latency         Measure connect latency of listeners instead of scanning\n"
+            "  --count N         Latency samples per port (default %d)\n"
+            "  --rate N          Latency connects per second (default %d)\n"
+            "  --timeout MS      Latency connect/first-byte timeout (default %d)\n"
+            "  --first-byte      Also measure time to the first byte sent by the service\n"
+            "  --stream          List sockets from the kernel tables in constant memory\n"
+            "  --proto LIST      Socket tables: tcp,tcp6,udp,udp6,raw,raw6,packet,netlink\n"
+            "                    (default all)\n"
+            "  --state NAME      Only sockets in this state, e.g. LISTEN, ESTABLISHED, UNCONN\n"
+            "  --list            Load all sockets into a columnar table, then filter and sort\n"
+            "  --sort KEYS       Sort --list by proto,state,port,rport,local,remote,pid,uid,\n"
+            "                    user,process,inode; with --mem also rmem,wmem,queued,drops\n"
+            "                    ('-' prefix for descending)\n"
+            "  --pid N           Only sockets owned by PID N (--list)\n"
+            "  --uid N           Only sockets of uid N (--list)\n"
+            "  --json            Print --list as a JSON array\n"
+            "  --exe KIND        Add EXE and BUILD columns to --list: buildid (ELF build ID,\n"
+            "                    else SHA-256) or sha256 (whole file); cached per binary\n"
+            "  --agent EP        Send listener snapshot and deltas to a collector at EP\n"
+            "  --collect EP      Run a fleet collector listening on EP\n"
+            "  --query EP        Ask the collector at EP for listeners (honours --ports/--proto)\n"
+            "                    EP is unix:/path or ADDR:PORT\n"
+            "  --name NAME       Host name announced by --agent (default: hostname)\n"
+            "  --interval SECS   Seconds between periodic ticks (default %d)\n"
+            "  --iterations N    Stop after N periodic ticks (default: run forever)\n"
+            "  --watch           Print listener changes every --interval; ticks on an\n"
+            "                    unchanged host cost a few syscalls, not a /proc walk\n"
+            "  --shard I/N       Only handle ports with port %% N == I (combine with --merge)\n"
+            "  --snapshot FILE   Write the listener set as a sorted snapshot file (- for stdout)\n"
+            "  --merge OUT IN... K-way merge sorted snapshot files of one host into OUT\n"
+            "  --dump FILE       Print a snapshot file\n"
+            "  --probe KIND      Concurrent probe of --ports: connect, banner, redis, postgres,\n"
+            "                    http, tls or auto (by port); honours --timeout\n"
+            "  --concurrency N   Probes in flight (default %d)\n"
+            "  --verify          Connect-probe only the kernel's TCP listeners and report\n"
+            "                    listeners a firewall filters; wildcard ones at --host\n"
+            "  --reach           Probe our TCP listeners from every network namespace and\n"
+            "                    print a namespace x listener reachability matrix\n"
+            "  --netns LIST      Namespaces for --reach: PIDs or /run/netns names\n"
+            "  --udp             Active UDP scan of --ports with DNS/NTP/SNMP/memcached/QUIC\n"
+            "                    payloads; paced to the ICMP rate limit, honours --timeout\n"
+            "  --ephemeral       Outgoing TCP connections per (source, destination, port)\n"
+            "                    against ip_local_port_range, with TIME_WAIT and owners;\n"
+            "                    --ports filters destination ports\n"
+            "  --leaks           Every --interval, report processes whose CLOSE_WAIT,\n"
+            "                    FIN_WAIT2 or socket counts keep growing, with rates\n"
+            "  --mem             Socket buffer memory, queued bytes and drops per process and\n"
+            "                    per listener (--ports: listener ports, --pid, --json); with\n"
+            "                    --list, adds RMEM/WMEM/QUEUED/DROPS columns per socket\n"
+            "  --fds             Processes closest to their open-file limit, with their\n"
+            "                    socket share (counts come from the owner fd walk; --pid)\n"
+            "  --fast-names      Resolve users/services from /etc/passwd and /etc/services\n"
+            "                    directly; only unknown ids go through NSS\n"
+            "  --fd-walk KIND    Socket owner discovery: procfs (readlink per fd, the\n"
+            "                    default; auto is the same), uring (batched statx) or bpf\n"
+            "                    (task_file iterator)\n"
+            "  --stats           On exit, print wall time, CPU time and hardware counters\n"
+            "                    (cycles, instructions, IPC, cache/branch misses, context\n"
+            "                    switches) per phase and thread to stderr, then allocations\n"
+            "                    and heap high-water mark per phase, VmHWM and VmRSS\n"
+            "  --help            Show this help\n",
+            prog, LAT_COUNT, LAT_RATE, LAT_TIMEOUT, AGENT_INTERVAL, PROBE_CONCURRENCY);
+}
+
+// Function to parse the command line into the global options
+int parse_options(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        const char *arg = argv[i];                        // Current option
+        const char *val = i + 1 < argc ? argv[i + 1] : NULL; // Its value, if any
+
+        if (strcmp(arg, "--latency") == 0)
+            opts.mode = MODE_LATENCY;
+        else if (strcmp(arg, "--first-byte") == 0)
+            opts.first_byte = 1;
+        else if (strcmp(arg, "--fast-names") == 0)
+            opts.fast_names = 1;
+        else if (strcmp(arg, "--probe") == 0 && val)
+        {
+            opts.mode = MODE_PROBE;
+            opts.probe = argv[++i];
+        }
+        else if (strcmp(arg, "--verify") == 0)
+            opts.mode = MODE_VERIFY;
+        else if (strcmp(arg, "--reach") == 0)
+            opts.mode = MODE_REACH;
+        else if (strcmp(arg, "--udp") == 0)
+            opts.mode = MODE_UDP;
+        else if (strcmp(arg, "--watch") == 0)
+            opts.mode = MODE_WATCH;
+        else if (strcmp(arg, "--ephemeral") == 0)
+            opts.mode = MODE_EPHEMERAL;
+        else if (strcmp(arg, "--leaks") == 0)
+            opts.mode = MODE_LEAKS;
+        else if (strcmp(arg, "--mem") == 0)
+            opts.mem = 1;
+        else if (strcmp(arg, "--fds") == 0)
+            opts.mode = MODE_FDS;
+        else if (strcmp(arg, "--stats") == 0)
+            opts.stats = 1;
+        else if (strcmp(arg, "--exe") == 0 && val)
+        {
+            const char *e = argv[++i]; // Identity kind
+            if (strcmp(e, "buildid") == 0)
+                opts.exe = EXE_BUILDID;
+            else if (strcmp(e, "sha256") == 0)
+                opts.exe = EXE_SHA256;
+            else
+                return -1;
+        }
+        else if (strcmp(arg, "--netns") == 0 && val)
+            opts.netns = argv[++i];
+        else if (strcmp(arg, "--concurrency") == 0 && val)
+            opts.concurrency = atoi(argv[++i]);
+        else if (strcmp(arg, "--stream") == 0)
+            opts.mode = MODE_STREAM;
+        else if (strcmp(arg, "--list") == 0)
+            opts.mode = MODE_LIST;
+        else if (strcmp(arg, "--sort") == 0 && val)
+            opts.sort = argv[++i];
+        else if (strcmp(arg, "--pid") == 0 && val)
+            opts.pid = atoi(argv[++i]);
+        else if (strcmp(arg, "--uid") == 0 && val)
+            opts.uid = atol(argv[++i]);
+        else if (strcmp(arg, "--json") == 0)
+            opts.json = 1;
+        else if (strcmp(arg, "--fd-walk") == 0 && val)
+        {
+            const char *w = argv[++i]; // Backend name
+            if (strcmp(w, "auto") == 0)
+                opts.fd_walk = FDWALK_AUTO;
+            else if (strcmp(w, "procfs") == 0)
+                opts.fd_walk = FDWALK_PROCFS;
+            else if (strcmp(w, "uring") == 0)
+                opts.fd_walk = FDWALK_URING;
+            else if (strcmp(w, "bpf") == 0)
+                opts.fd_walk = FDWALK_BPF;
+            else
+                return -1;
+        }
+        else if (strcmp(arg, "--proto") == 0 && val)
+        {
+            opts.protos = parse_proto_list(argv[++i]);
+            if (opts.protos <= 0)
+                return -1;
+        }
+        else if (strcmp(arg, "--state") == 0 && val)
+            opts.state = argv[++i];
+        else if (strcmp(arg, "--agent") == 0 && val)
+        {
+            opts.mode = MODE_AGENT;
+            opts.agent = argv[++i];
+        }
+        else if (strcmp(arg, "--collect") == 0 && val)
+        {
+            opts.mode = MODE_COLLECT;
+            opts.collect = argv[++i];
+        }
+        else if (strcmp(arg, "--query") == 0 && val)
+        {
+            opts.mode = MODE_QUERY;
+            opts.query = argv[++i];
+        }
+        else if (strcmp(arg, "--name") == 0 && val)
+            opts.name = argv[++i];
+        else if (strcmp(arg, "--interval") == 0 && val)
+            opts.interval = atoi(argv[++i]);
+        else if (strcmp(arg, "--iterations") == 0 && val)
+            opts.iterations = atol(argv[++i]);
+        else if (strcmp(arg, "--shard") == 0 && val)
+        {
+            if (sscanf(argv[++i], "%d/%d", &opts.shard, &opts.shards) != 2 ||
+                opts.shards <= 0 || opts.shard < 0 || opts.shard >= opts.shards)
+                return -1;
+        }
+        else if (strcmp(arg, "--snapshot") == 0 && val)
+        {
+            opts.mode = MODE_SNAPSHOT;
+            opts.snapshot = argv[++i];
+        }
+        else if (strcmp(arg, "--merge") == 0 && val)
+        {
+            opts.mode = MODE_MERGE;
+            opts.merge = argv[++i];
+        }
+        else if (strcmp(arg, "--dump") == 0 && val)
+        {
+            opts.mode = MODE_DUMP;
+            opts.dump = argv[++i];
+        }
+        else if (opts.mode == MODE_MERGE && arg[0] != '-')
+        { // Merge inputs are positional
+            opts.inputs = argv + i;
+            while (i + 1 < argc && argv[i + 1][0] != '-')
+                i++;
+            opts.ninputs = (int)(argv + i + 1 - opts.inputs);
+        }
+        else if (strcmp(arg, "--host") == 0 && val)
+            opts.host = argv[++i];
+        else if (strcmp(arg, "--ports") == 0 && val)
+            opts.ports = argv[++i];
+        else if (strcmp(arg, "--count") == 0 && val)
+            opts.count = atoi(argv[++i]);
+        else if (strcmp(arg, "--rate") == 0 && val)
+            opts.rate = atoi(argv[++i]);
+        else if (strcmp(arg, "--timeout") == 0 && val)
+            opts.timeout_ms = atoi(argv[++i]);
+        else
+            return -1; // Unknown option, missing value or --help
+    }
+    if (inet_addr(opts.host) == INADDR_NONE || opts.count <= 0 || opts.rate <= 0 ||
+        opts.timeout_ms <= 0 || opts.interval < 0 || opts.iterations < 0 || opts.concurrency <= 0)
+        return -1; // Invalid values
+    if (opts.mem && opts.mode == MODE_SCAN)
+        opts.mode = MODE_MEM; // --mem alone is the memory report; with --list it adds columns
+    return 0;
+}
+
+// Main program entry point
+int main(int argc, char **argv)
+{
+    static unsigned char port_set[(END_PORT + 1) / 8]; // Ports selected with --ports
+
+    // Store our own process ID to avoid self-detection later
+    our_pid = getpid();
+
+    // Parse command line and port selection
+    if (parse_options(argc, argv) < 0 ||
+        (opts.ports && parse_port_list(opts.ports, port_set) <= 0) ||
+        (opts.mode == MODE_MERGE && opts.ninputs == 0))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    if (opts.shards)
+    { // Narrow the selection (or the full range) to this shard's ports
+        if (!opts.ports)
+            memset(port_set, 0xff, sizeof(port_set));
+        for (int port = 0; port <= END_PORT; port++)
+            if (port % opts.shards != opts.shard)
+                port_set[port >> 3] &= ~(1 << (port & 7));
+    }
+    const unsigned char *sel = opts.ports || opts.shards ? port_set : NULL; // Port selection
+    if (opts.stats)
+    { // Report per-phase time and counters however the mode ends
+        stats_start_ns = now_ns();
+        atexit(stats_report);
+    }
+    if (opts.mode == MODE_PROBE || opts.mode == MODE_VERIFY || opts.mode == MODE_REACH)
+        probe_fd_budget(); // Each probe in flight holds a descriptor
+
+    // Dispatch to the requested mode
+    if (opts.mode == MODE_LATENCY)
+        return run_latency(sel);
+    if (opts.mode == MODE_STREAM)
+        return run_stream(sel);
+    if (opts.mode == MODE_LIST)
+        return run_list(sel);
+    if (opts.mode == MODE_AGENT)
+        return run_agent(sel);
+    if (opts.mode == MODE_COLLECT)
+        return run_collector();
+    if (opts.mode == MODE_QUERY)
+        return run_query(sel);
+    if (opts.mode == MODE_SNAPSHOT)
+        return run_snapshot(sel);
+    if (opts.mode == MODE_MERGE)
+        return run_merge();
+    if (opts.mode == MODE_DUMP)
+        return run_dump();
+    if (opts.mode == MODE_VERIFY)
+        return run_verify(sel);
+    if (opts.mode == MODE_REACH)
+        return run_reach(sel);
+    if (opts.mode == MODE_UDP)
+        return run_udp(sel);
+    if (opts.mode == MODE_WATCH)
+        return run_watch(sel);
+    if (opts.mode == MODE_EPHEMERAL)
+        return run_ephemeral(sel);
+    if (opts.mode == MODE_LEAKS)
+        return run_leaks();
+    if (opts.mode == MODE_MEM)
+        return run_mem(sel);
+    if (opts.mode == MODE_FDS)
+        return run_fds();
+    if (opts.mode == MODE_PROBE)
+        return run_probe(sel);
+
+    // Initialize required structures for socket operations
+    const char *service;     // Will hold the service name from the system database
+    struct sockaddr_in addr; // Will hold socket addressing information
+    int sock;                // Will store socket file descriptor
+
+    // Print program banner and scanning range
+    printf("Scanning %s ports %s...\n\n", opts.host, opts.ports ? opts.ports : "1 to 65535");
+    if (opts.shards)
+        printf("Shard %d of %d (ports with port %% %d == %d)\n\n", opts.shard, opts.shards, opts.shards, opts.shard);
+
+    // Print formatted header with column titles
+    printf("\nPort Scanner Results\n"); // Main title
+    printf("%-*s %-*s %-*s %-*s\n",     // Column headers with proper width
+           COL_PORT, "PORT",            // Port number column
+           COL_STATE, "STATE",          // Port state column
+           COL_SERVICE, "SERVICE",      // Service name column
+           COL_PROC, "PROCESS");        // Process information column
+
+    // Print separator line for visual clarity
+    printf("%-*s %-*s %-*s %-*s\n",                     // Separator line with matching widths
+           COL_PORT, "--------",                        // Port column separator
+           COL_STATE, "-----------",                    // State column separator
+           COL_SERVICE, "-------------------",          // Service column separator
+           COL_PROC, "------------------------------"); // Process column separator
+
+    // Scan each port in the specified range
+    stats_begin(PHASE_PROBE);
+    for (int port = START_PORT; port <= END_PORT; port++)
+    {
+        // Skip ports outside the --ports/--shard selection
+        if (sel && !port_in_set(sel, port))
+            continue;
+
         // Create new TCP socket for port testing
         sock = socket(AF_INET, SOCK_STREAM, 0);
         if (sock < 0)
@@ -222,14 +8963,14 @@ int main(void) // void explicitly states no parameters are expected
         // Setup socket address structure
         memset(&addr, 0, sizeof(addr));                // Clear structure
         addr.sin_family = AF_INET;                     // Set IPv4
-        addr.sin_addr.s_addr = inet_addr("127.0.0.1"); // Use localhost
+        addr.sin_addr.s_addr = inet_addr(opts.host);   // Use scan target
         addr.sin_port = htons(port);                   // Set port (network byte order)
 
         // Attempt connection to port
         if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0)
         {
             // Port is open - gather information
-            service = getservbyport(htons(port), "tcp"); // Get service name
+            service = resolve_service(port, "tcp");      // Get service name
             int port_state = check_port_state(port);     // Check port state
             char *proc_info = get_process_info(port);    // Get process info
 
@@ -242,12 +8983,13 @@ int main(void) // void explicitly states no parameters are expected
                                        :                  // Show ESTABLISHED if state is 1
                        "OPEN",                            // Show OPEN for other states
                    COL_SERVICE,                           // Service column with fixed width
-                   service ? service->s_name : "unknown", // Service name if available
+                   service ? service : "unknown",         // Service name if available
                    proc_info[0] ? proc_info : "unknown"); // Process info if available
         }
 
         close(sock); // Clean up socket
     }
+    stats_end();
 
     return 0; // Return success status to operating system
 }
\ No newline at end of file